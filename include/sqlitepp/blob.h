@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+struct sqlite3_blob;
+namespace sqlitepp {
+	class database;
+
+	/**
+	 * \brief Incremental access to a single blob value using sqlite3_blob_open()
+	 *
+	 * Reads and writes happen in place, without loading the whole value. A blob can not change its size,
+	 * preallocate it by binding zeroblob{ size } and fill it afterwards:
+	 *
+	 * statement stmt(db, "INSERT INTO files (data) VALUES (?);");
+	 * stmt.bind(1, zeroblob{ size });
+	 * stmt.execute();
+	 * blob_stream blob(db, "files", "data", db.last_insert_rowid(), blob_stream::mode::read_write);
+	 * blob.write(chunk.data(), chunk.size());
+	 *
+	 * The stream is invalidated (reads and writes throw error_code::abort) if the row is modified or deleted
+	 * by another statement, use reopen() to continue with another row of the same column.
+	 */
+	class blob_stream {
+	public:
+		enum class mode {
+			read,
+			read_write
+		};
+	private:
+		database* m_db;
+		sqlite3_blob* m_handle;
+		int64_t m_size;
+		int64_t m_pos;
+	public:
+		blob_stream(database& db, const std::string& table, const std::string& column, int64_t rowid, mode m = mode::read, const std::string& schema = "main");
+		blob_stream(blob_stream&& other) noexcept;
+		blob_stream& operator=(blob_stream&& other) noexcept;
+
+		blob_stream(const blob_stream& other) = delete;
+		blob_stream& operator=(const blob_stream& other) = delete;
+
+		~blob_stream() noexcept;
+
+		sqlite3_blob* raw() const noexcept { return m_handle; }
+		int64_t size() const noexcept { return m_size; }
+		int64_t tell() const noexcept { return m_pos; }
+		/**
+		 * \brief Set the position of the next read or write, pos must not exceed size()
+		 */
+		void seek(int64_t pos);
+
+		/**
+		 * \brief Read up to size bytes at the current position, returns the number of bytes read (0 at the end)
+		 */
+		size_t read(void* data, size_t size);
+		/**
+		 * \brief Read size bytes at offset without moving the current position
+		 */
+		void read_at(int64_t offset, void* data, size_t size) const;
+		/**
+		 * \brief Write size bytes at the current position, throws std::out_of_range if the blob is too small
+		 */
+		void write(const void* data, size_t size);
+		void write_at(int64_t offset, const void* data, size_t size);
+
+		/**
+		 * \brief Move the stream to the same column of another row, the position is reset to 0
+		 */
+		void reopen(int64_t rowid);
+		void close() noexcept;
+	};
+
+	/**
+	 * \brief std::streambuf reading and writing a blob_stream in chunks of chunk_size bytes
+	 *
+	 * blob_streambuf buf(blob_stream(db, "files", "data", rowid));
+	 * std::istream in(&buf);
+	 *
+	 * Only chunk_size bytes are buffered. Written data is flushed on sync(), seek and destruction.
+	 * Writing past the end of the blob fails, as blobs can not grow.
+	 */
+	class blob_streambuf : public std::streambuf {
+		blob_stream m_stream;
+		std::vector<char> m_buffer;
+		// Offset of the first buffered byte in the blob
+		int64_t m_offset;
+
+		int64_t position() const noexcept;
+		void flush_put();
+	protected:
+		int_type underflow() override;
+		int_type overflow(int_type c) override;
+		int sync() override;
+		pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+		pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+		std::streamsize showmanyc() override;
+	public:
+		explicit blob_streambuf(blob_stream stream, size_t chunk_size = 64 * 1024);
+		~blob_streambuf() override;
+
+		blob_streambuf(const blob_streambuf& other) = delete;
+		blob_streambuf& operator=(const blob_streambuf& other) = delete;
+
+		blob_stream& stream() noexcept { return m_stream; }
+	};
+}
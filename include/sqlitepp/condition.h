@@ -1,8 +1,15 @@
 #pragma once
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <initializer_list>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
 #include <type_traits>
 
 #include <sqlitepp/fwd.h>
+#include <sqlitepp/statement.h>
 
 namespace sqlitepp {
 namespace orm {
@@ -10,192 +17,463 @@ namespace orm {
     struct partial {
         std::string query {};
         std::array<db_value,Size> params {};
+
+        /**
+         * \brief Query text with whitespace and redundant parentheses removed, see canonical_condition()
+         */
+        std::string canonical() const { return canonical_condition(query); }
+        /**
+         * \brief Hash of canonical(), equal for conditions that only differ in their parameters
+         */
+        uint64_t shape_hash() const { return sqlitepp::shape_hash(canonical()); }
     };
 
     template<size_t LhsSize, size_t RhsSize>
     struct condition;
 
+    namespace detail {
+        inline std::string quote_column(const std::string& name) {
+            std::string res;
+            res.reserve(name.size() + 2);
+            res += '`';
+            res += name;
+            res += '`';
+            return res;
+        }
+
+        /**
+         * \brief Type tags of the values packed by col::in(), decoded by the sqlitepp_array table function
+         */
+        enum class array_tag : uint8_t {
+            null,
+            integer,
+            real,
+            text,
+            blob
+        };
+
+        inline void append_array_raw(db_blob_type& out, array_tag tag, const void* data, size_t size) {
+            auto pos = out.size();
+            out.resize(pos + 1 + size);
+            out[pos] = static_cast<uint8_t>(tag);
+            if(size != 0) memcpy(out.data() + pos + 1, data, size);
+        }
+
+        inline void append_array_bytes(db_blob_type& out, array_tag tag, const void* data, size_t size) {
+            if(size > UINT32_MAX) throw std::length_error("array element too large");
+            auto len = static_cast<uint32_t>(size);
+            append_array_raw(out, tag, &len, sizeof(len));
+            auto pos = out.size();
+            out.resize(pos + size);
+            if(size != 0) memcpy(out.data() + pos, data, size);
+        }
+
+        inline void append_array_value(db_blob_type& out, const db_value& val) {
+            if(auto i = std::get_if<db_integer_type>(&val)) append_array_raw(out, array_tag::integer, i, sizeof(*i));
+            else if(auto d = std::get_if<db_real_type>(&val)) append_array_raw(out, array_tag::real, d, sizeof(*d));
+            else if(auto str = std::get_if<db_text_type>(&val)) append_array_bytes(out, array_tag::text, str->data(), str->size());
+            else if(auto blob = std::get_if<db_blob_type>(&val)) append_array_bytes(out, array_tag::blob, blob->data(), blob->size());
+            else append_array_raw(out, array_tag::null, nullptr, 0);
+        }
+
+        template<typename U>
+        void append_array_element(db_blob_type& out, const U& val) {
+            if constexpr(std::is_same<U, db_value>::value) {
+                append_array_value(out, val);
+            } else if constexpr(std::is_same<U, std::string>::value) {
+                append_array_bytes(out, array_tag::text, val.data(), val.size());
+            } else if constexpr(std::is_integral<U>::value || std::is_enum<U>::value) {
+                db_integer_type i = static_cast<db_integer_type>(val);
+                append_array_raw(out, array_tag::integer, &i, sizeof(i));
+            } else if constexpr(std::is_floating_point<U>::value) {
+                db_real_type d = static_cast<db_real_type>(val);
+                append_array_raw(out, array_tag::real, &d, sizeof(d));
+            } else {
+                append_array_value(out, db_value(val));
+            }
+        }
+    }
+
     struct col {
         std::string name {};
 
-        condition<0,1> operator==(const db_value& rhs);
-        condition<0,1> operator!=(const db_value& rhs);
+        condition<0,1> operator==(const db_value& rhs) const;
+        condition<0,1> operator!=(const db_value& rhs) const;
+
+        condition<0,0> operator==(std::nullptr_t) const;
+        condition<0,0> operator!=(std::nullptr_t) const;
 
-        condition<0,0> operator==(std::nullptr_t);
-        condition<0,0> operator!=(std::nullptr_t);
+        condition<0,2> between(const db_value& min, const db_value& max) const;
+        condition<0,2> not_between(const db_value& min, const db_value& max) const;
+        condition<0,1> like(const std::string& str) const;
+        condition<0,1> glob(const std::string& str) const;
 
-        condition<0,2> between(const db_value& min, const db_value& max);
-        condition<0,2> not_between(const db_value& min, const db_value& max);
-        condition<0,1> like(const std::string& str);
-        condition<0,1> glob(const std::string& str);
+        condition<0,1> operator>(const db_value& rhs) const;
+        condition<0,1> operator>=(const db_value& rhs) const;
+        condition<0,1> operator<(const db_value& rhs) const;
+        condition<0,1> operator<=(const db_value& rhs) const;
 
-        condition<0,1> operator>(const db_value& rhs);
-        condition<0,1> operator>=(const db_value& rhs);
-        condition<0,1> operator<(const db_value& rhs);
-        condition<0,1> operator<=(const db_value& rhs);
+        /**
+         * \brief Column is one of the values in the range.
+         * 
+         * The values are packed into a single blob parameter expanded by the sqlitepp_array table function,
+         * so the query text is the same for any number of values and SQLITE_MAX_VARIABLE_NUMBER does not apply.
+         * The size of the list is only limited by the maximum blob size (SQLITE_MAX_LENGTH).
+         */
+        template<typename Range>
+        condition<0,1> in(const Range& values) const;
+        condition<0,1> in(std::initializer_list<db_value> values) const;
+        template<typename Range>
+        condition<0,1> not_in(const Range& values) const;
+        condition<0,1> not_in(std::initializer_list<db_value> values) const;
+    private:
+        template<size_t Size>
+        condition<0,Size> make(const char* op, const char* rhs, std::array<db_value,Size> params) const;
     };
 
+    /**
+     * \brief A condition of the form lhs op rhs, the sizes are the number of parameters of each side.
+     *
+     * op always points to a string literal. The query text is rendered into a single preallocated
+     * string by as_partial(), combining temporaries using && / || / ! moves their text and parameters.
+     */
     template<size_t LhsSize, size_t RhsSize>
     struct condition {
         partial<LhsSize> lhs {};
-        std::string op {};
+        const char* op {""};
         partial<RhsSize> rhs {};
 
+        size_t size() const noexcept {
+            return lhs.query.size() + std::char_traits<char>::length(op) + rhs.query.size() + 2;
+        }
+        void render(std::string& out) const {
+            out += lhs.query;
+            out += ' ';
+            out += op;
+            out += ' ';
+            out += rhs.query;
+        }
         std::string str() const {
-            return lhs.query + " " + op + " " + rhs.query;
+            std::string res;
+            res.reserve(size());
+            render(res);
+            return res;
         }
-        partial<LhsSize+RhsSize> as_partial() const {
+        std::string canonical() const { return canonical_condition(str()); }
+        uint64_t shape_hash() const { return sqlitepp::shape_hash(canonical()); }
+        partial<LhsSize+RhsSize> as_partial() const & {
             partial<LhsSize+RhsSize> p;
-            p.query = lhs.query + " " + op + " " + rhs.query;
+            p.query = str();
             std::copy(lhs.params.begin(), lhs.params.end(), p.params.begin());
             std::copy(rhs.params.begin(), rhs.params.end(), p.params.begin() + LhsSize);
             return p;
         }
+        partial<LhsSize+RhsSize> as_partial() && {
+            partial<LhsSize+RhsSize> p;
+            p.query = str();
+            std::move(lhs.params.begin(), lhs.params.end(), p.params.begin());
+            std::move(rhs.params.begin(), rhs.params.end(), p.params.begin() + LhsSize);
+            return p;
+        }
+        /**
+         * \brief Same as as_partial() with the query wrapped in parentheses
+         */
+        partial<LhsSize+RhsSize> as_group() const & {
+            partial<LhsSize+RhsSize> p;
+            group_query(p.query);
+            std::copy(lhs.params.begin(), lhs.params.end(), p.params.begin());
+            std::copy(rhs.params.begin(), rhs.params.end(), p.params.begin() + LhsSize);
+            return p;
+        }
+        partial<LhsSize+RhsSize> as_group() && {
+            partial<LhsSize+RhsSize> p;
+            group_query(p.query);
+            std::move(lhs.params.begin(), lhs.params.end(), p.params.begin());
+            std::move(rhs.params.begin(), rhs.params.end(), p.params.begin() + LhsSize);
+            return p;
+        }
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Weffc++"
         template<size_t OLhsSize, size_t ORhsSize>
-        condition<LhsSize+RhsSize,OLhsSize+ORhsSize> operator&&(const condition<OLhsSize,ORhsSize>& other);
+        condition<LhsSize+RhsSize,OLhsSize+ORhsSize> operator&&(const condition<OLhsSize,ORhsSize>& other) const & {
+            return { as_group(), "AND", other.as_group() };
+        }
+        template<size_t OLhsSize, size_t ORhsSize>
+        condition<LhsSize+RhsSize,OLhsSize+ORhsSize> operator&&(condition<OLhsSize,ORhsSize>&& other) && {
+            return { std::move(*this).as_group(), "AND", std::move(other).as_group() };
+        }
+        template<size_t OLhsSize, size_t ORhsSize>
+        condition<LhsSize+RhsSize,OLhsSize+ORhsSize> operator||(const condition<OLhsSize,ORhsSize>& other) const & {
+            return { as_group(), "OR", other.as_group() };
+        }
         template<size_t OLhsSize, size_t ORhsSize>
-        condition<LhsSize+RhsSize,OLhsSize+ORhsSize> operator||(const condition<OLhsSize,ORhsSize>& other);
+        condition<LhsSize+RhsSize,OLhsSize+ORhsSize> operator||(condition<OLhsSize,ORhsSize>&& other) && {
+            return { std::move(*this).as_group(), "OR", std::move(other).as_group() };
+        }
 #pragma GCC diagnostic pop
-        condition<0, LhsSize + RhsSize> operator!();
+        condition<0, LhsSize + RhsSize> operator!() const & {
+            return { {}, "NOT", as_group() };
+        }
+        condition<0, LhsSize + RhsSize> operator!() && {
+            return { {}, "NOT", std::move(*this).as_group() };
+        }
+    private:
+        void group_query(std::string& out) const {
+            out.reserve(size() + 2);
+            out += '(';
+            render(out);
+            out += ')';
+        }
     };
 
-    inline condition<0,1> col::operator==(const db_value& rhs) {
-        condition<0,1> c;
-        c.lhs = { "`" + name + "`", {} };
-        c.op = "=";
-        c.rhs = { "?", { rhs } };
-        return c;
+    /**
+     * \brief A condition composed at runtime, e.g. from optional filter fields
+     *
+     * dynamic_condition where;
+     * if(name) where &= "name"_c == *name;
+     * if(min_balance) where &= "balance"_c >= *min_balance;
+     * auto res = select_multiple<account>(db, where);
+     *
+     * The tree is stored in postfix order in a single node array, the text of all predicates in a single
+     * string and the parameters in a single vector, all allocated from the given memory resource.
+     * Pass a std::pmr::monotonic_buffer_resource over a local buffer to avoid heap allocations for small
+     * conditions. clear() keeps the allocated capacity, so a condition can be reused for the next query.
+     * An empty condition matches every row in count and select, orm::remove() rejects it.
+     * AND / OR render the same text as the static builder.
+     */
+    class dynamic_condition {
+        enum class node_kind : uint8_t {
+            predicate,
+            conjunction,
+            disjunction,
+            negation
+        };
+        struct node {
+            node_kind kind;
+            // Number of nodes in the subtree ending at this node
+            uint32_t size;
+            // Predicate text inside m_text
+            uint32_t offset;
+            uint32_t length;
+        };
+
+        std::pmr::vector<node> m_nodes;
+        std::pmr::string m_text;
+        std::pmr::vector<db_value> m_params;
+
+        void add_predicate(std::string_view sql) {
+            if(m_text.size() + sql.size() > UINT32_MAX) throw std::length_error("condition too large");
+            m_nodes.push_back({ node_kind::predicate, 1, static_cast<uint32_t>(m_text.size()), static_cast<uint32_t>(sql.size()) });
+            m_text.append(sql);
+        }
+
+        void combine(node_kind kind, const dynamic_condition& other) {
+            if(other.empty()) return;
+            if(empty()) {
+                *this = other;
+                return;
+            }
+            auto offset = static_cast<uint32_t>(m_text.size());
+            m_nodes.reserve(m_nodes.size() + other.m_nodes.size() + 1);
+            for(auto n : other.m_nodes) {
+                n.offset += offset;
+                m_nodes.push_back(n);
+            }
+            m_text.append(other.m_text);
+            m_params.insert(m_params.end(), other.m_params.begin(), other.m_params.end());
+            m_nodes.push_back({ kind, static_cast<uint32_t>(m_nodes.size() + 1), 0, 0 });
+        }
+
+        void combine(node_kind kind, dynamic_condition&& other) {
+            if(other.empty()) return;
+            if(empty()) {
+                *this = std::move(other);
+                return;
+            }
+            auto offset = static_cast<uint32_t>(m_text.size());
+            m_nodes.reserve(m_nodes.size() + other.m_nodes.size() + 1);
+            for(auto n : other.m_nodes) {
+                n.offset += offset;
+                m_nodes.push_back(n);
+            }
+            m_text.append(other.m_text);
+            m_params.insert(m_params.end(), std::make_move_iterator(other.m_params.begin()), std::make_move_iterator(other.m_params.end()));
+            m_nodes.push_back({ kind, static_cast<uint32_t>(m_nodes.size() + 1), 0, 0 });
+        }
+
+        void render_node(std::string& out, size_t idx) const {
+            auto& n = m_nodes[idx];
+            switch(n.kind) {
+            case node_kind::predicate:
+                out.append(m_text, n.offset, n.length);
+                break;
+            case node_kind::negation:
+                out += "NOT (";
+                render_node(out, idx - 1);
+                out += ')';
+                break;
+            default: {
+                auto rhs = idx - 1;
+                auto lhs = rhs - m_nodes[rhs].size;
+                out += '(';
+                render_node(out, lhs);
+                out += n.kind == node_kind::conjunction ? ") AND (" : ") OR (";
+                render_node(out, rhs);
+                out += ')';
+                break;
+            }
+            }
+        }
+    public:
+        explicit dynamic_condition(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : m_nodes(resource), m_text(resource), m_params(resource)
+        {}
+        /**
+         * \brief A single predicate with raw SQL text, params are bound to its placeholders
+         */
+        explicit dynamic_condition(std::string_view sql, std::initializer_list<db_value> params = {}, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : dynamic_condition(resource)
+        {
+            add_predicate(sql);
+            m_params.assign(params.begin(), params.end());
+        }
+        template<size_t A, size_t B>
+        dynamic_condition(const condition<A,B>& cond, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : dynamic_condition(resource)
+        {
+            std::string sql;
+            sql.reserve(cond.size());
+            cond.render(sql);
+            add_predicate(sql);
+            m_params.reserve(A + B);
+            m_params.insert(m_params.end(), cond.lhs.params.begin(), cond.lhs.params.end());
+            m_params.insert(m_params.end(), cond.rhs.params.begin(), cond.rhs.params.end());
+        }
+
+        bool empty() const noexcept { return m_nodes.empty(); }
+        /**
+         * \brief Remove all predicates and parameters, keeping the allocated memory
+         */
+        void clear() noexcept {
+            m_nodes.clear();
+            m_text.clear();
+            m_params.clear();
+        }
+
+        dynamic_condition& operator&=(const dynamic_condition& other) { combine(node_kind::conjunction, other); return *this; }
+        dynamic_condition& operator&=(dynamic_condition&& other) { combine(node_kind::conjunction, std::move(other)); return *this; }
+        dynamic_condition& operator|=(const dynamic_condition& other) { combine(node_kind::disjunction, other); return *this; }
+        dynamic_condition& operator|=(dynamic_condition&& other) { combine(node_kind::disjunction, std::move(other)); return *this; }
+        /**
+         * \brief Negate the condition in place, an empty condition stays empty
+         */
+        dynamic_condition& negate() {
+            if(!empty()) m_nodes.push_back({ node_kind::negation, static_cast<uint32_t>(m_nodes.size() + 1), 0, 0 });
+            return *this;
+        }
+
+        /**
+         * \brief Append the SQL text to out, nothing is appended for an empty condition
+         */
+        void render(std::string& out) const {
+            if(empty()) return;
+            out.reserve(out.size() + m_text.size() + m_nodes.size() * 8);
+            render_node(out, m_nodes.size() - 1);
+        }
+        std::string str() const {
+            std::string res;
+            render(res);
+            return res;
+        }
+        const std::pmr::vector<db_value>& params() const noexcept { return m_params; }
+        std::vector<db_value> param_vector() const & { return { m_params.begin(), m_params.end() }; }
+        std::vector<db_value> param_vector() && {
+            return { std::make_move_iterator(m_params.begin()), std::make_move_iterator(m_params.end()) };
+        }
+    };
+
+    inline dynamic_condition operator&&(dynamic_condition lhs, const dynamic_condition& rhs) { return std::move(lhs &= rhs); }
+    inline dynamic_condition operator||(dynamic_condition lhs, const dynamic_condition& rhs) { return std::move(lhs |= rhs); }
+    inline dynamic_condition operator!(dynamic_condition cond) { return std::move(cond.negate()); }
+
+    template<size_t Size>
+    inline condition<0,Size> col::make(const char* op, const char* rhs, std::array<db_value,Size> params) const {
+        return { { detail::quote_column(name), {} }, op, { rhs, std::move(params) } };
     }
 
-    inline condition<0,1> col::operator!=(const db_value& rhs) {
-        condition<0,1> c;
-        c.lhs = { "`" + name + "`", {} };
-        c.op = "<>";
-        c.rhs = { "?", { rhs } };
-        return c;
+    inline condition<0,1> col::operator==(const db_value& rhs) const {
+        return make<1>("=", "?", { rhs });
     }
 
-    inline condition<0,0> col::operator==(std::nullptr_t) {
-        condition<0,0> c;
-        c.lhs = { "`" + name + "`", {} };
-        c.op = "IS";
-        c.rhs = { "NULL", {} };
-        return c;
+    inline condition<0,1> col::operator!=(const db_value& rhs) const {
+        return make<1>("<>", "?", { rhs });
     }
 
-    inline condition<0,0> col::operator!=(std::nullptr_t) {
-        condition<0,0> c;
-        c.lhs = { "`" + name + "`", {} };
-        c.op = "IS NOT";
-        c.rhs = { "NULL", {} };
-        return c;
+    inline condition<0,0> col::operator==(std::nullptr_t) const {
+        return make<0>("IS", "NULL", {});
     }
 
-    inline condition<0,2> col::between(const db_value& min, const db_value& max) {
-        condition<0,2> c;
-        c.lhs = { "`" + name + "`", {} };
-        c.op = "BETWEEN";
-        c.rhs = { "? AND ?", { min, max } };
-        return c;
+    inline condition<0,0> col::operator!=(std::nullptr_t) const {
+        return make<0>("IS NOT", "NULL", {});
     }
 
-    inline condition<0,2> col::not_between(const db_value& min, const db_value& max) {
-        condition<0,2> c;
-        c.lhs = { "`" + name + "`", {} };
-        c.op = "NOT BETWEEN";
-        c.rhs = { "? AND ?", { min, max } };
-        return c;
+    inline condition<0,2> col::between(const db_value& min, const db_value& max) const {
+        return make<2>("BETWEEN", "? AND ?", { min, max });
     }
 
-    inline condition<0,1> col::like(const std::string& str) {
-        condition<0,1> c;
-        c.lhs = { "`" + name + "`", {} };
-        c.op = "LIKE";
-        c.rhs = { "?", { str } };
-        return c;
+    inline condition<0,2> col::not_between(const db_value& min, const db_value& max) const {
+        return make<2>("NOT BETWEEN", "? AND ?", { min, max });
     }
 
-    inline condition<0,1> col::glob(const std::string& str) {
-        condition<0,1> c;
-        c.lhs = { "`" + name + "`", {} };
-        c.op = "GLOB";
-        c.rhs = { "?", { str } };
-        return c;
+    inline condition<0,1> col::like(const std::string& str) const {
+        return make<1>("LIKE", "?", { str });
     }
 
-    inline condition<0,1> col::operator>(const db_value& rhs) {
-        condition<0,1> c;
-        c.lhs = { "`" + name + "`", {} };
-        c.op = ">";
-        c.rhs = { "?", { rhs } };
-        return c;
+    inline condition<0,1> col::glob(const std::string& str) const {
+        return make<1>("GLOB", "?", { str });
     }
 
-    inline condition<0,1> col::operator>=(const db_value& rhs) {
-        condition<0,1> c;
-        c.lhs = { "`" + name + "`", {} };
-        c.op = ">=";
-        c.rhs = { "?", { rhs } };
-        return c;
+    inline condition<0,1> col::operator>(const db_value& rhs) const {
+        return make<1>(">", "?", { rhs });
     }
 
-    inline condition<0,1> col::operator<(const db_value& rhs) {
-        condition<0,1> c;
-        c.lhs = { "`" + name + "`", {} };
-        c.op = "<";
-        c.rhs = { "?", { rhs } };
-        return c;
+    inline condition<0,1> col::operator>=(const db_value& rhs) const {
+        return make<1>(">=", "?", { rhs });
     }
 
-    inline condition<0,1> col::operator<=(const db_value& rhs) {
-        condition<0,1> c;
-        c.lhs = { "`" + name + "`", {} };
-        c.op = "<=";
-        c.rhs = { "?", { rhs } };
-        return c;
+    inline condition<0,1> col::operator<(const db_value& rhs) const {
+        return make<1>("<", "?", { rhs });
     }
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Weffc++"
-    template<size_t LhsSize, size_t RhsSize>
-    template<size_t OLhsSize, size_t ORhsSize>
-    inline condition<LhsSize+RhsSize,OLhsSize+ORhsSize> condition<LhsSize,RhsSize>::operator&&(const condition<OLhsSize,ORhsSize>& other) {
-        condition<LhsSize+RhsSize,OLhsSize+ORhsSize> c;
-        c.lhs = as_partial();
-        c.lhs.query = "(" + c.lhs.query + ")";
-        c.op = "AND";
-        c.rhs = other.as_partial();
-        c.rhs.query = "(" + c.rhs.query + ")";
-        return c;
+    inline condition<0,1> col::operator<=(const db_value& rhs) const {
+        return make<1>("<=", "?", { rhs });
     }
 
-    template<size_t LhsSize, size_t RhsSize>
-    template<size_t OLhsSize, size_t ORhsSize>
-    inline condition<LhsSize+RhsSize,OLhsSize+ORhsSize> condition<LhsSize,RhsSize>::operator||(const condition<OLhsSize,ORhsSize>& other) {
-        condition<LhsSize+RhsSize,OLhsSize+ORhsSize> c;
-        c.lhs = as_partial();
-        c.lhs.query = "(" + c.lhs.query + ")";
-        c.op = "OR";
-        c.rhs = other.as_partial();
-        c.rhs.query = "(" + c.rhs.query + ")";
-        return c;
+    template<typename Range>
+    inline condition<0,1> col::in(const Range& values) const {
+        db_blob_type data;
+        for(auto& e : values) detail::append_array_element(data, e);
+        return make<1>("IN", "sqlitepp_array(?)", { std::move(data) });
     }
-#pragma GCC diagnostic pop
 
-    template<size_t LhsSize, size_t RhsSize>
-    inline condition<0, LhsSize + RhsSize> condition<LhsSize, RhsSize>::operator!() {
-        condition<0, LhsSize + RhsSize> res = {};
-        res.op = "NOT";
-        res.rhs = as_partial();
-        res.rhs.query = "(" + res.rhs.query + ")";
+    inline condition<0,1> col::in(std::initializer_list<db_value> values) const {
+        return in<std::initializer_list<db_value>>(values);
+    }
+
+    template<typename Range>
+    inline condition<0,1> col::not_in(const Range& values) const {
+        auto res = in(values);
+        res.op = "NOT IN";
         return res;
     }
+
+    inline condition<0,1> col::not_in(std::initializer_list<db_value> values) const {
+        return not_in<std::initializer_list<db_value>>(values);
+    }
 }
 namespace literals {
-    inline orm::col operator ""_c(const char* str, std::size_t) {
-        return orm::col{str};
+    inline orm::col operator ""_c(const char* str, std::size_t len) {
+        return orm::col{ std::string(str, len) };
     }
 }
 }
\ No newline at end of file
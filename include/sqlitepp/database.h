@@ -1,11 +1,76 @@
 #pragma once
+#include <chrono>
 #include <functional>
+#include <memory>
 #include <string>
 
 struct sqlite3;
+struct sqlite3_stmt;
 namespace sqlitepp {
+	namespace detail {
+		struct statement_cache;
+	}
+	namespace orm {
+		class identity_map;
+		class index_advisor;
+	}
+
+	enum class update_operation : int {
+		insert = 18, // SQLITE_INSERT
+		remove = 9, // SQLITE_DELETE
+		update = 23 // SQLITE_UPDATE
+	};
+
+	struct statement_cache_stats {
+		// Statements served from the cache
+		uint64_t hits;
+		// Statements that had to be prepared
+		uint64_t misses;
+		// Prepared statements currently held by the cache
+		size_t idle;
+	};
+
+	/**
+	 * \brief Retry policy used while another connection holds a lock, see database::set_busy_strategy()
+	 * 
+	 * The n-th retry waits min(max_delay, initial_delay * multiplier^n), randomly shortened by up to jitter
+	 * (a fraction between 0 and 1) so competing connections do not retry in lockstep. Once timeout has passed
+	 * since the first retry, the operation fails with error_code::busy.
+	 */
+	struct busy_strategy {
+		std::chrono::milliseconds initial_delay { 1 };
+		std::chrono::milliseconds max_delay { 100 };
+		std::chrono::milliseconds timeout { 5000 };
+		double multiplier { 2.0 };
+		double jitter { 0.5 };
+	};
+
 	class database {
+	public:
+		typedef std::function<void(update_operation, const char*, const char*, int64_t)> update_hook_fn_t;
+		typedef std::function<void(const char*, int)> wal_hook_fn_t;
+		typedef std::function<bool()> progress_handler_fn_t;
+	private:
 		sqlite3* m_handle;
+		std::shared_ptr<orm::identity_map> m_identity_map;
+		std::shared_ptr<orm::index_advisor> m_index_advisor;
+		update_hook_fn_t m_update_hook;
+		wal_hook_fn_t m_wal_hook;
+		progress_handler_fn_t m_progress_handler;
+		int m_progress_instructions;
+		// Shared with the statements using cached handles, which may outlive the database
+		std::shared_ptr<detail::statement_cache> m_statement_cache;
+		struct busy_state;
+		std::unique_ptr<busy_state> m_busy;
+
+		void install_update_hook();
+		// Statements with limits replace the progress handler while stepping and restore it afterwards
+		friend class result_iterator;
+		void install_progress_handler() noexcept;
+		bool call_progress_handler() noexcept;
+
+		friend class statement;
+		sqlite3_stmt* acquire_statement(const std::string& query, std::shared_ptr<detail::statement_cache>& cache);
 	public:
 		database(const std::string& filename = ":memory:");
 
@@ -19,9 +84,60 @@ namespace sqlitepp {
 		void exec(const std::string& query, std::function<void(int, char**, char**)> fn);
 		void exec(const std::string& query);
 		void interrupt();
+		/**
+		 * \brief Let sqlite retry for up to timeout when a table is locked, 0 fails immediately (default)
+		 */
+		void busy_timeout(std::chrono::milliseconds timeout);
+		/**
+		 * \brief Retry locked operations using exponential backoff with jitter, replaces busy_timeout()
+		 */
+		void set_busy_strategy(const busy_strategy& strategy);
 		int64_t last_insert_rowid() const noexcept;
 		size_t total_changes() const noexcept;
 		sqlite3* raw() const noexcept;
+
+		/**
+		 * \brief Set a callback invoked for every row inserted, updated or deleted on this connection.
+		 * 
+		 * Arguments are the operation, the schema name, the table name and the rowid.
+		 */
+		void set_update_hook(update_hook_fn_t fn);
+		/**
+		 * \brief Set a callback invoked after each commit in WAL mode with the schema name and the number of frames in the WAL.
+		 * 
+		 * This replaces the automatic checkpoint of sqlite, checkpoints have to be run by the application
+		 * (e.g. using maintenance). Passing nullptr does not restore the automatic checkpoint.
+		 */
+		void set_wal_hook(wal_hook_fn_t fn);
+		/**
+		 * \brief Call fn about every instructions virtual machine instructions, returning true (or throwing) interrupts the statement.
+		 * 
+		 * Use this instead of sqlite3_progress_handler() on raw(): statements with a timeout or cancellation
+		 * token install their own handler while stepping, which keeps calling fn and restores it afterwards.
+		 * Pass nullptr to remove the handler.
+		 */
+		void set_progress_handler(int instructions, progress_handler_fn_t fn);
+		/**
+		 * \brief Attach an identity map used by the orm to share loaded entities, pass nullptr to disable it.
+		 * 
+		 * Uses sqlite3_update_hook and sqlite3_rollback_hook, the map is cleared when a transaction is rolled back.
+		 */
+		void set_identity_map(std::shared_ptr<orm::identity_map> map);
+		orm::identity_map* get_identity_map() const noexcept;
+		/**
+		 * \brief Attach an index advisor recording the conditions of orm queries, pass nullptr to disable it.
+		 */
+		void set_index_advisor(std::shared_ptr<orm::index_advisor> advisor);
+		orm::index_advisor* get_index_advisor() const noexcept;
+		/**
+		 * \brief Keep up to size prepared statements for reuse, 0 disables the cache (default).
+		 * 
+		 * Statements are matched by their canonical text (see canonical_sql()), so queries only differing
+		 * in whitespace share a prepared statement. A statement is returned to the cache once destroyed,
+		 * with its bindings cleared. The least recently used statements are finalized first.
+		 */
+		void set_statement_cache_size(size_t size);
+		statement_cache_stats get_statement_cache_stats() const;
 	};
 
 	bool is_threadsafe() noexcept;
@@ -102,7 +102,13 @@ namespace sqlitepp {
 		notice_recover_rollback	= SQLITE_NOTICE_RECOVER_ROLLBACK,
 		warning_autoindex		= SQLITE_WARNING_AUTOINDEX,
 		auth_user				= SQLITE_AUTH_USER,
-		ok_load_permanently		= SQLITE_OK_LOAD_PERMANENTLY
+		ok_load_permanently		= SQLITE_OK_LOAD_PERMANENTLY,
+
+		/* sqlitepp codes, sqlite reports both as SQLITE_INTERRUPT */
+		// The deadline of a statement passed, see statement::with_timeout()
+		timeout					= SQLITE_INTERRUPT | (1 << 16),
+		// The statement was cancelled, see statement::with_cancellation()
+		cancelled				= SQLITE_INTERRUPT | (2 << 16)
 	};
 
 	const std::error_category& sqlite_error_category();
@@ -112,6 +118,15 @@ namespace sqlitepp {
 		return { static_cast<int>(e), sqlite_error_category() };
 	}
 
+	/**
+	 * \brief Convert a sqlite result code, SQLITE_OK, SQLITE_ROW and SQLITE_DONE are no error
+	 */
+	inline std::error_code to_error_code(int code) noexcept
+	{
+		if(code == SQLITE_OK || code == SQLITE_ROW || code == SQLITE_DONE) return {};
+		return make_error_code(static_cast<error_code>(code));
+	}
+
 	inline void throw_if_error(int code, sqlite3* raw)
 	{
 		if(code != SQLITE_OK && code != SQLITE_ROW && code != SQLITE_DONE)
@@ -123,6 +138,15 @@ namespace sqlitepp {
 		if(code != SQLITE_OK && code != SQLITE_ROW && code != SQLITE_DONE)
 			throw std::system_error(make_error_code(static_cast<error_code>(code)), raw ? sqlite3_errmsg(sqlite3_db_handle(raw)) : "");
 	}
+
+	inline void throw_if_error(const std::error_code& ec, sqlite3_stmt* raw)
+	{
+		if(!ec) return;
+		// sqlitepp codes are unknown to sqlite, its message would only say "interrupted"
+		if(ec.category() == sqlite_error_category() && (ec.value() >> 16) != 0)
+			throw std::system_error(ec, ec.message());
+		throw std::system_error(ec, raw ? sqlite3_errmsg(sqlite3_db_handle(raw)) : "");
+	}
 }
 
 namespace std
@@ -0,0 +1,334 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sqlite3.h>
+
+namespace sqlitepp {
+	class database;
+
+	/**
+	 * \brief Flags of a user defined function, see create_function()
+	 */
+	enum class function_flags : int {
+		none = 0,
+		// Same arguments always return the same result, required to use the function in indexes
+		deterministic = SQLITE_DETERMINISTIC,
+		// Can not be used from triggers, views or schema structures
+		direct_only = SQLITE_DIRECTONLY,
+		// Has no side effects, may be used in schema structures even with trusted_schema=OFF
+		innocuous = SQLITE_INNOCUOUS
+	};
+
+	inline constexpr function_flags operator|(function_flags lhs, function_flags rhs) noexcept {
+		return static_cast<function_flags>(static_cast<int>(lhs) | static_cast<int>(rhs));
+	}
+
+	inline constexpr function_flags operator&(function_flags lhs, function_flags rhs) noexcept {
+		return static_cast<function_flags>(static_cast<int>(lhs) & static_cast<int>(rhs));
+	}
+
+	/**
+	 * \brief Fixed size buffer collecting per-row values of an aggregate or window function
+	 * 
+	 * Instead of doing expensive math once per step() call the values are buffered and processed
+	 * in blocks of up to Size values, e.g. by a simple loop the compiler can vectorize:
+	 * 
+	 * void step(double v) { m_batch.push(v, [this](const double* vals, size_t n) { for(size_t i = 0; i < n; i++) m_sum += vals[i] * vals[i]; }); }
+	 * 
+	 * Call flush() with the same function before reading the aggregated value.
+	 */
+	template<typename T, size_t Size = 64>
+	class batch_buffer {
+		static_assert(Size > 0, "batch size must not be zero");
+		std::array<T, Size> m_values {};
+		size_t m_count {};
+	public:
+		template<typename Fn>
+		void push(const T& val, Fn&& fn) {
+			m_values[m_count++] = val;
+			if(m_count == Size) flush(fn);
+		}
+		template<typename Fn>
+		void flush(Fn&& fn) {
+			if(m_count == 0) return;
+			fn(static_cast<const T*>(m_values.data()), m_count);
+			m_count = 0;
+		}
+		size_t size() const noexcept { return m_count; }
+		bool empty() const noexcept { return m_count == 0; }
+		static constexpr size_t capacity() noexcept { return Size; }
+	};
+
+	namespace detail {
+		// Defined in database.cpp
+		void register_function(database& db, const std::string& name, int args, function_flags flags, void* user,
+			void(*fn)(sqlite3_context*, int, sqlite3_value**), void(*step)(sqlite3_context*, int, sqlite3_value**),
+			void(*final)(sqlite3_context*), void(*destroy)(void*));
+		void register_window_function(database& db, const std::string& name, int args, function_flags flags,
+			void(*step)(sqlite3_context*, int, sqlite3_value**), void(*final)(sqlite3_context*),
+			void(*value)(sqlite3_context*), void(*inverse)(sqlite3_context*, int, sqlite3_value**));
+
+		template<typename T>
+		struct is_optional : std::false_type {};
+		template<typename T>
+		struct is_optional<std::optional<T>> : std::true_type {};
+
+		/**
+		 * \brief Convert a function argument to T, string_view arguments are only valid during the call
+		 */
+		template<typename T>
+		T from_value(sqlite3_value* val) {
+			if constexpr(std::is_same<T, sqlite3_value*>::value) {
+				return val;
+			} else if constexpr(is_optional<T>::value) {
+				if(sqlite3_value_type(val) == SQLITE_NULL) return std::nullopt;
+				return from_value<typename T::value_type>(val);
+			} else if constexpr(std::is_same<T, bool>::value) {
+				return sqlite3_value_int64(val) != 0;
+			} else if constexpr(std::is_integral<T>::value || std::is_enum<T>::value) {
+				return static_cast<T>(sqlite3_value_int64(val));
+			} else if constexpr(std::is_floating_point<T>::value) {
+				return static_cast<T>(sqlite3_value_double(val));
+			} else if constexpr(std::is_same<T, std::string_view>::value || std::is_same<T, std::string>::value) {
+				auto str = reinterpret_cast<const char*>(sqlite3_value_text(val));
+				return T(str ? str : "", sqlite3_value_bytes(val));
+			} else if constexpr(std::is_same<T, std::vector<uint8_t>>::value) {
+				auto ptr = static_cast<const uint8_t*>(sqlite3_value_blob(val));
+				return T(ptr, ptr + sqlite3_value_bytes(val));
+			} else {
+				static_assert(!std::is_same<T, T>::value, "unsupported function argument type");
+			}
+		}
+
+		template<typename T>
+		void set_result(sqlite3_context* ctx, const T& val) {
+			if constexpr(std::is_same<T, std::nullptr_t>::value || std::is_same<T, std::nullopt_t>::value) {
+				sqlite3_result_null(ctx);
+			} else if constexpr(is_optional<T>::value) {
+				if(val) set_result(ctx, *val);
+				else sqlite3_result_null(ctx);
+			} else if constexpr(std::is_integral<T>::value || std::is_enum<T>::value) {
+				sqlite3_result_int64(ctx, static_cast<sqlite3_int64>(val));
+			} else if constexpr(std::is_floating_point<T>::value) {
+				sqlite3_result_double(ctx, static_cast<double>(val));
+			} else if constexpr(std::is_same<T, std::string_view>::value || std::is_same<T, std::string>::value) {
+				sqlite3_result_text64(ctx, val.data(), val.size(), SQLITE_TRANSIENT, SQLITE_UTF8);
+			} else if constexpr(std::is_convertible<T, const char*>::value) {
+				sqlite3_result_text(ctx, val, -1, SQLITE_TRANSIENT);
+			} else if constexpr(std::is_same<T, std::vector<uint8_t>>::value) {
+				sqlite3_result_blob64(ctx, val.data(), val.size(), SQLITE_TRANSIENT);
+			} else {
+				static_assert(!std::is_same<T, T>::value, "unsupported function result type");
+			}
+		}
+
+		/**
+		 * \brief Report the active exception as error of the function call
+		 */
+		inline void set_exception_result(sqlite3_context* ctx) noexcept {
+			try {
+				throw;
+			} catch(const std::bad_alloc&) {
+				sqlite3_result_error_nomem(ctx);
+			} catch(const std::exception& e) {
+				sqlite3_result_error(ctx, e.what(), -1);
+			} catch(...) {
+				sqlite3_result_error(ctx, "unknown exception in user defined function", -1);
+			}
+		}
+
+		template<typename T>
+		struct callable_traits : callable_traits<decltype(&T::operator())> {};
+		template<typename R, typename... Args>
+		struct callable_traits<R(*)(Args...)> {
+			using result_type = R;
+			using args = std::tuple<std::decay_t<Args>...>;
+		};
+		template<typename C, typename R, typename... Args>
+		struct callable_traits<R(C::*)(Args...)> : callable_traits<R(*)(Args...)> {};
+		template<typename C, typename R, typename... Args>
+		struct callable_traits<R(C::*)(Args...) const> : callable_traits<R(*)(Args...)> {};
+
+		/**
+		 * \brief Decode the arguments and invoke fn, storing its result (if any) in ctx
+		 */
+		template<typename Fn, typename Args, size_t... I>
+		void invoke_function(sqlite3_context* ctx, Fn&& fn, sqlite3_value** argv, std::index_sequence<I...>) {
+			using result_type = decltype(fn(from_value<std::tuple_element_t<I, Args>>(argv[I])...));
+			if constexpr(std::is_void<result_type>::value) {
+				fn(from_value<std::tuple_element_t<I, Args>>(argv[I])...);
+				sqlite3_result_null(ctx);
+			} else {
+				set_result(ctx, fn(from_value<std::tuple_element_t<I, Args>>(argv[I])...));
+			}
+		}
+
+		template<typename Fn>
+		struct scalar_function {
+			using args = typename callable_traits<Fn>::args;
+
+			static void call(sqlite3_context* ctx, int, sqlite3_value** argv) noexcept {
+				try {
+					auto fn = static_cast<Fn*>(sqlite3_user_data(ctx));
+					invoke_function<Fn&, args>(ctx, *fn, argv, std::make_index_sequence<std::tuple_size<args>::value>());
+				} catch(...) {
+					set_exception_result(ctx);
+				}
+			}
+
+			static void destroy(void* ptr) noexcept {
+				delete static_cast<Fn*>(ptr);
+			}
+		};
+
+		/**
+		 * \brief Aggregate state stored in the sqlite aggregate context, created on the first row
+		 */
+		template<typename State>
+		struct aggregate_function {
+			using args = typename callable_traits<decltype(&State::step)>::args;
+
+			static State* state(sqlite3_context* ctx, bool create) {
+				auto ptr = static_cast<State**>(sqlite3_aggregate_context(ctx, create ? sizeof(State*) : 0));
+				if(ptr == nullptr) {
+					if(create) throw std::bad_alloc();
+					return nullptr;
+				}
+				if(*ptr == nullptr && create) *ptr = new State();
+				return *ptr;
+			}
+
+			static void release(sqlite3_context* ctx) noexcept {
+				auto ptr = static_cast<State**>(sqlite3_aggregate_context(ctx, 0));
+				if(ptr == nullptr) return;
+				delete *ptr;
+				*ptr = nullptr;
+			}
+
+			static void step(sqlite3_context* ctx, int, sqlite3_value** argv) noexcept {
+				try {
+					invoke_step(*state(ctx, true), argv, std::make_index_sequence<std::tuple_size<args>::value>());
+				} catch(...) {
+					set_exception_result(ctx);
+				}
+			}
+
+			static void final(sqlite3_context* ctx) noexcept {
+				try {
+					auto s = state(ctx, false);
+					// No rows were aggregated
+					if(s == nullptr) set_result(ctx, State().result());
+					else set_result(ctx, s->result());
+				} catch(...) {
+					set_exception_result(ctx);
+				}
+				release(ctx);
+			}
+
+			template<size_t... I>
+			static void invoke_step(State& s, sqlite3_value** argv, std::index_sequence<I...>) {
+				s.step(from_value<std::tuple_element_t<I, args>>(argv[I])...);
+			}
+		};
+
+		template<typename State, typename = void>
+		struct has_result : std::false_type {};
+		template<typename State>
+		struct has_result<State, std::void_t<decltype(std::declval<State&>().result())>> : std::true_type {};
+
+		/**
+		 * \brief Window function, value() returns the current value and inverse() removes the oldest row from the frame
+		 */
+		template<typename State>
+		struct window_function : aggregate_function<State> {
+			using base = aggregate_function<State>;
+			using inverse_args = typename callable_traits<decltype(&State::inverse)>::args;
+			static_assert(std::is_same<inverse_args, typename base::args>::value, "step() and inverse() must take the same arguments");
+
+			static void inverse(sqlite3_context* ctx, int, sqlite3_value** argv) noexcept {
+				try {
+					invoke_inverse(*base::state(ctx, true), argv, std::make_index_sequence<std::tuple_size<inverse_args>::value>());
+				} catch(...) {
+					set_exception_result(ctx);
+				}
+			}
+
+			static void value(sqlite3_context* ctx) noexcept {
+				try {
+					auto s = base::state(ctx, false);
+					if(s == nullptr) set_result(ctx, State().value());
+					else set_result(ctx, s->value());
+				} catch(...) {
+					set_exception_result(ctx);
+				}
+			}
+
+			static void final(sqlite3_context* ctx) noexcept {
+				if constexpr(has_result<State>::value) {
+					base::final(ctx);
+				} else {
+					value(ctx);
+					base::release(ctx);
+				}
+			}
+
+			template<size_t... I>
+			static void invoke_inverse(State& s, sqlite3_value** argv, std::index_sequence<I...>) {
+				s.inverse(from_value<std::tuple_element_t<I, inverse_args>>(argv[I])...);
+			}
+		};
+	}
+
+	/**
+	 * \brief Register a scalar SQL function implemented by fn on db
+	 * 
+	 * Argument and result types are deduced from fn, which must not be a generic lambda.
+	 * Supported are integral, enum and floating point types, std::string, std::string_view (only valid during the call),
+	 * std::vector<uint8_t>, std::optional of those (NULL is passed as std::nullopt) and raw sqlite3_value*.
+	 * Exceptions thrown by fn are reported as SQL errors.
+	 * 
+	 * create_function(db, "score", [](int64_t a, double b) { return a * b; }, function_flags::deterministic);
+	 */
+	template<typename Fn>
+	void create_function(database& db, const std::string& name, Fn fn, function_flags flags = function_flags::none) {
+		using impl = detail::scalar_function<Fn>;
+		auto ptr = new Fn(std::move(fn));
+		detail::register_function(db, name, static_cast<int>(std::tuple_size<typename impl::args>::value), flags, ptr, &impl::call, nullptr, nullptr, &impl::destroy);
+	}
+
+	/**
+	 * \brief Register an aggregate SQL function on db
+	 * 
+	 * A new State is default constructed for every group, State::step() is called for every row with the
+	 * arguments of the function and State::result() returns the value of the group.
+	 * Types are deduced the same way as for create_function().
+	 */
+	template<typename State>
+	void create_aggregate(database& db, const std::string& name, function_flags flags = function_flags::none) {
+		using impl = detail::aggregate_function<State>;
+		detail::register_function(db, name, static_cast<int>(std::tuple_size<typename impl::args>::value), flags, nullptr, nullptr, &impl::step, &impl::final, nullptr);
+	}
+
+	/**
+	 * \brief Register an aggregate SQL function usable as window function (OVER clause) on db
+	 * 
+	 * In addition to create_aggregate() State::inverse() is called with the arguments of a row leaving the
+	 * frame and State::value() returns the value for the current frame. State::result() returns the final
+	 * value of the group when used as aggregate, if State has no result() member value() is used instead.
+	 */
+	template<typename State>
+	void create_window_function(database& db, const std::string& name, function_flags flags = function_flags::none) {
+		using impl = detail::window_function<State>;
+		detail::register_window_function(db, name, static_cast<int>(std::tuple_size<typename impl::args>::value), flags, &impl::step, &impl::final, &impl::value, &impl::inverse);
+	}
+}
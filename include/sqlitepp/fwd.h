@@ -15,6 +15,8 @@ namespace sqlitepp {
         struct class_info;
         struct field_info;
         class entity;
+        class entity_arena;
+        struct entity_loader;
         enum class db_type;
         using db_text_type = std::string;
         using db_integer_type = int64_t;
@@ -0,0 +1,92 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace sqlitepp {
+	class database;
+
+	struct maintenance_options {
+		// Time between two checks of the WAL, the thread is woken earlier once passive_frames is reached
+		std::chrono::milliseconds interval { 1000 };
+		// Run a PASSIVE checkpoint once the WAL holds this many frames
+		int64_t passive_frames { 1000 };
+		// Escalate to a RESTART checkpoint (waiting for readers) at this size
+		int64_t restart_frames { 10000 };
+		// Escalate to a TRUNCATE checkpoint, also resetting the WAL file size to zero
+		int64_t truncate_frames { 50000 };
+		// No commit for this long is a quiet period, the WAL is truncated and idle tasks are run
+		std::chrono::milliseconds idle_time { 5000 };
+		// Minimum time between two runs of PRAGMA optimize (on all tables, ANALYZE before SQLite 3.46) during quiet periods, zero disables it
+		std::chrono::milliseconds optimize_interval { std::chrono::hours(1) };
+		// Pages freed by PRAGMA incremental_vacuum during quiet periods, 0 disables it (requires auto_vacuum = INCREMENTAL)
+		int64_t vacuum_pages { 0 };
+		// Busy timeout of the maintenance connection, limits the time RESTART and TRUNCATE wait for readers
+		std::chrono::milliseconds busy_timeout { 100 };
+	};
+
+	struct maintenance_stats {
+		// Checkpoints run, by mode
+		uint64_t passive;
+		uint64_t restart;
+		uint64_t truncate;
+		// Frames left in the WAL after the last checkpoint, -1 if the database is not in WAL mode
+		int64_t wal_frames;
+		// Checkpoints and idle tasks skipped because the database was locked
+		uint64_t busy;
+		uint64_t optimize;
+		uint64_t vacuum;
+		// Other failures of the background thread
+		uint64_t errors;
+	};
+
+	/**
+	 * \brief Background WAL checkpoints and database housekeeping
+	 *
+	 * With the automatic checkpoint sqlite copies the WAL back into the database inline, on whichever commit
+	 * crosses the threshold. This service runs checkpoints on its own thread and connection instead:
+	 *
+	 * maintenance service("app.db");
+	 * database db("app.db");
+	 * db.exec("PRAGMA journal_mode = WAL;");
+	 * service.attach(db);
+	 *
+	 * Attached connections no longer checkpoint on commit and report the WAL size to the service.
+	 * A PASSIVE checkpoint (never blocking) is run once passive_frames is reached and escalated to RESTART
+	 * and TRUNCATE as the WAL keeps growing, e.g. because readers prevented the WAL from being reset.
+	 * Once no connection committed for idle_time the WAL is truncated, PRAGMA optimize and
+	 * PRAGMA incremental_vacuum are run. The database has to be in WAL mode before the first attach().
+	 */
+	class maintenance {
+		struct state;
+		std::shared_ptr<state> m_state;
+		std::unique_ptr<database> m_db;
+		std::thread m_thread;
+
+		void run() noexcept;
+		void run_checkpoint(int64_t frames, bool idle);
+		void run_idle_tasks();
+		template<typename Fn>
+		void guarded(Fn&& fn) noexcept;
+	public:
+		explicit maintenance(const std::string& filename, maintenance_options options = {});
+		~maintenance() noexcept;
+
+		maintenance(const maintenance&) = delete;
+		maintenance& operator=(const maintenance&) = delete;
+
+		/**
+		 * \brief Disable the automatic checkpoint of db and report its commits to this service
+		 *
+		 * Uses database::set_wal_hook(). db may outlive the service, commits are ignored afterwards.
+		 */
+		void attach(database& db);
+		/**
+		 * \brief Wake the background thread to check the WAL now
+		 */
+		void trigger();
+		maintenance_stats stats() const;
+	};
+}
@@ -1,7 +1,10 @@
 #pragma once
+#include <any>
 #include <functional>
 #include <memory>
+#include <memory_resource>
 #include <map>
+#include <unordered_map>
 #include <chrono>
 #include <optional>
 
@@ -9,6 +12,8 @@
 #include <sqlitepp/statement.h>
 #include <sqlitepp/result_iterator.h>
 #include <sqlitepp/orm_entity.h>
+#include <sqlitepp/orm_identity_map.h>
+#include <sqlitepp/orm_advisor.h>
 #include <sqlitepp/condition.h>
 
 namespace sqlitepp {
@@ -29,6 +34,20 @@ namespace sqlitepp {
             cascade
         };
 
+        /**
+         * \brief Controls how entities remember the values they were loaded with.
+         * 
+         * full: Keep a copy of every field (default). is_modified() and reset() never touch the database.
+         * hash: Keep a 64bit hash per field and a copy of fields not larger than snapshot_inline_limit.
+         *       reset() reloads the remaining fields from the database.
+         * none: Keep nothing, every entity is considered modified and save() writes all fields.
+         */
+        enum class snapshot_policy {
+            full,
+            hash,
+            none
+        };
+
         struct field_info {
             typedef std::function<void(entity*, const db_value&)> setter_fn_t;
             typedef std::function<db_value(const entity*)> getter_fn_t;
@@ -37,6 +56,8 @@ namespace sqlitepp {
             setter_fn_t setter {};
             getter_fn_t getter {};
             bool nullable { false };
+            // Column is not part of the default select list and loaded on demand
+            bool lazy { false };
             bool primary_key { false };
             bool row_id { false };
             enum {
@@ -50,15 +71,36 @@ namespace sqlitepp {
             fk_action fk_del_action { fk_action::no_action };
             fk_action fk_update_action { fk_action::no_action };
             std::optional<db_value> default_value {};
+            // Pointer to the mapped member (as const U T::*), empty if unknown
+            std::any member {};
         };
         
+        struct index_info {
+            std::string name {};
+            // Field names or expressions (e.g. "lower(`name`)" or "`name` DESC")
+            std::vector<std::string> columns {};
+            // Condition of a partial index, empty for a full index
+            std::string where {};
+            bool unique { false };
+        };
+
         struct class_info {
             typedef std::function<std::unique_ptr<entity>(database&)> create_fn_t;
+            typedef std::function<entity*(void*, database&, std::pmr::memory_resource*)> construct_fn_t;
             std::string table;
             std::string schema;
             bool is_temporary = false;
+            // Table is created WITHOUT ROWID, rows are identified by their primary key
+            bool without_rowid = false;
+            std::vector<index_info> indexes;
+            snapshot_policy snapshot = snapshot_policy::full;
+            size_t snapshot_inline_limit = 32;
             std::vector<field_info> fields;
             create_fn_t create;
+            // Placement construction used by entity_arena
+            size_t size = 0;
+            size_t alignment = 0;
+            construct_fn_t construct;
 
             field_info* get_field_by_name(const std::string& name) {
                 for(auto& e : fields) {
@@ -72,16 +114,93 @@ namespace sqlitepp {
                 }
                 return nullptr;
             }
+            /**
+             * \brief Get the indexes of all fields mapped to the given member.
+             * 
+             * Array members map to multiple fields.
+             */
+            template<typename T, typename U>
+            std::vector<size_t> get_field_indexes(U T::*ptr) const {
+                typedef const typename std::remove_const<U>::type T::* member_t;
+                member_t m = ptr;
+                std::vector<size_t> res;
+                for(size_t i = 0; i < fields.size(); i++) {
+                    auto p = std::any_cast<member_t>(&fields[i].member);
+                    if(p && *p == m) res.push_back(i);
+                }
+                return res;
+            }
         };
         
         std::function<void(class_info&, field_info&)> primary_key(bool v = true);
         std::function<void(class_info&, field_info&)> row_id(bool v = true);
         std::function<void(class_info&, field_info&)> nullable(bool v = true);
+        std::function<void(class_info&, field_info&)> lazy(bool v = true);
         std::function<void(class_info&, field_info&)> unique_id(int id = field_info::UNIQUE_ID_SINGLE_FIELD);
         std::function<void(class_info&, field_info&)> fk(const std::string& table, const std::string& field, fk_action del_action, fk_action update_action);
         std::function<void(class_info&, field_info&)> default_value(db_value val);
         std::function<void(class_info&)> schema(std::string schema);
         std::function<void(class_info&)> temporary(bool v = true);
+        std::function<void(class_info&)> snapshot(snapshot_policy policy, size_t inline_limit = 32);
+        /**
+         * \brief Declare a secondary index created by generate_create_indexes()
+         *
+         * Columns matching a field name are quoted, everything else is used as expression.
+         * A non empty where creates a partial index.
+         */
+        std::function<void(class_info&)> index(std::string name, std::vector<std::string> columns, std::string where = "", bool unique = false);
+        std::function<void(class_info&)> unique_index(std::string name, std::vector<std::string> columns, std::string where = "");
+        /**
+         * \brief Create the table WITHOUT ROWID, clustering the rows by their primary key
+         *
+         * Requires a primary key and no row_id() field. Entities of such classes are identified
+         * by their primary key instead of the rowid and are not cached by an identity_map.
+         */
+        std::function<void(class_info&)> without_rowid(bool v = true);
+
+        /**
+         * \brief 64bit hash of a value, stable for the lifetime of the process
+         */
+        uint64_t hash_value(const db_value& val) noexcept;
+
+        struct db_value_hash {
+            size_t operator()(const db_value& val) const noexcept { return static_cast<size_t>(hash_value(val)); }
+        };
+
+        template<typename U>
+        struct is_optional : std::false_type {};
+        template<typename U>
+        struct is_optional<std::optional<U>> : std::true_type {};
+
+        /**
+         * \brief Get the value of type V, NULL (e.g. in a column added without default) reads as V{}
+         */
+        template<typename V>
+        inline V value_or_default(const db_value& val) {
+            if(auto ptr = std::get_if<V>(&val)) return *ptr;
+            return V{};
+        }
+
+        /**
+         * \brief Convert a member value to the db_value stored by the matching builder::field() overload
+         */
+        template<typename U>
+        inline db_value to_db_value(const U& val) {
+            if constexpr(std::is_same<U, db_value>::value) {
+                return val;
+            } else if constexpr(is_optional<U>::value) {
+                if(!val.has_value()) return db_value{ db_null_type{} };
+                return to_db_value(*val);
+            } else if constexpr(std::is_integral<U>::value) {
+                return db_value{ static_cast<db_integer_type>(val) };
+            } else if constexpr(std::is_floating_point<U>::value) {
+                return db_value{ static_cast<db_real_type>(val) };
+            } else if constexpr(std::is_convertible<U, db_blob_type>::value) {
+                return db_value{ static_cast<db_blob_type>(val) };
+            } else {
+                return db_value{ val };
+            }
+        }
         
         template<typename T, typename std::enable_if<std::is_base_of<entity, T>::value>::type* = nullptr>
         class builder {
@@ -90,6 +209,13 @@ namespace sqlitepp {
             builder(const std::string& table, std::initializer_list<std::function<void(class_info&)>> attributes = {}) {
                 m_info.table = table;
                 m_info.create = [](database& db){ return std::make_unique<T>(db); };
+                m_info.size = sizeof(T);
+                m_info.alignment = alignof(T);
+                m_info.construct = [](void* mem, database& db, std::pmr::memory_resource* resource) -> entity* {
+                    if constexpr(std::is_constructible<T, database&, std::pmr::memory_resource*>::value)
+                        return new(mem) T(db, resource);
+                    else return new(mem) T(db);
+                };
                 for(auto& e : attributes) {
                     e(m_info);
                 }
@@ -97,10 +223,10 @@ namespace sqlitepp {
             // Special overload for rowid columns
             builder& field(const std::string& name, const db_integer_type T::*ptr, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
                 return field(name, db_type::integer, [ptr](entity* e, const db_value& v) {
-                    *const_cast<db_integer_type*>(&(static_cast<T*>(e)->*ptr)) = std::get<db_integer_type>(v);
+                    *const_cast<db_integer_type*>(&(static_cast<T*>(e)->*ptr)) = value_or_default<db_integer_type>(v);
                 }, [ptr](const entity* e) -> db_value {
                     return db_value{static_cast<db_integer_type>(static_cast<const T*>(e)->*ptr) };
-                }, attributes);
+                }, attributes).member(ptr);
             }
 
 
@@ -111,51 +237,51 @@ namespace sqlitepp {
             typename std::enable_if<std::is_convertible<typename std::underlying_type<U>::type, db_integer_type>::value, builder&>::type
             field(const std::string& name, U T::*ptr, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
                 return field(name, db_type::integer, [ptr](entity* e, const db_value& v) {
-                    static_cast<T*>(e)->*ptr = static_cast<U>(std::get<db_integer_type>(v));
+                    static_cast<T*>(e)->*ptr = static_cast<U>(value_or_default<db_integer_type>(v));
                 }, [ptr](const entity* e) -> db_value {
                     return db_value{static_cast<db_integer_type>(static_cast<const T*>(e)->*ptr) };
-                }, attributes);
+                }, attributes).member(ptr);
             }
             template<typename U, typename std::enable_if<!std::is_enum<U>::value && std::is_convertible<U, db_integer_type>::value && !std::is_floating_point<U>::value>::type* = nullptr>
             builder& field(const std::string& name, U T::*ptr, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
                 return field(name, db_type::integer, [ptr](entity* e, const db_value& v) {
-                    static_cast<T*>(e)->*ptr = static_cast<U>(std::get<db_integer_type>(v));
+                    static_cast<T*>(e)->*ptr = static_cast<U>(value_or_default<db_integer_type>(v));
                 }, [ptr](const entity* e) -> db_value {
                     return db_value{static_cast<db_integer_type>(static_cast<const T*>(e)->*ptr) };
-                }, attributes);
+                }, attributes).member(ptr);
             }
             // Special overload for time values
             template<typename U, typename std::enable_if<std::is_same<U, std::chrono::system_clock::time_point>::value>::type* = nullptr>
             builder& field(const std::string& name, U T::*ptr, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
                 return field(name, db_type::integer, [ptr](entity* e, const db_value& v) {
-                    static_cast<T*>(e)->*ptr = std::chrono::system_clock::from_time_t(std::get<db_integer_type>(v));
+                    static_cast<T*>(e)->*ptr = std::chrono::system_clock::from_time_t(value_or_default<db_integer_type>(v));
                 }, [ptr](const entity* e) -> db_value {
                     return db_value{static_cast<db_integer_type>(std::chrono::system_clock::to_time_t(static_cast<const T*>(e)->*ptr)) };
-                }, attributes);
+                }, attributes).member(ptr);
             }
             template<typename U, typename std::enable_if<std::is_convertible<U, db_text_type>::value>::type* = nullptr>
             builder& field(const std::string& name, U T::*ptr, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
                 return field(name, db_type::text, [ptr](entity* e, const db_value& v) {
-                    static_cast<T*>(e)->*ptr = std::get<db_text_type>(v);
+                    static_cast<T*>(e)->*ptr = value_or_default<db_text_type>(v);
                 }, [ptr](const entity* e) -> db_value {
                     return db_value{static_cast<db_text_type>(static_cast<const T*>(e)->*ptr) };
-                }, attributes);
+                }, attributes).member(ptr);
             }
             template<typename U, typename std::enable_if<std::is_convertible<U, db_real_type>::value && std::is_floating_point<U>::value>::type* = nullptr>
             builder& field(const std::string& name, U T::*ptr, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
                 return field(name, db_type::real, [ptr](entity* e, const db_value& v) {
-                    static_cast<T*>(e)->*ptr = std::get<db_real_type>(v);
+                    static_cast<T*>(e)->*ptr = value_or_default<db_real_type>(v);
                 }, [ptr](const entity* e) -> db_value {
                     return db_value{static_cast<db_real_type>(static_cast<const T*>(e)->*ptr) };
-                }, attributes);
+                }, attributes).member(ptr);
             }
             template<typename U, typename std::enable_if<std::is_convertible<U, db_blob_type>::value>::type* = nullptr>
             builder& field(const std::string& name, U T::*ptr, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
                 return field(name, db_type::blob, [ptr](entity* e, const db_value& v) {
-                    static_cast<T*>(e)->*ptr = std::get<db_blob_type>(v);
+                    static_cast<T*>(e)->*ptr = value_or_default<db_blob_type>(v);
                 }, [ptr](const entity* e) -> db_value {
                     return db_value{static_cast<db_blob_type>(static_cast<const T*>(e)->*ptr) };
-                }, attributes);
+                }, attributes).member(ptr);
             }
             
             /** =============   Optional fields    ================**/
@@ -170,9 +296,9 @@ namespace sqlitepp {
                     else (static_cast<T*>(e)->*ptr).reset();
                 }, [ptr](const entity* e) -> db_value {
                     if((static_cast<const T*>(e)->*ptr).has_value())
-                        return db_value{static_cast<db_integer_type>(static_cast<const T*>(e)->*ptr.value()) };
+                        return db_value{static_cast<db_integer_type>((static_cast<const T*>(e)->*ptr).value()) };
                     return db_value{db_null_type{}};
-                }, { [attributes](class_info& ci, field_info& fi) { fi.nullable = true; for(auto& e : attributes) e(ci, fi);} });
+                }, { [attributes](class_info& ci, field_info& fi) { fi.nullable = true; for(auto& e : attributes) e(ci, fi);} }).member(ptr);
             }
             template<typename U, typename std::enable_if<!std::is_enum<U>::value && std::is_convertible<U, db_integer_type>::value && !std::is_floating_point<U>::value>::type* = nullptr>
             builder& field(const std::string& name, std::optional<U> T::*ptr, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
@@ -184,7 +310,7 @@ namespace sqlitepp {
                     if((static_cast<const T*>(e)->*ptr).has_value())
                         return db_value{static_cast<db_integer_type>((static_cast<const T*>(e)->*ptr).value()) };
                     return db_value{db_null_type{}};
-                }, { [attributes](class_info& ci, field_info& fi) { fi.nullable = true; for(auto& e : attributes) e(ci, fi);} });
+                }, { [attributes](class_info& ci, field_info& fi) { fi.nullable = true; for(auto& e : attributes) e(ci, fi);} }).member(ptr);
             }
             // Special overload for time values
             template<typename U, typename std::enable_if<std::is_same<U, std::chrono::system_clock::time_point>::value>::type* = nullptr>
@@ -194,10 +320,10 @@ namespace sqlitepp {
                         static_cast<T*>(e)->*ptr = std::chrono::system_clock::from_time_t(std::get<db_integer_type>(v));
                     else (static_cast<T*>(e)->*ptr).reset();
                 }, [ptr](const entity* e) -> db_value {
-                    if(static_cast<const T*>(e)->*ptr.has_value())
-                        return db_value{static_cast<db_integer_type>(std::chrono::system_clock::to_time_t(static_cast<const T*>(e)->*ptr.value())) };
+                    if((static_cast<const T*>(e)->*ptr).has_value())
+                        return db_value{static_cast<db_integer_type>(std::chrono::system_clock::to_time_t((static_cast<const T*>(e)->*ptr).value())) };
                     return db_value{db_null_type{}};
-                }, { [attributes](class_info& ci, field_info& fi) { fi.nullable = true; for(auto& e : attributes) e(ci, fi);} });
+                }, { [attributes](class_info& ci, field_info& fi) { fi.nullable = true; for(auto& e : attributes) e(ci, fi);} }).member(ptr);
             }
             template<typename U, typename std::enable_if<std::is_convertible<U, db_text_type>::value>::type* = nullptr>
             builder& field(const std::string& name, std::optional<U> T::*ptr, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
@@ -206,10 +332,10 @@ namespace sqlitepp {
                         static_cast<T*>(e)->*ptr = std::get<db_text_type>(v);
                     else (static_cast<T*>(e)->*ptr).reset();
                 }, [ptr](const entity* e) -> db_value {
-                    if(static_cast<const T*>(e)->*ptr.has_value())
-                        return db_value{static_cast<db_text_type>(static_cast<const T*>(e)->*ptr.value()) };
+                    if((static_cast<const T*>(e)->*ptr).has_value())
+                        return db_value{static_cast<db_text_type>((static_cast<const T*>(e)->*ptr).value()) };
                     return db_value{db_null_type{}};
-                }, { [attributes](class_info& ci, field_info& fi) { fi.nullable = true; for(auto& e : attributes) e(ci, fi);} });
+                }, { [attributes](class_info& ci, field_info& fi) { fi.nullable = true; for(auto& e : attributes) e(ci, fi);} }).member(ptr);
             }
             template<typename U, typename std::enable_if<std::is_convertible<U, db_real_type>::value && std::is_floating_point<U>::value>::type* = nullptr>
             builder& field(const std::string& name, std::optional<U> T::*ptr, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
@@ -218,10 +344,10 @@ namespace sqlitepp {
                         static_cast<T*>(e)->*ptr = std::get<db_real_type>(v);
                     else (static_cast<T*>(e)->*ptr).reset();
                 }, [ptr](const entity* e) -> db_value {
-                    if(static_cast<const T*>(e)->*ptr.has_value())
-                        return db_value{static_cast<db_real_type>(static_cast<const T*>(e)->*ptr.value()) };
+                    if((static_cast<const T*>(e)->*ptr).has_value())
+                        return db_value{static_cast<db_real_type>((static_cast<const T*>(e)->*ptr).value()) };
                     return db_value{db_null_type{}};
-                }, { [attributes](class_info& ci, field_info& fi) { fi.nullable = true; for(auto& e : attributes) e(ci, fi);} });
+                }, { [attributes](class_info& ci, field_info& fi) { fi.nullable = true; for(auto& e : attributes) e(ci, fi);} }).member(ptr);
             }
             template<typename U, typename std::enable_if<std::is_convertible<U, db_blob_type>::value>::type* = nullptr>
             builder& field(const std::string& name, std::optional<U> T::*ptr, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
@@ -230,10 +356,10 @@ namespace sqlitepp {
                         static_cast<T*>(e)->*ptr = std::get<db_blob_type>(v);
                     else (static_cast<T*>(e)->*ptr).reset();
                 }, [ptr](const entity* e) -> db_value {
-                    if(static_cast<const T*>(e)->*ptr.has_value())
-                        return db_value{static_cast<db_blob_type>(static_cast<const T*>(e)->*ptr.value()) };
+                    if((static_cast<const T*>(e)->*ptr).has_value())
+                        return db_value{static_cast<db_blob_type>((static_cast<const T*>(e)->*ptr).value()) };
                     return db_value{db_null_type{}};
-                }, { [attributes](class_info& ci, field_info& fi) { fi.nullable = true; for(auto& e : attributes) e(ci, fi);} });
+                }, { [attributes](class_info& ci, field_info& fi) { fi.nullable = true; for(auto& e : attributes) e(ci, fi);} }).member(ptr);
             }
             
             /** =============   Array fields    ================**/
@@ -241,43 +367,43 @@ namespace sqlitepp {
             template<typename U, size_t Size, typename std::enable_if<std::is_convertible<U, db_integer_type>::value && !std::is_floating_point<U>::value>::type* = nullptr>
             builder& field(const std::string& name, std::array<U,Size> T::*ptr, size_t index, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
                 return field(name, db_type::integer, [ptr, index](entity* e, const db_value& v) {
-                    (static_cast<T*>(e)->*ptr)[index] = std::get<db_integer_type>(v);
+                    (static_cast<T*>(e)->*ptr)[index] = value_or_default<db_integer_type>(v);
                 }, [ptr, index](const entity* e) -> db_value {
                     return db_value{static_cast<db_integer_type>((static_cast<const T*>(e)->*ptr)[index]) };
-                }, attributes);
+                }, attributes).member(ptr);
             }
             // Special overload for time values
             template<typename U, size_t Size, typename std::enable_if<std::is_same<U, std::chrono::system_clock::time_point>::value>::type* = nullptr>
             builder& field(const std::string& name, std::array<U,Size> T::*ptr, size_t index, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
                 return field(name, db_type::integer, [ptr, index](entity* e, const db_value& v) {
-                    (static_cast<T*>(e)->*ptr)[index] = std::chrono::system_clock::from_time_t(std::get<db_integer_type>(v));
+                    (static_cast<T*>(e)->*ptr)[index] = std::chrono::system_clock::from_time_t(value_or_default<db_integer_type>(v));
                 }, [ptr, index](const entity* e) -> db_value {
                     return db_value{static_cast<db_integer_type>(std::chrono::system_clock::to_time_t((static_cast<const T*>(e)->*ptr)[index])) };
-                }, attributes);
+                }, attributes).member(ptr);
             }
             template<typename U, size_t Size, typename std::enable_if<std::is_convertible<U, db_text_type>::value>::type* = nullptr>
             builder& field(const std::string& name, std::array<U,Size> T::*ptr, size_t index, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
                 return field(name, db_type::text, [ptr, index](entity* e, const db_value& v) {
-                    (static_cast<T*>(e)->*ptr)[index] = std::get<db_text_type>(v);
+                    (static_cast<T*>(e)->*ptr)[index] = value_or_default<db_text_type>(v);
                 }, [ptr, index](const entity* e) -> db_value {
                     return db_value{static_cast<db_text_type>((static_cast<const T*>(e)->*ptr)[index]) };
-                }, attributes);
+                }, attributes).member(ptr);
             }
             template<typename U, size_t Size, typename std::enable_if<std::is_convertible<U, db_real_type>::value && std::is_floating_point<U>::value>::type* = nullptr>
             builder& field(const std::string& name, std::array<U,Size> T::*ptr, size_t index, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
                 return field(name, db_type::real, [ptr, index](entity* e, const db_value& v) {
-                    (static_cast<T*>(e)->*ptr)[index] = std::get<db_real_type>(v);
+                    (static_cast<T*>(e)->*ptr)[index] = value_or_default<db_real_type>(v);
                 }, [ptr, index](const entity* e) -> db_value {
                     return db_value{static_cast<db_real_type>((static_cast<const T*>(e)->*ptr)[index]) };
-                }, attributes);
+                }, attributes).member(ptr);
             }
             template<typename U, size_t Size, typename std::enable_if<std::is_convertible<U, db_blob_type>::value>::type* = nullptr>
             builder& field(const std::string& name, std::array<U,Size> T::*ptr, size_t index, std::initializer_list<std::function<void(class_info&, field_info&)>> attributes = {}) {
                 return field(name, db_type::blob, [ptr, index](entity* e, const db_value& v) {
-                    (static_cast<T*>(e)->*ptr)[index] = std::get<db_blob_type>(v);
+                    (static_cast<T*>(e)->*ptr)[index] = value_or_default<db_blob_type>(v);
                 }, [ptr, index](const entity* e) -> db_value {
                     return db_value{static_cast<db_blob_type>((static_cast<const T*>(e)->*ptr)[index]) };
-                }, attributes);
+                }, attributes).member(ptr);
             }
 
             template<typename U, size_t Size, typename std::enable_if<
@@ -306,28 +432,260 @@ namespace sqlitepp {
                 return *this;
             }
 
+            /**
+             * \brief Associate the last added field with a member pointer, used to reference fields in queries
+             */
+            template<typename U>
+            builder& member(U T::*ptr) {
+                m_info.fields.back().member = static_cast<const typename std::remove_const<U>::type T::*>(ptr);
+                return *this;
+            }
+
             class_info build() {
                 return m_info;
             }
         };
 
+        /**
+         * \brief Owns entities allocated from a single monotonic buffer.
+         * 
+         * The entity objects and the vectors of their change tracking state are placed into a few
+         * large blocks and destroyed together when the arena is cleared or destroyed.
+         * Text and blob values are not covered: the members declared by the entity as well as the
+         * snapshot copies of text and blob columns (see snapshot_policy) still use the heap for
+         * values too long for the small string optimization.
+         * Entities created inside an arena must not outlive it.
+         */
+        class entity_arena {
+            std::pmr::monotonic_buffer_resource m_resource;
+            // Kept outside the arena, outgrown buffers would stay allocated until clear()
+            std::vector<entity*> m_entities;
+        public:
+            explicit entity_arena(size_t initial_size = 64 * 1024);
+            ~entity_arena();
+
+            entity_arena(const entity_arena&) = delete;
+            entity_arena& operator=(const entity_arena&) = delete;
+
+            /**
+             * \brief Construct a new entity of the given class inside the arena
+             */
+            entity* create(database& db, const class_info& info);
+            /**
+             * \brief Destroy all entities and release the allocated memory
+             */
+            void clear();
+
+            std::pmr::memory_resource* resource() noexcept { return &m_resource; }
+            const std::vector<entity*>& entities() const noexcept { return m_entities; }
+            size_t size() const noexcept { return m_entities.size(); }
+            bool empty() const noexcept { return m_entities.empty(); }
+            template<typename T>
+            T& at(size_t idx) const { return *static_cast<T*>(m_entities.at(idx)); }
+        };
+
         std::string generate_create_table(const class_info& info);
+        /**
+         * \brief Generate the CREATE INDEX statements of all indexes declared using index()
+         */
+        std::string generate_create_indexes(const class_info& info);
+
+        /**
+         * \brief Upsert multiple entities of the same class reusing one statement inside a savepoint
+         * 
+         * Conflicts are resolved on the primary key and every unique constraint, see entity::upsert().
+         */
+        void upsert(database& db, const class_info& info, const std::vector<entity*>& entities);
+        template<typename T>
+        inline void upsert(database& db, const std::vector<std::unique_ptr<T>>& entities) {
+            std::vector<entity*> ptrs;
+            ptrs.reserve(entities.size());
+            for(auto& e : entities) ptrs.push_back(e.get());
+            upsert(db, T::_class_info, ptrs);
+        }
+        template<typename T>
+        inline void upsert(database& db, const std::vector<std::shared_ptr<T>>& entities) {
+            std::vector<entity*> ptrs;
+            ptrs.reserve(entities.size());
+            for(auto& e : entities) ptrs.push_back(e.get());
+            upsert(db, T::_class_info, ptrs);
+        }
+
+        /**
+         * \brief Load the pending (e.g. lazy) fields of multiple entities using one query per batch
+         */
+        void load_lazy(database& db, const class_info& info, const std::vector<entity*>& entities, size_t batch_size = 500);
+        template<typename T>
+        inline void load_lazy(database& db, const std::vector<std::unique_ptr<T>>& entities, size_t batch_size = 500) {
+            std::vector<entity*> ptrs;
+            ptrs.reserve(entities.size());
+            for(auto& e : entities) ptrs.push_back(e.get());
+            load_lazy(db, T::_class_info, ptrs, batch_size);
+        }
+        inline void load_lazy(database& db, const class_info& info, const entity_arena& arena, size_t batch_size = 500) {
+            load_lazy(db, info, arena.entities(), batch_size);
+        }
 
         int64_t remove(database& db, const class_info& info, const std::string& where = "", std::vector<db_value> vals = {});
         int64_t count(database& db, const class_info& info, const std::string& where = "", std::vector<db_value> vals = {});
         template<size_t A,size_t B>
         inline int64_t remove(database& db, const class_info& info, const condition<A,B>& where) {
             auto p = where.as_partial();
-            return remove(db, info, p.query, std::vector<db_value>(p.params.begin(), p.params.end()));
+            return remove(db, info, p.query, std::vector<db_value>(std::make_move_iterator(p.params.begin()), std::make_move_iterator(p.params.end())));
         }
         template<size_t A,size_t B>
         inline int64_t count(database& db, const class_info& info, const condition<A,B>& where) {
             auto p = where.as_partial();
-            return count(db, info, p.query, std::vector<db_value>(p.params.begin(), p.params.end()));
+            return count(db, info, p.query, std::vector<db_value>(std::make_move_iterator(p.params.begin()), std::make_move_iterator(p.params.end())));
+        }
+        /**
+         * \brief Remove the rows matching where, an empty condition throws std::invalid_argument
+         * 
+         * Conditions assembled at runtime (e.g. from search filters) are empty if no filter is set,
+         * use remove(db, info) to delete all rows on purpose.
+         */
+        inline int64_t remove(database& db, const class_info& info, const dynamic_condition& where) {
+            if(where.empty()) throw std::invalid_argument("refusing to remove all rows of " + info.table + " with an empty condition");
+            return remove(db, info, where.str(), where.param_vector());
+        }
+        inline int64_t count(database& db, const class_info& info, const dynamic_condition& where) {
+            return count(db, info, where.str(), where.param_vector());
+        }
+
+        /**
+         * \brief Column assignment used by update_where()
+         */
+        struct field_assignment {
+            // Index into class_info::fields
+            size_t field;
+            db_value value;
+        };
+        template<typename T, typename U, typename V>
+        inline field_assignment set(U T::*ptr, V&& value) {
+            auto idx = T::_class_info.get_field_indexes(ptr);
+            if(idx.size() != 1) throw std::invalid_argument("member is not mapped to a single field");
+            return field_assignment{ idx[0], to_db_value(static_cast<U>(std::forward<V>(value))) };
+        }
+
+        /**
+         * \brief Update all rows matching where using a single UPDATE statement, returns the number of changed rows
+         *
+         * Entities already loaded are not modified. Cached entities are evicted from an attached identity_map.
+         */
+        int64_t update_where(database& db, const class_info& info, const std::vector<field_assignment>& values, const std::string& where = "", std::vector<db_value> vals = {});
+        template<size_t A,size_t B>
+        inline int64_t update_where(database& db, const class_info& info, const std::vector<field_assignment>& values, const condition<A,B>& where) {
+            auto p = where.as_partial();
+            return update_where(db, info, values, p.query, std::vector<db_value>(std::make_move_iterator(p.params.begin()), std::make_move_iterator(p.params.end())));
+        }
+        template<class T, size_t A, size_t B, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
+        inline int64_t update_where(database& db, const field_assignment& value, const condition<A,B>& where) {
+            return update_where(db, T::_class_info, { value }, where);
         }
+        template<class T, size_t A, size_t B, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
+        inline int64_t update_where(database& db, const std::vector<field_assignment>& values, const condition<A,B>& where) {
+            return update_where(db, T::_class_info, values, where);
+        }
+
+        /**
+         * \brief Options for a select, see orm_query.h for a typed builder
+         */
+        enum class sort_order {
+            ascending,
+            descending
+        };
+
+        struct select_options {
+            struct order_term {
+                // Index into class_info::fields
+                size_t field;
+                sort_order order;
+            };
+
+            // Indexes into class_info::fields to read, all non lazy fields if empty
+            std::vector<size_t> fields {};
+            std::string where {};
+            std::vector<db_value> params {};
+            std::vector<order_term> order_by {};
+            // Maximum number of rows, negative for no limit
+            int64_t limit {-1};
+            int64_t offset {0};
+            /**
+             * \brief Keyset pagination: only return rows ordered after these values of the order_by fields
+             *
+             * Generates WHERE (k1, k2) > (?, ?), which uses an index on the order_by fields instead of
+             * skipping rows like offset does. The order_by fields need to be unique together and share
+             * the same sort_order. Pass the values of the last row of the previous page.
+             */
+            std::vector<db_value> after {};
+        };
+
+        std::vector<std::unique_ptr<entity>> select_multiple(database& db, const class_info& info, const select_options& options);
+        std::unique_ptr<entity> select_one(database& db, const class_info& info, const select_options& options);
+        std::vector<std::shared_ptr<entity>> select_multiple_shared(database& db, const class_info& info, const select_options& options);
+        std::shared_ptr<entity> select_one_shared(database& db, const class_info& info, const select_options& options);
+        size_t select_multiple(database& db, const class_info& info, entity_arena& arena, const select_options& options);
+        typedef std::unordered_map<db_value, std::shared_ptr<entity>, db_value_hash> relation_index_t;
+        /**
+         * \brief Load all entities of target whose column key_field matches one of keys.
+         * 
+         * Uses one IN (...) query per batch and returns the entities indexed by their key.
+         * key_field may name a field of target or _rowid_.
+         */
+        relation_index_t select_related(database& db, const class_info& target, const std::string& key_field, const std::vector<db_value>& keys, size_t batch_size = 500);
+        /**
+         * \brief Prepare a select returning only the requested fields (without _rowid_)
+         */
+        statement select_columns(database& db, const class_info& info, const select_options& options);
+
+        /**
+         * \brief Options for an aggregate select, see orm_query.h for a typed builder
+         */
+        struct aggregate_options {
+            struct column {
+                // SQL aggregate function (e.g. SUM), empty for a group_by key
+                std::string function;
+                // Index into class_info::fields, all_fields for COUNT(*)
+                size_t field;
+            };
+            static constexpr size_t all_fields = static_cast<size_t>(-1);
+
+            // Result columns in order
+            std::vector<column> columns {};
+            // Indexes into class_info::fields to group by
+            std::vector<size_t> group_by {};
+            std::string where {};
+            std::vector<db_value> params {};
+        };
+        /**
+         * \brief Prepare a select computing the requested aggregates inside the database
+         */
+        statement select_aggregate(database& db, const class_info& info, const aggregate_options& options);
 
         std::vector<std::unique_ptr<entity>> select_multiple(database& db, const class_info& info, const std::string& where = "", std::vector<db_value> vals = {});
         std::unique_ptr<entity> select_one(database& db, const class_info& info, const std::string& where = "", std::vector<db_value> vals = {});
+        /**
+         * \brief Select entities into an arena
+         * 
+         * Results are appended to arena, the return value is the number of loaded entities.
+         */
+        size_t select_multiple(database& db, const class_info& info, entity_arena& arena, const std::string& where = "", std::vector<db_value> vals = {});
+
+        template <class T, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
+        inline size_t select_multiple(database& db, entity_arena& arena, const std::string& where = "", std::vector<db_value> vals = {}) {
+            return select_multiple(db, T::_class_info, arena, where, vals);
+        }
+
+        template<class T, size_t A, size_t B, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
+        inline size_t select_multiple(database& db, entity_arena& arena, const condition<A,B>& where) {
+            auto p = where.as_partial();
+            return select_multiple(db, T::_class_info, arena, p.query, std::vector<db_value>(std::make_move_iterator(p.params.begin()), std::make_move_iterator(p.params.end())));
+        }
+
+        template<class T, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
+        inline size_t select_multiple(database& db, entity_arena& arena, const dynamic_condition& where) {
+            return select_multiple(db, T::_class_info, arena, where.str(), where.param_vector());
+        }
 
         template<typename T>
         inline std::vector<std::unique_ptr<T>> select_multiple(database& db, const class_info& info, const std::string& where = "", std::vector<db_value> vals = {}) {
@@ -349,7 +707,12 @@ namespace sqlitepp {
         template<class T, size_t A, size_t B, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
         inline std::vector<std::unique_ptr<T>> select_multiple(database& db, const condition<A,B>& where) {
             auto p = where.as_partial();
-            return select_multiple<T>(db, p.query, std::vector<db_value>(p.params.begin(), p.params.end()));
+            return select_multiple<T>(db, p.query, std::vector<db_value>(std::make_move_iterator(p.params.begin()), std::make_move_iterator(p.params.end())));
+        }
+
+        template<class T, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
+        inline std::vector<std::unique_ptr<T>> select_multiple(database& db, const dynamic_condition& where) {
+            return select_multiple<T>(db, where.str(), where.param_vector());
         }
 
         template<typename T>
@@ -365,26 +728,25 @@ namespace sqlitepp {
         template<class T, size_t A, size_t B, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
         inline std::unique_ptr<T> select_one(database& db, const condition<A,B>& where) {
             auto p = where.as_partial();
-            return select_one<T>(db, p.query, std::vector<db_value>(p.params.begin(), p.params.end()));
-        }
-
-        inline std::vector<std::shared_ptr<entity>> select_multiple_shared(database& db, const class_info& info, const std::string& where = "", std::vector<db_value> vals = {}) {
-            auto m = select_multiple(db, info, where, vals);
-            std::vector<std::shared_ptr<entity>> res;
-            res.reserve(m.size());
-            for(auto& e : m) {
-                res.emplace_back(std::move(e));
-            }
-            return res;
+            return select_one<T>(db, p.query, std::vector<db_value>(std::make_move_iterator(p.params.begin()), std::make_move_iterator(p.params.end())));
         }
 
-        inline std::shared_ptr<entity> select_one_shared(database& db, const class_info& info, const std::string& where = "", std::vector<db_value> vals = {}) {
-            return select_one(db, info, where, vals);
-        }
+        /**
+         * \brief Select entities with shared ownership
+         * 
+         * If the database has an identity map attached, rows already loaded are returned as the cached entity
+         * instead of reading them again.
+         */
+        std::vector<std::shared_ptr<entity>> select_multiple_shared(database& db, const class_info& info, const std::string& where = "", std::vector<db_value> vals = {});
+        std::shared_ptr<entity> select_one_shared(database& db, const class_info& info, const std::string& where = "", std::vector<db_value> vals = {});
+        /**
+         * \brief Get the entity stored at rowid, served from the identity map without a query if possible
+         */
+        std::shared_ptr<entity> find(database& db, const class_info& info, int64_t rowid);
 
         template<typename T>
-        inline std::vector<std::unique_ptr<T>> select_multiple_shared(database& db, const class_info& info, const std::string& where = "", std::vector<db_value> vals = {}) {
-            auto m = select_multiple(db, info, where, vals);
+        inline std::vector<std::shared_ptr<T>> select_multiple_shared(database& db, const class_info& info, const std::string& where = "", std::vector<db_value> vals = {}) {
+            auto m = select_multiple_shared(db, info, where, vals);
             std::vector<std::shared_ptr<T>> res;
             res.reserve(m.size());
             for(auto& e : m) {
@@ -398,14 +760,31 @@ namespace sqlitepp {
             return select_multiple_shared<T>(db, T::_class_info, where, vals);
         }
 
+        template<class T, size_t A, size_t B, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
+        inline std::vector<std::shared_ptr<T>> select_multiple_shared(database& db, const condition<A,B>& where) {
+            auto p = where.as_partial();
+            return select_multiple_shared<T>(db, p.query, std::vector<db_value>(std::make_move_iterator(p.params.begin()), std::make_move_iterator(p.params.end())));
+        }
+
         template<typename T>
         inline std::shared_ptr<T> select_one_shared(database& db, const class_info& info, const std::string& where = "", std::vector<db_value> vals = {}) {
-            return std::static_pointer_cast<T>(select_one(db, info, where, vals));
+            return std::static_pointer_cast<T>(select_one_shared(db, info, where, vals));
         }
 
         template <class T, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
         inline std::shared_ptr<T> select_one_shared(database& db, const std::string& where = "", std::vector<db_value> vals = {}) {
-            return std::static_pointer_cast<T>(select_one(db, T::_class_info, where, vals));
+            return std::static_pointer_cast<T>(select_one_shared(db, T::_class_info, where, vals));
+        }
+
+        template<class T, size_t A, size_t B, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
+        inline std::shared_ptr<T> select_one_shared(database& db, const condition<A,B>& where) {
+            auto p = where.as_partial();
+            return select_one_shared<T>(db, p.query, std::vector<db_value>(std::make_move_iterator(p.params.begin()), std::make_move_iterator(p.params.end())));
+        }
+
+        template <class T, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
+        inline std::shared_ptr<T> find(database& db, int64_t rowid) {
+            return std::static_pointer_cast<T>(find(db, T::_class_info, rowid));
         }
     }
 }
\ No newline at end of file
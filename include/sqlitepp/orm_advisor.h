@@ -0,0 +1,94 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sqlitepp/fwd.h>
+
+namespace sqlitepp {
+    namespace orm {
+        /**
+         * \brief Columns used by the conditions of orm queries on a class
+         */
+        struct column_usage {
+            std::string column;
+            // Number of predicates using =, IS or IN
+            uint64_t equality {};
+            // Number of predicates using <, <=, >, >= or BETWEEN
+            uint64_t range {};
+            // Number of GLOB predicates with a constant prefix
+            uint64_t prefix {};
+        };
+
+        /**
+         * \brief A suggested index, see index_advisor::suggest()
+         */
+        struct index_suggestion {
+            const class_info* info;
+            std::vector<std::string> columns;
+            // CREATE INDEX statement creating the index
+            std::string statement;
+            // Number of recorded queries that would use the index
+            uint64_t hits;
+            // Rows visited by those queries without the index, hits times the rows visited per query
+            double estimated_cost;
+            // EXPLAIN QUERY PLAN of a recorded query
+            std::string plan;
+        };
+
+        /**
+         * \brief Records the predicates of orm queries and suggests missing indexes.
+         *
+         * Once attached to a database using database::set_index_advisor() every select, count, remove,
+         * update_where and aggregate query built by the orm is recorded. Only columns rendered by the
+         * condition builder (`name` op ?) are recognized, OR and NOT predicates can not use a single
+         * index and only contribute to usage().
+         *
+         * Recording is cheap, suggest() queries the database and is meant for diagnostics.
+         */
+        class index_advisor {
+            struct shape {
+                std::vector<std::string> equality;
+                std::string range;
+                uint64_t hits;
+                // Condition and parameters of the first matching query, used for EXPLAIN QUERY PLAN
+                std::string where;
+                std::vector<db_value> params;
+            };
+            struct class_usage {
+                std::map<std::string, column_usage> columns;
+                std::map<std::string, shape> shapes;
+            };
+
+            mutable std::mutex m_mtx {};
+            std::map<const class_info*, class_usage> m_usage {};
+        public:
+            index_advisor() = default;
+
+            index_advisor(const index_advisor&) = delete;
+            index_advisor& operator=(const index_advisor&) = delete;
+
+            /**
+             * \brief Record a condition used on a class, called by the orm
+             */
+            void record(const class_info& info, const std::string& where, const std::vector<db_value>& params);
+
+            /**
+             * \brief Get the recorded column usage of a class, most used columns first
+             */
+            std::vector<column_usage> usage(const class_info& info) const;
+
+            /**
+             * \brief Suggest indexes for the recorded queries, ordered by estimated_cost (highest first)
+             *
+             * Suggestions covered by an existing index (PRAGMA index_list) are skipped.
+             * The cost is estimated using EXPLAIN QUERY PLAN: a full scan visits every row, a search using
+             * a partially matching index is assumed to visit the square root of it.
+             */
+            std::vector<index_suggestion> suggest(database& db) const;
+
+            void clear();
+        };
+    }
+}
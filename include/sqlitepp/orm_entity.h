@@ -1,5 +1,6 @@
 #pragma once
 #include <memory>
+#include <memory_resource>
 
 #include <sqlitepp/fwd.h>
 
@@ -21,19 +22,52 @@ namespace sqlitepp {
              * NOTE: If you read the same row into multiple entities and delete it using one of them
              * NOTE: the behaviour is undefined. Currently the _rowid_ is only changed on the one used
              * NOTE: to delete the row, but this may change in the future.
+             * NOTE: Attach an identity_map to the database and use the *_shared functions to
+             * NOTE: get a single entity per row instead.
+             * NOTE: Entities of WITHOUT ROWID tables use 0 once stored, the primary key identifies the row.
              */
             int64_t _rowid_ {-1};
             sqlitepp::database& m_db;
-            std::vector<db_value> m_db_vals {};
-            void from_result(const sqlitepp::result_iterator& it);
+            /**
+             * \brief Snapshot of the values last read from or written to the database.
+             * 
+             * Depending on the snapshot_policy of the class this holds a full copy of every field,
+             * only the small fields or nothing at all. m_db_hashes holds a 64bit hash of every field
+             * if the policy is snapshot_policy::hash.
+             */
+            std::pmr::vector<db_value> m_db_vals;
+            std::pmr::vector<uint64_t> m_db_hashes;
+            /**
+             * \brief Fields that were not part of the query this entity was loaded with.
+             */
+            std::pmr::vector<bool> m_pending;
+            /**
+             * \brief Primary key values this entity is stored under, only used for WITHOUT ROWID tables.
+             */
+            std::pmr::vector<db_value> m_key;
+            void from_result(const sqlitepp::result_iterator& it, const std::vector<size_t>& columns);
             void insert();
             void update();
+            void snapshot_clear();
+            void snapshot_field(size_t idx, db_value val);
+            bool is_field_modified(size_t idx, const db_value& current) const;
+            void load_fields(const std::vector<size_t>& fields);
+            void store_key();
+            void bind_key(statement& stmt, size_t idx) const;
 
-            friend std::vector<std::unique_ptr<entity>> select_multiple(database& db, const class_info& info, const std::string& where, std::vector<db_value> vals);
-            friend std::unique_ptr<entity> select_one(database& db, const class_info& info, const std::string& where, std::vector<db_value> vals);
+            friend struct entity_loader;
         public:
             explicit entity(sqlitepp::database& db)
-                : m_db(db)
+                : m_db(db), m_db_vals(), m_db_hashes(), m_pending(), m_key()
+            {}
+            /**
+             * \brief Construct an entity whose internal bookkeeping is allocated from resource.
+             * 
+             * Used by entity_arena, the resource has to outlive the entity. Text and blob values held
+             * by the snapshot are not allocated from resource.
+             */
+            entity(sqlitepp::database& db, std::pmr::memory_resource* resource)
+                : m_db(db), m_db_vals(resource), m_db_hashes(resource), m_pending(resource), m_key(resource)
             {}
             virtual ~entity() {}
 
@@ -49,12 +83,40 @@ namespace sqlitepp {
             bool is_modified() const;
             /**
              * \brief Reset the entity to its original values
+             * 
+             * Values not kept in the snapshot are read from the database again.
              */
             void reset();
+            /**
+             * \brief Reload all fields from the database
+             */
+            void refresh();
+            /**
+             * \brief Load all fields that were left out when reading this entity (e.g. lazy fields)
+             * 
+             * Changes made to those fields before loading are overwritten.
+             */
+            void load();
+            /**
+             * \brief Load a single field if it was left out when reading this entity
+             */
+            void load(const std::string& field);
+            /**
+             * \brief Check if a field holds the value read from the database
+             */
+            bool is_loaded(const std::string& field) const;
             /**
              * \brief Persist all changes to the database
              */
             void save();
+            /**
+             * \brief Insert the entity or update the row with the same primary key / unique fields
+             * 
+             * Uses a single INSERT ... ON CONFLICT DO UPDATE statement, the entity refers to the
+             * inserted or updated row afterwards. Fields left out when reading the entity (e.g. lazy fields)
+             * are loaded first unless they were changed, so their stored values are kept.
+             */
+            void upsert();
             /**
              * \brief Remove the entity from the database
              */
@@ -0,0 +1,97 @@
+#pragma once
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <sqlitepp/fwd.h>
+
+namespace sqlitepp {
+    namespace orm {
+        /**
+         * \brief Cache of loaded entities keyed by class and rowid.
+         *
+         * Once attached to a database using database::set_identity_map() the *_shared select functions
+         * and orm::find() return the same shared_ptr for the same row as long as it is alive.
+         * Entries are held weakly, the most recently used lru_capacity entities are additionally kept alive.
+         *
+         * Writes on the owning connection evict the affected rows through sqlite3_update_hook, except
+         * for writes done by the cached entity itself. SQLite does not report changes made by other
+         * connections or the truncate optimization (DELETE without WHERE) to the hook, orm::remove()
+         * evicts the whole class in the latter case.
+         *
+         * Cached entities reflect uncommitted writes of the owning connection. Rolling back a transaction
+         * clears the map (sqlite3_rollback_hook), but entities still held by the application keep the values
+         * they had and have to be refreshed. ROLLBACK TO a savepoint is not reported by SQLite, call clear()
+         * after rolling back to a savepoint that wrote cached entities.
+         */
+        class identity_map {
+            struct key {
+                const class_info* info;
+                int64_t rowid;
+                bool operator==(const key& o) const noexcept { return info == o.info && rowid == o.rowid; }
+            };
+            struct key_hash {
+                size_t operator()(const key& k) const noexcept {
+                    return std::hash<const void*>{}(k.info) ^ (std::hash<int64_t>{}(k.rowid) * 31);
+                }
+            };
+            typedef std::list<std::pair<key, std::shared_ptr<entity>>> lru_list_t;
+            struct entry {
+                std::weak_ptr<entity> ptr;
+                lru_list_t::iterator lru;
+                bool in_lru;
+            };
+
+            mutable std::mutex m_mtx {};
+            size_t m_capacity;
+            size_t m_sweep_threshold {64};
+            std::unordered_map<key, entry, key_hash> m_entries {};
+            std::unordered_multimap<std::string, const class_info*> m_classes {};
+            lru_list_t m_lru {};
+            const entity* m_writing {nullptr};
+
+            void touch(entry& e, const key& k, const std::shared_ptr<entity>& ptr);
+            void erase(std::unordered_map<key, entry, key_hash>::iterator it);
+            void sweep();
+        public:
+            explicit identity_map(size_t lru_capacity = 0);
+
+            identity_map(const identity_map&) = delete;
+            identity_map& operator=(const identity_map&) = delete;
+
+            /**
+             * \brief Get the cached entity for the given row or nullptr
+             */
+            std::shared_ptr<entity> find(const class_info& info, int64_t rowid);
+            /**
+             * \brief Add a loaded entity to the map, returns the entity already cached for this row if any
+             */
+            std::shared_ptr<entity> insert(const class_info& info, int64_t rowid, std::shared_ptr<entity> e);
+            void evict(const class_info& info, int64_t rowid);
+            void evict(const class_info& info);
+            /**
+             * \brief Evict a row of every class mapped to table
+             */
+            void evict(const std::string& table, int64_t rowid);
+            void clear();
+            size_t size() const;
+
+            /**
+             * \brief Marks writes done by an entity, so they do not evict the entity itself
+             */
+            class write_guard {
+                identity_map* m_map;
+            public:
+                write_guard(identity_map* map, const entity* e);
+                ~write_guard();
+                write_guard(const write_guard&) = delete;
+                write_guard& operator=(const write_guard&) = delete;
+            };
+
+            // Called by database
+            void on_update(int op, const char* table, int64_t rowid);
+        };
+    }
+}
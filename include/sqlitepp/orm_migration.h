@@ -0,0 +1,72 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <sqlitepp/fwd.h>
+
+namespace sqlitepp {
+    namespace orm {
+        /**
+         * \brief Changes needed to bring a table in line with its class_info, see plan_migration()
+         */
+        struct migration_plan {
+            enum class action {
+                // The table matches the class
+                none,
+                // The table does not exist yet
+                create,
+                // Only cheap changes (ADD COLUMN, CREATE INDEX) are needed
+                alter,
+                // The table has to be copied into a new table
+                rebuild
+            };
+            action kind { action::none };
+            // Human readable description of every difference found
+            std::vector<std::string> changes {};
+            // Statements executed for create and alter, the indexes created after a rebuild
+            std::vector<std::string> statements {};
+        };
+
+        struct migration_progress {
+            enum class phase {
+                copy,
+                swap,
+                done
+            };
+            phase current { phase::copy };
+            std::string table {};
+            int64_t rows_copied { 0 };
+            // Estimated from the highest rowid, may be smaller than rows_copied
+            int64_t rows_estimated { 0 };
+        };
+
+        struct migration_options {
+            // Rows copied per transaction during a rebuild
+            size_t batch_size { 10000 };
+            // Time to sleep between two batches, giving other connections room to write
+            std::chrono::milliseconds pause { 0 };
+            std::function<void(const migration_progress&)> progress {};
+        };
+
+        /**
+         * \brief Compare the live table (PRAGMA table_info, index_list, foreign_key_list) with the class
+         */
+        migration_plan plan_migration(database& db, const class_info& info);
+
+        /**
+         * \brief Migrate the table of a class to its current definition, returns the executed plan
+         *
+         * Cheap changes are applied in a single transaction. A rebuild creates a shadow table,
+         * keeps it in sync using triggers and copies the existing rows in batches of
+         * options.batch_size rowids, each in its own short transaction. Other connections can keep
+         * reading and writing between batches. The tables are swapped in a final transaction.
+         * New NOT NULL columns without default_value() are filled with 0, an empty string or blob.
+         * Tables created WITHOUT ROWID are copied in a single batch.
+         *
+         * Has to be called outside of a transaction. Columns that no longer exist in the class are dropped.
+         */
+        migration_plan migrate(database& db, const class_info& info, const migration_options& options = {});
+    }
+}
@@ -0,0 +1,385 @@
+#pragma once
+#include <algorithm>
+#include <tuple>
+
+#include <sqlitepp/orm.h>
+
+namespace sqlitepp {
+    namespace orm {
+        /**
+         * \brief Entities loaded by select_query::fetch() together with their eagerly loaded relations
+         */
+        template<typename T>
+        class result_set {
+            struct relation {
+                size_t field;
+                const class_info* target;
+                relation_index_t index;
+            };
+            std::vector<std::unique_ptr<T>> m_entities;
+            std::vector<relation> m_relations;
+
+            template<typename U> friend class select_query;
+        public:
+            result_set()
+                : m_entities(), m_relations()
+            {}
+
+            std::vector<std::unique_ptr<T>>& entities() noexcept { return m_entities; }
+            const std::vector<std::unique_ptr<T>>& entities() const noexcept { return m_entities; }
+            size_t size() const noexcept { return m_entities.size(); }
+            bool empty() const noexcept { return m_entities.empty(); }
+            T& operator[](size_t idx) const { return *m_entities[idx]; }
+            typename std::vector<std::unique_ptr<T>>::const_iterator begin() const noexcept { return m_entities.begin(); }
+            typename std::vector<std::unique_ptr<T>>::const_iterator end() const noexcept { return m_entities.end(); }
+
+            /**
+             * \brief Get the entity referenced by the foreign key member of e, loaded using select_query::with()
+             *
+             * Returns nullptr if the key is NULL or the referenced row does not exist.
+             */
+            template<typename U, typename M>
+            std::shared_ptr<U> related(const T& e, M T::*ptr) const {
+                auto idx = T::_class_info.get_field_indexes(ptr);
+                if(idx.size() != 1) throw std::invalid_argument("member is not mapped to a single field");
+                for(auto& r : m_relations) {
+                    if(r.field != idx[0] || r.target != &U::_class_info) continue;
+                    auto it = r.index.find(T::_class_info.fields[r.field].getter(&e));
+                    if(it == r.index.end()) return nullptr;
+                    return std::static_pointer_cast<U>(it->second);
+                }
+                throw std::logic_error("relation was not loaded, use with() to load it");
+            }
+        };
+
+        /**
+         * \brief Typed select builder
+         *
+         * orm::select<T>(db).fields(&T::name, &T::status).where("status"_c == 1).all()
+         * orm::select<T>(db).order_by(&T::id).after(*page.back()).limit(50).all()
+         *
+         * Fields left out by fields() are not read and stay pending on the returned entities,
+         * they are never written back unless changed and can be loaded using entity::load().
+         */
+        template<typename T>
+        class select_query {
+            struct relation_spec {
+                size_t field;
+                const class_info* target;
+            };
+            database& m_db;
+            select_options m_options;
+            std::vector<relation_spec> m_relations;
+
+            void add_fields() {}
+            template<typename U, typename... Members>
+            void add_fields(U T::*ptr, Members... others) {
+                auto idx = T::_class_info.get_field_indexes(ptr);
+                if(idx.empty()) throw std::invalid_argument("member is not mapped to a field");
+                m_options.fields.insert(m_options.fields.end(), idx.begin(), idx.end());
+                add_fields(others...);
+            }
+        public:
+            explicit select_query(database& db)
+                : m_db(db), m_options(), m_relations()
+            {}
+
+            /**
+             * \brief Only read the given members
+             */
+            template<typename... Members>
+            select_query& fields(Members... ptrs) {
+                m_options.fields.clear();
+                add_fields(ptrs...);
+                return *this;
+            }
+
+            template<size_t A, size_t B>
+            select_query& where(const condition<A,B>& where) {
+                auto p = where.as_partial();
+                m_options.where = std::move(p.query);
+                m_options.params.assign(std::make_move_iterator(p.params.begin()), std::make_move_iterator(p.params.end()));
+                return *this;
+            }
+
+            select_query& where(const std::string& where, std::vector<db_value> vals = {}) {
+                m_options.where = where;
+                m_options.params = std::move(vals);
+                return *this;
+            }
+
+            select_query& where(const dynamic_condition& where) {
+                m_options.where.clear();
+                where.render(m_options.where);
+                m_options.params.assign(where.params().begin(), where.params().end());
+                return *this;
+            }
+
+            /**
+             * \brief Add an ORDER BY term, calls are applied in order
+             */
+            template<typename U>
+            select_query& order_by(U T::*ptr, sort_order order = sort_order::ascending) {
+                auto idx = T::_class_info.get_field_indexes(ptr);
+                if(idx.size() != 1) throw std::invalid_argument("member is not mapped to a single field");
+                m_options.order_by.push_back({ idx[0], order });
+                return *this;
+            }
+
+            select_query& limit(int64_t n) {
+                m_options.limit = n;
+                return *this;
+            }
+
+            select_query& offset(int64_t n) {
+                m_options.offset = n;
+                return *this;
+            }
+
+            /**
+             * \brief Continue after the given values of the order_by() fields, see select_options::after
+             */
+            select_query& after(std::vector<db_value> values) {
+                m_options.after = std::move(values);
+                return *this;
+            }
+
+            /**
+             * \brief Continue after the last entity of the previous page
+             */
+            select_query& after(const T& last) {
+                m_options.after.clear();
+                for(auto& o : m_options.order_by) {
+                    m_options.after.push_back(T::_class_info.fields[o.field].getter(&last));
+                }
+                return *this;
+            }
+
+            /**
+             * \brief Eagerly load the entities of U referenced by the fk() field ptr when calling fetch()
+             *
+             * All referenced rows of the result are loaded using batched IN (...) queries, instead of one query per entity.
+             */
+            template<typename U, typename M>
+            select_query& with(M T::*ptr) {
+                auto idx = T::_class_info.get_field_indexes(ptr);
+                if(idx.size() != 1) throw std::invalid_argument("member is not mapped to a single field");
+                auto& f = T::_class_info.fields[idx[0]];
+                if(f.fk_table.empty()) throw std::invalid_argument("field " + f.name + " is not a foreign key");
+                if(f.fk_table != U::_class_info.table) throw std::invalid_argument("field " + f.name + " does not reference " + U::_class_info.table);
+                m_relations.push_back(relation_spec{ idx[0], &U::_class_info });
+                return *this;
+            }
+
+            const select_options& options() const noexcept { return m_options; }
+
+            /**
+             * \brief Select all matching entities together with the relations requested by with()
+             */
+            result_set<T> fetch() const {
+                result_set<T> res;
+                // Foreign keys need to be read even if a projection left them out
+                auto options = m_options;
+                for(auto& r : m_relations) {
+                    if(!options.fields.empty() && std::find(options.fields.begin(), options.fields.end(), r.field) == options.fields.end())
+                        options.fields.push_back(r.field);
+                }
+                for(auto& e : select_multiple(m_db, T::_class_info, options)) {
+                    res.m_entities.emplace_back(static_cast<T*>(e.release()));
+                }
+                for(auto& r : m_relations) {
+                    auto& f = T::_class_info.fields[r.field];
+                    std::vector<db_value> keys;
+                    keys.reserve(res.m_entities.size());
+                    for(auto& e : res.m_entities) keys.push_back(f.getter(e.get()));
+                    res.m_relations.push_back({ r.field, r.target, select_related(m_db, *r.target, f.fk_field, keys) });
+                }
+                return res;
+            }
+
+            std::vector<std::unique_ptr<T>> all() const {
+                auto m = select_multiple(m_db, T::_class_info, m_options);
+                std::vector<std::unique_ptr<T>> res;
+                res.reserve(m.size());
+                for(auto& e : m) {
+                    res.emplace_back(static_cast<T*>(e.release()));
+                }
+                return res;
+            }
+
+            std::unique_ptr<T> one() const {
+                return std::unique_ptr<T>(static_cast<T*>(select_one(m_db, T::_class_info, m_options).release()));
+            }
+
+            std::vector<std::shared_ptr<T>> all_shared() const {
+                auto m = select_multiple_shared(m_db, T::_class_info, m_options);
+                std::vector<std::shared_ptr<T>> res;
+                res.reserve(m.size());
+                for(auto& e : m) {
+                    res.emplace_back(std::static_pointer_cast<T>(std::move(e)));
+                }
+                return res;
+            }
+
+            size_t all(entity_arena& arena) const {
+                return select_multiple(m_db, T::_class_info, arena, m_options);
+            }
+
+            /**
+             * \brief Read the selected fields into tuples without creating entities
+             *
+             * Types need to be supported by result_iterator::get_tuple() and match the order of fields().
+             */
+            template<typename... Types>
+            std::vector<std::tuple<Types...>> tuples() const {
+                auto stmt = select_columns(m_db, T::_class_info, m_options);
+                auto it = stmt.iterator();
+                std::vector<std::tuple<Types...>> res;
+                while(it.next()) {
+                    res.emplace_back();
+                    it.get_tuple(res.back());
+                }
+                return res;
+            }
+        };
+
+        template <class T, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
+        inline select_query<T> select(database& db) {
+            return select_query<T>(db);
+        }
+
+        /**
+         * \brief Type used to read an aggregate or group key of a member of type U
+         */
+        template<typename U, typename = void>
+        struct aggregate_value;
+        template<typename U>
+        struct aggregate_value<U, typename std::enable_if<std::is_integral<U>::value || std::is_enum<U>::value>::type> { typedef int64_t type; };
+        template<typename U>
+        struct aggregate_value<U, typename std::enable_if<std::is_floating_point<U>::value>::type> { typedef double type; };
+        template<>
+        struct aggregate_value<std::chrono::system_clock::time_point> { typedef int64_t type; };
+        template<>
+        struct aggregate_value<std::string> { typedef std::string type; };
+        template<>
+        struct aggregate_value<std::vector<uint8_t>> { typedef std::vector<uint8_t> type; };
+        template<typename U>
+        struct aggregate_value<std::optional<U>> : aggregate_value<U> {};
+
+        /**
+         * \brief Typed aggregate builder
+         *
+         * orm::aggregate<T>(db).group_by(&T::account).sum(&T::amount).where("amount"_c > 0).rows()
+         *
+         * Every call to group_by(), count(), sum(), avg(), min() or max() adds a result column in call order.
+         * The query runs inside the database, rows() returns one tuple per group.
+         * NULL results (e.g. SUM over no rows) are read as 0 or an empty value.
+         * Calls adding columns consume the builder, use the returned one.
+         */
+        template<typename T, typename... Columns>
+        class aggregate_query {
+            database& m_db;
+            aggregate_options m_options;
+
+            template<typename, typename...> friend class aggregate_query;
+
+            template<typename U>
+            static size_t field_index(U T::*ptr) {
+                auto idx = T::_class_info.get_field_indexes(ptr);
+                if(idx.size() != 1) throw std::invalid_argument("member is not mapped to a single field");
+                return idx[0];
+            }
+
+            template<typename R>
+            aggregate_query<T, Columns..., R> add(std::string function, size_t field) {
+                m_options.columns.push_back({ std::move(function), field });
+                return aggregate_query<T, Columns..., R>(m_db, std::move(m_options));
+            }
+        public:
+            aggregate_query(database& db, aggregate_options options = {})
+                : m_db(db), m_options(std::move(options))
+            {}
+
+            /**
+             * \brief Group by the given member, the key is added as result column
+             */
+            template<typename U>
+            aggregate_query<T, Columns..., typename aggregate_value<U>::type> group_by(U T::*ptr) {
+                auto idx = field_index(ptr);
+                m_options.group_by.push_back(idx);
+                return add<typename aggregate_value<U>::type>("", idx);
+            }
+
+            aggregate_query<T, Columns..., int64_t> count() {
+                return add<int64_t>("COUNT", aggregate_options::all_fields);
+            }
+            /**
+             * \brief Count rows where the member is not NULL
+             */
+            template<typename U>
+            aggregate_query<T, Columns..., int64_t> count(U T::*ptr) {
+                return add<int64_t>("COUNT", field_index(ptr));
+            }
+            template<typename U, typename R = typename aggregate_value<U>::type,
+                typename std::enable_if<std::is_arithmetic<R>::value>::type* = nullptr>
+            aggregate_query<T, Columns..., R> sum(U T::*ptr) {
+                return add<R>("SUM", field_index(ptr));
+            }
+            template<typename U, typename R = typename aggregate_value<U>::type,
+                typename std::enable_if<std::is_arithmetic<R>::value>::type* = nullptr>
+            aggregate_query<T, Columns..., double> avg(U T::*ptr) {
+                return add<double>("AVG", field_index(ptr));
+            }
+            template<typename U>
+            aggregate_query<T, Columns..., typename aggregate_value<U>::type> min(U T::*ptr) {
+                return add<typename aggregate_value<U>::type>("MIN", field_index(ptr));
+            }
+            template<typename U>
+            aggregate_query<T, Columns..., typename aggregate_value<U>::type> max(U T::*ptr) {
+                return add<typename aggregate_value<U>::type>("MAX", field_index(ptr));
+            }
+
+            template<size_t A, size_t B>
+            aggregate_query& where(const condition<A,B>& where) {
+                auto p = where.as_partial();
+                m_options.where = std::move(p.query);
+                m_options.params.assign(std::make_move_iterator(p.params.begin()), std::make_move_iterator(p.params.end()));
+                return *this;
+            }
+
+            aggregate_query& where(const std::string& where, std::vector<db_value> vals = {}) {
+                m_options.where = where;
+                m_options.params = std::move(vals);
+                return *this;
+            }
+
+            const aggregate_options& options() const noexcept { return m_options; }
+
+            std::vector<std::tuple<Columns...>> rows() const {
+                static_assert(sizeof...(Columns) != 0, "no aggregate columns");
+                auto stmt = select_aggregate(m_db, T::_class_info, m_options);
+                auto it = stmt.iterator();
+                std::vector<std::tuple<Columns...>> res;
+                while(it.next()) {
+                    res.emplace_back();
+                    it.get_tuple(res.back());
+                }
+                return res;
+            }
+
+            /**
+             * \brief Get the single result row of an aggregate without group_by()
+             */
+            std::tuple<Columns...> one() const {
+                auto r = rows();
+                if(r.empty()) return {};
+                return r.front();
+            }
+        };
+
+        template <class T, typename std::enable_if<std::is_same<decltype(T::_class_info), const sqlitepp::orm::class_info>::value>::type* = nullptr>
+        inline aggregate_query<T> aggregate(database& db) {
+            return aggregate_query<T>(db);
+        }
+    }
+}
@@ -1,18 +1,31 @@
 #pragma once
+#include <chrono>
 #include <cstdint>
 #include <stdexcept>
 #include <string>
+#include <system_error>
 #include <utility>
 #include <vector>
 
 struct sqlite3_stmt;
 namespace sqlitepp {
+	class cancellation_token;
+	class database;
+	enum class error_code : int;
+
 	class result_iterator {
 		sqlite3_stmt* m_handle;
 		bool m_has_row;
-		result_iterator(sqlite3_stmt* hdl)
-			: m_handle(hdl), m_has_row(false)
+		// Limits of the statement, checked by a progress handler while stepping
+		std::chrono::steady_clock::time_point m_deadline;
+		const cancellation_token* m_token;
+		// Owner of the progress handler replaced while stepping with limits
+		database* m_db;
+		result_iterator(sqlite3_stmt* hdl, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max(), const cancellation_token* token = nullptr, database* db = nullptr)
+			: m_handle(hdl), m_has_row(false), m_deadline(deadline), m_token(token), m_db(db)
 		{}
+
+		int step_limited(error_code& reason) noexcept;
 		friend class statement;
 		template<typename... Types> 
 		friend class stl_for_each_iterator;
@@ -43,10 +56,15 @@ namespace sqlitepp {
 
 		bool is_valid() const noexcept;
 		bool next();
+		/**
+		 * \brief Same as next() but stores errors in ec instead of throwing, returns false on error
+		 */
+		bool try_next(std::error_code& ec) noexcept;
 		bool done() const noexcept;
 
 		size_t column_count() const noexcept;
 		const char* column_name(size_t idx) const;
+		bool column_is_null(size_t idx) const;
 		size_t column_index(const std::string& name) const;
 		double column_double(size_t idx) const;
 		int64_t column_int64(size_t idx) const;
@@ -1,4 +1,9 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string_view>
+#include <system_error>
 #include <utility>
 #include <vector>
 
@@ -6,9 +11,59 @@
 
 namespace sqlitepp {
 	class database;
+	namespace detail {
+		struct statement_cache;
+	}
+
+	/**
+	 * \brief Normalize the text of a statement
+	 * 
+	 * Collapses whitespace outside of literals and comments, removes whitespace next to parentheses
+	 * and commas as well as trailing semicolons. Statements with the same canonical text are equivalent.
+	 */
+	std::string canonical_sql(std::string_view query);
+	/**
+	 * \brief Same as canonical_sql() for a condition, additionally removes redundant parentheses
+	 * 
+	 * Parentheses around a single predicate, e.g. "(`a` = ?) AND (`b` = ?)" become "`a` = ? AND `b` = ?".
+	 */
+	std::string canonical_condition(std::string_view condition);
+	/**
+	 * \brief 64bit FNV-1a hash of a canonical statement or condition
+	 */
+	uint64_t shape_hash(std::string_view canonical) noexcept;
+
+	/**
+	 * \brief Bind a blob of size zero bytes without allocating it, to be filled using blob_stream
+	 */
+	struct zeroblob {
+		uint64_t size;
+	};
+
+	/**
+	 * \brief Flag checked by running statements, see statement::with_cancellation()
+	 */
+	class cancellation_token {
+		std::atomic<bool> m_cancelled { false };
+	public:
+		/**
+		 * \brief Request cancellation, safe to call from any thread
+		 */
+		void cancel() noexcept { m_cancelled.store(true, std::memory_order_relaxed); }
+		void reset() noexcept { m_cancelled.store(false, std::memory_order_relaxed); }
+		bool is_cancelled() const noexcept { return m_cancelled.load(std::memory_order_relaxed); }
+	};
+
 	class statement {
 		database* m_db;
 		sqlite3_stmt* m_handle;
+		// Cache the handle is returned to, it outlives the database if the statement does
+		std::shared_ptr<detail::statement_cache> m_cache;
+		std::chrono::steady_clock::duration m_timeout;
+		std::chrono::steady_clock::time_point m_deadline;
+		const cancellation_token* m_token;
+
+		void release() noexcept;
 
 		template<typename Arg1, typename... Args>
 		void bind_all_impl(size_t idx, Arg1&& arg1, Args&&... args) {
@@ -50,11 +105,34 @@ namespace sqlitepp {
 #endif
 
 		void bind(size_t idx, const std::vector<uint8_t>& blob);
+		void bind(size_t idx, zeroblob blob);
 		void bind(size_t idx, std::nullptr_t);
 		void bind(size_t idx, double val);
 		void bind(size_t idx, int val);
 		void bind(size_t idx, int64_t val);
 
+		/**
+		 * \brief Same as bind() but returns the error instead of throwing a std::system_error
+		 * 
+		 * The error message is available from sqlite3_errmsg(parent_database().raw()).
+		 */
+#ifdef __cpp_lib_string_view
+		std::error_code try_bind(size_t idx, const std::string_view& str) noexcept;
+		std::error_code try_bind(size_t idx, const std::wstring_view& str) noexcept;
+		std::error_code try_bind(size_t idx, const std::string_view& data, bool is_blob) noexcept;
+#else
+		std::error_code try_bind(size_t idx, const std::string& str) noexcept;
+		std::error_code try_bind(size_t idx, const std::wstring& str) noexcept;
+		std::error_code try_bind(size_t idx, const std::string& data, bool is_blob) noexcept;
+#endif
+
+		std::error_code try_bind(size_t idx, const std::vector<uint8_t>& blob) noexcept;
+		std::error_code try_bind(size_t idx, zeroblob blob) noexcept;
+		std::error_code try_bind(size_t idx, std::nullptr_t) noexcept;
+		std::error_code try_bind(size_t idx, double val) noexcept;
+		std::error_code try_bind(size_t idx, int val) noexcept;
+		std::error_code try_bind(size_t idx, int64_t val) noexcept;
+
 		template<typename... Args>
 		void bind_tuple(std::tuple<Args...>& t) {
 			bind_tuple_impl(t, std::index_sequence_for<Args...>{});
@@ -70,6 +148,29 @@ namespace sqlitepp {
 		size_t param_name(const char* name) const noexcept;
 		size_t param_name(const std::string& name) const;
 
+		/**
+		 * \brief Abort every execution (iterator()) running longer than timeout, a zero timeout removes the limit
+		 * 
+		 * Limits are checked by a progress handler every 1000 virtual machine instructions and once before each step,
+		 * exceeding the limit throws a std::system_error with error_code::timeout. Unlike database::interrupt()
+		 * other statements on the same connection are not affected. Time spent outside of a step (e.g. between
+		 * two rows) counts towards the timeout.
+		 * While stepping the limits take over the progress handler of the connection. A handler set using
+		 * database::set_progress_handler() keeps being called and is restored afterwards, one installed
+		 * directly on database::raw() is removed.
+		 */
+		statement& with_timeout(std::chrono::steady_clock::duration timeout) noexcept;
+		/**
+		 * \brief Abort executions running past deadline, see with_timeout()
+		 */
+		statement& with_deadline(std::chrono::steady_clock::time_point deadline) noexcept;
+		/**
+		 * \brief Abort executions once token is cancelled with error_code::cancelled, pass nullptr to remove it
+		 * 
+		 * The token has to outlive the statement.
+		 */
+		statement& with_cancellation(const cancellation_token* token) noexcept;
+
 		result_iterator iterator();
 
 		template<typename... Types>
@@ -89,5 +190,20 @@ namespace sqlitepp {
 		}
 
 		void execute();
+		/**
+		 * \brief Execute the statement and return the error instead of throwing, for paths expecting errors
+		 * 
+		 * Retrying after error_code::busy or handling error_code::constraint (e.g. an upsert fallback)
+		 * does not unwind the stack. The statement is reset afterwards, bindings are kept.
+		 */
+		std::error_code try_execute() noexcept;
+		/**
+		 * \brief Reset the statement so it can be executed again, bindings are kept
+		 */
+		void reset();
+		/**
+		 * \brief Set all parameters to NULL
+		 */
+		void clear_bindings();
 	};
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+namespace sqlitepp {
+	class database;
+
+	enum class transaction_mode {
+		// Locks are acquired on first use, a reader upgrading to a writer can fail with busy without retrying
+		deferred,
+		// Acquire the write lock at BEGIN, recommended for transactions that write
+		immediate,
+		// Also prevent readers (only differs from immediate outside of WAL mode)
+		exclusive
+	};
+
+	/**
+	 * \brief RAII transaction, rolled back on destruction unless commit() was called
+	 */
+	class transaction {
+		database* m_db;
+		bool m_active;
+	public:
+		explicit transaction(database& db, transaction_mode mode = transaction_mode::deferred);
+		transaction(transaction&& other) noexcept;
+		transaction& operator=(transaction&& other) = delete;
+		transaction(const transaction& other) = delete;
+		transaction& operator=(const transaction& other) = delete;
+		~transaction() noexcept;
+
+		bool is_active() const noexcept { return m_active; }
+		void commit();
+		void rollback();
+	};
+
+	/**
+	 * \brief Serializes writers of one process in FIFO order
+	 *
+	 * Connections of the same process competing for the write lock only see each other through SQLITE_BUSY,
+	 * retrying in a busy handler is unfair and causes long tail latencies. Writers going through the same
+	 * write_scheduler instead wait in a ticket queue and are served in arrival order, each one running its own
+	 * BEGIN IMMEDIATE transaction. Configure a busy_strategy to handle contention with other processes.
+	 *
+	 * auto rows = scheduler.run(db, [&](database& db) { return orm::update_where(...); });
+	 */
+	class write_scheduler {
+		mutable std::mutex m_mtx {};
+		std::condition_variable m_cv {};
+		uint64_t m_next_ticket { 0 };
+		uint64_t m_serving { 0 };
+	public:
+		write_scheduler() = default;
+		write_scheduler(const write_scheduler&) = delete;
+		write_scheduler& operator=(const write_scheduler&) = delete;
+
+		/**
+		 * \brief Wait for the turn of the calling thread, every lock() needs a matching unlock()
+		 */
+		void lock();
+		void unlock();
+		/**
+		 * \brief Number of writers waiting or running
+		 */
+		size_t pending() const noexcept;
+
+		/**
+		 * \brief Run fn(db) in its own BEGIN IMMEDIATE transaction once all earlier writers are done
+		 *
+		 * The transaction is committed if fn returns and rolled back if it throws.
+		 */
+		template<typename Fn>
+		auto run(database& db, Fn&& fn) -> decltype(fn(db)) {
+			std::unique_lock<write_scheduler> lck(*this);
+			transaction tx(db, transaction_mode::immediate);
+			if constexpr(std::is_void<decltype(fn(db))>::value) {
+				fn(db);
+				tx.commit();
+			} else {
+				auto res = fn(db);
+				tx.commit();
+				return res;
+			}
+		}
+	};
+}
@@ -0,0 +1,183 @@
+#pragma once
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <sqlitepp/function.h>
+
+namespace sqlitepp {
+	class database;
+
+	namespace detail {
+		struct vtab_column {
+			std::string name;
+			// Declared type of the column
+			std::string type;
+			// Rows are ordered by this column (ascending)
+			bool sorted;
+			void(*result)(sqlite3_context* ctx, const void* row, const void* accessor);
+			// Compare the column of row with val, returns false if the values can not be compared
+			bool(*compare)(const void* row, const void* accessor, sqlite3_value* val, int& res);
+			std::shared_ptr<const void> accessor;
+		};
+
+		struct vtab_source {
+			std::vector<vtab_column> columns;
+			const void* container;
+			size_t(*size)(const void* container);
+			const void*(*at)(const void* container, size_t idx);
+		};
+
+		/**
+		 * \brief Register src as eponymous virtual table name, defined in vtab.cpp
+		 */
+		void register_vtab(database& db, const std::string& name, std::unique_ptr<vtab_source> src);
+
+		template<typename U>
+		const char* declared_type() noexcept {
+			if constexpr(is_optional<U>::value) return declared_type<typename U::value_type>();
+			else if constexpr(std::is_integral<U>::value || std::is_enum<U>::value) return "INTEGER";
+			else if constexpr(std::is_floating_point<U>::value) return "REAL";
+			else if constexpr(std::is_same<U, std::vector<uint8_t>>::value) return "BLOB";
+			else return "TEXT";
+		}
+
+		template<typename U>
+		bool compare_column(const U& lhs, sqlite3_value* val, int& res) {
+			int type = sqlite3_value_type(val);
+			if constexpr(std::is_integral<U>::value || std::is_enum<U>::value) {
+				if(type == SQLITE_INTEGER) {
+					auto l = static_cast<int64_t>(lhs);
+					auto r = sqlite3_value_int64(val);
+					res = l < r ? -1 : (l > r ? 1 : 0);
+					return true;
+				}
+			}
+			if constexpr(std::is_arithmetic<U>::value || std::is_enum<U>::value) {
+				if(type != SQLITE_INTEGER && type != SQLITE_FLOAT) return false;
+				auto l = static_cast<double>(lhs);
+				auto r = sqlite3_value_double(val);
+				res = l < r ? -1 : (l > r ? 1 : 0);
+				return true;
+			} else {
+				if(type != SQLITE_TEXT) return false;
+				std::string_view r(reinterpret_cast<const char*>(sqlite3_value_text(val)), sqlite3_value_bytes(val));
+				res = std::string_view(lhs).compare(r);
+				return true;
+			}
+		}
+	}
+
+	/**
+	 * \brief Expose a random access container of T as eponymous virtual table
+	 *
+	 * std::vector<point> points = ...;
+	 * vtab<point> table;
+	 * table.column("id", &point::id, true).column("x", &point::x).column("norm", [](const point& p) { return p.x * p.x + p.y * p.y; });
+	 * table.attach(db, "points", points);
+	 * db.exec("SELECT * FROM points JOIN t ON t.point_id = points.id;");
+	 *
+	 * Rows are read directly from the container when SQLite asks for a column, string and blob members
+	 * are passed without copying. The container is referenced, it has to outlive the database connection
+	 * (or until the name is attached again) and must not be modified while a statement reads it.
+	 *
+	 * Columns marked as sorted must be ordered ascending in the container. Equality and range constraints
+	 * (=, <, <=, >, >=) using the BINARY collation on a sorted column are resolved using binary search and ORDER BY on it is satisfied
+	 * without sorting. All other constraints are checked by SQLite while scanning.
+	 */
+	template<typename T>
+	class vtab {
+		std::vector<detail::vtab_column> m_columns {};
+
+		template<typename U, typename Getter>
+		vtab& add_column(std::string name, std::shared_ptr<const void> accessor, bool sorted) {
+			static_assert(!std::is_same<U, std::nullptr_t>::value, "unsupported column type");
+			if(sorted && !(std::is_arithmetic<U>::value || std::is_enum<U>::value || std::is_same<U, std::string>::value || std::is_same<U, std::string_view>::value))
+				throw std::invalid_argument("only numeric and text columns can be sorted");
+			detail::vtab_column col{ std::move(name), detail::declared_type<U>(), sorted, nullptr, nullptr, std::move(accessor) };
+			col.result = [](sqlite3_context* ctx, const void* row, const void* accessor) {
+				Getter::result(ctx, *static_cast<const T*>(row), accessor);
+			};
+			col.compare = [](const void* row, const void* accessor, sqlite3_value* val, int& res) {
+				if constexpr(std::is_arithmetic<U>::value || std::is_enum<U>::value || std::is_same<U, std::string>::value || std::is_same<U, std::string_view>::value)
+					return detail::compare_column<U>(Getter::get(*static_cast<const T*>(row), accessor), val, res);
+				else
+					return false;
+			};
+			m_columns.push_back(std::move(col));
+			return *this;
+		}
+
+		template<typename U>
+		struct member_getter {
+			static const U& get(const T& row, const void* accessor) {
+				return row.*(*static_cast<U T::* const*>(accessor));
+			}
+			static void result(sqlite3_context* ctx, const T& row, const void* accessor) {
+				auto& val = get(row, accessor);
+				// Members live as long as the container, no copy is needed
+				if constexpr(std::is_same<U, std::string>::value)
+					sqlite3_result_text64(ctx, val.data(), val.size(), SQLITE_STATIC, SQLITE_UTF8);
+				else if constexpr(std::is_same<U, std::vector<uint8_t>>::value)
+					sqlite3_result_blob64(ctx, val.data(), val.size(), SQLITE_STATIC);
+				else
+					detail::set_result(ctx, val);
+			}
+		};
+
+		template<typename Fn>
+		struct function_getter {
+			static decltype(auto) get(const T& row, const void* accessor) {
+				return (*static_cast<const Fn*>(accessor))(row);
+			}
+			static void result(sqlite3_context* ctx, const T& row, const void* accessor) {
+				detail::set_result(ctx, get(row, accessor));
+			}
+		};
+	public:
+		/**
+		 * \brief Add a column reading a member of T
+		 */
+		template<typename U>
+		vtab& column(std::string name, U T::*member, bool sorted = false) {
+			return add_column<std::decay_t<U>, member_getter<U>>(std::move(name), std::make_shared<U T::*>(member), sorted);
+		}
+		/**
+		 * \brief Add a column computed by fn(const T&)
+		 */
+		template<typename Fn, typename = std::enable_if_t<std::is_invocable<const Fn&, const T&>::value>>
+		vtab& column(std::string name, Fn fn, bool sorted = false) {
+			using U = std::decay_t<std::invoke_result_t<const Fn&, const T&>>;
+			return add_column<U, function_getter<Fn>>(std::move(name), std::make_shared<Fn>(std::move(fn)), sorted);
+		}
+
+		/**
+		 * \brief Make container available as table name on db
+		 */
+		template<typename Container>
+		void attach(database& db, const std::string& name, const Container& container) const {
+			using iterator = decltype(std::begin(container));
+			static_assert(std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<iterator>::iterator_category>::value,
+				"container must provide random access iterators");
+			static_assert(std::is_same<std::decay_t<decltype(*std::begin(container))>, T>::value, "container must hold T");
+			if(m_columns.empty()) throw std::logic_error("virtual table has no columns");
+			auto src = std::make_unique<detail::vtab_source>();
+			src->columns = m_columns;
+			src->container = &container;
+			src->size = [](const void* c) -> size_t {
+				auto& cont = *static_cast<const Container*>(c);
+				return static_cast<size_t>(std::distance(std::begin(cont), std::end(cont)));
+			};
+			src->at = [](const void* c, size_t idx) -> const void* {
+				auto& cont = *static_cast<const Container*>(c);
+				return &*(std::begin(cont) + idx);
+			};
+			detail::register_vtab(db, name, std::move(src));
+		}
+	};
+}
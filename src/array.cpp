@@ -0,0 +1,184 @@
+#include "sqlitepp/condition.h"
+
+#include "sqlite3.h"
+
+namespace sqlitepp {
+    namespace detail {
+        namespace {
+            /**
+             * Eponymous table valued function expanding a blob packed by col::in() into one row per value:
+             *   SELECT value FROM sqlitepp_array(?)
+             */
+            struct array_cursor : sqlite3_vtab_cursor {
+                std::vector<uint8_t> data;
+                size_t pos;
+                int64_t rowid;
+            };
+
+            size_t element_size(const std::vector<uint8_t>& data, size_t pos) noexcept {
+                if(pos >= data.size()) return 0;
+                size_t avail = data.size() - pos - 1;
+                switch(static_cast<orm::detail::array_tag>(data[pos])) {
+                case orm::detail::array_tag::null: return 1;
+                case orm::detail::array_tag::integer:
+                case orm::detail::array_tag::real: return avail >= 8 ? 9 : 0;
+                case orm::detail::array_tag::text:
+                case orm::detail::array_tag::blob: {
+                    uint32_t len;
+                    if(avail < sizeof(len)) return 0;
+                    memcpy(&len, data.data() + pos + 1, sizeof(len));
+                    return avail - sizeof(len) >= len ? 1 + sizeof(len) + len : 0;
+                }
+                default: return 0;
+                }
+            }
+
+            int array_connect(sqlite3* db, void*, int, const char* const*, sqlite3_vtab** vtab, char**) {
+                int res = sqlite3_declare_vtab(db, "CREATE TABLE x(value, data HIDDEN)");
+                if(res != SQLITE_OK) return res;
+#ifdef SQLITE_VTAB_INNOCUOUS
+                sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+#endif
+                *vtab = static_cast<sqlite3_vtab*>(sqlite3_malloc(sizeof(sqlite3_vtab)));
+                if(*vtab == nullptr) return SQLITE_NOMEM;
+                memset(*vtab, 0, sizeof(sqlite3_vtab));
+                return SQLITE_OK;
+            }
+
+            int array_disconnect(sqlite3_vtab* vtab) {
+                sqlite3_free(vtab);
+                return SQLITE_OK;
+            }
+
+            int array_best_index(sqlite3_vtab*, sqlite3_index_info* info) {
+                for(int i = 0; i < info->nConstraint; i++) {
+                    auto& c = info->aConstraint[i];
+                    if(c.iColumn != 1 || c.op != SQLITE_INDEX_CONSTRAINT_EQ) continue;
+                    if(!c.usable) return SQLITE_CONSTRAINT;
+                    info->aConstraintUsage[i].argvIndex = 1;
+                    info->aConstraintUsage[i].omit = 1;
+                    info->idxNum = 1;
+                    info->estimatedCost = 1;
+                    info->estimatedRows = 100;
+                    return SQLITE_OK;
+                }
+                // Without an argument the table is empty
+                info->idxNum = 0;
+                info->estimatedCost = 2147483647;
+                info->estimatedRows = 0;
+                return SQLITE_OK;
+            }
+
+            int array_open(sqlite3_vtab*, sqlite3_vtab_cursor** cursor) {
+                try {
+                    *cursor = new array_cursor{};
+                } catch(...) {
+                    return SQLITE_NOMEM;
+                }
+                return SQLITE_OK;
+            }
+
+            int array_close(sqlite3_vtab_cursor* cursor) {
+                delete static_cast<array_cursor*>(cursor);
+                return SQLITE_OK;
+            }
+
+            int array_filter(sqlite3_vtab_cursor* cur, int idx_num, const char*, int argc, sqlite3_value** argv) {
+                auto cursor = static_cast<array_cursor*>(cur);
+                cursor->data.clear();
+                cursor->pos = 0;
+                cursor->rowid = 1;
+                if(idx_num != 1 || argc != 1 || sqlite3_value_type(argv[0]) == SQLITE_NULL) return SQLITE_OK;
+                if(sqlite3_value_type(argv[0]) != SQLITE_BLOB) {
+                    cur->pVtab->zErrMsg = sqlite3_mprintf("sqlitepp_array expects a blob created by col::in()");
+                    return SQLITE_ERROR;
+                }
+                auto data = static_cast<const uint8_t*>(sqlite3_value_blob(argv[0]));
+                try {
+                    cursor->data.assign(data, data + sqlite3_value_bytes(argv[0]));
+                } catch(...) {
+                    return SQLITE_NOMEM;
+                }
+                // Validate once, so columns can be decoded without checks
+                for(size_t pos = 0; pos < cursor->data.size();) {
+                    auto size = element_size(cursor->data, pos);
+                    if(size == 0) {
+                        cur->pVtab->zErrMsg = sqlite3_mprintf("malformed sqlitepp_array blob");
+                        return SQLITE_ERROR;
+                    }
+                    pos += size;
+                }
+                return SQLITE_OK;
+            }
+
+            int array_next(sqlite3_vtab_cursor* cur) {
+                auto cursor = static_cast<array_cursor*>(cur);
+                cursor->pos += element_size(cursor->data, cursor->pos);
+                cursor->rowid++;
+                return SQLITE_OK;
+            }
+
+            int array_eof(sqlite3_vtab_cursor* cur) {
+                auto cursor = static_cast<array_cursor*>(cur);
+                return cursor->pos >= cursor->data.size();
+            }
+
+            int array_column(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int column) {
+                auto cursor = static_cast<array_cursor*>(cur);
+                if(column != 0) return SQLITE_OK;
+                auto ptr = cursor->data.data() + cursor->pos + 1;
+                switch(static_cast<orm::detail::array_tag>(cursor->data[cursor->pos])) {
+                case orm::detail::array_tag::integer: {
+                    int64_t i;
+                    memcpy(&i, ptr, sizeof(i));
+                    sqlite3_result_int64(ctx, i);
+                    break;
+                }
+                case orm::detail::array_tag::real: {
+                    double d;
+                    memcpy(&d, ptr, sizeof(d));
+                    sqlite3_result_double(ctx, d);
+                    break;
+                }
+                case orm::detail::array_tag::text:
+                case orm::detail::array_tag::blob: {
+                    uint32_t len;
+                    memcpy(&len, ptr, sizeof(len));
+                    if(cursor->data[cursor->pos] == static_cast<uint8_t>(orm::detail::array_tag::text))
+                        sqlite3_result_text(ctx, reinterpret_cast<const char*>(ptr + sizeof(len)), len, SQLITE_TRANSIENT);
+                    else sqlite3_result_blob(ctx, ptr + sizeof(len), len, SQLITE_TRANSIENT);
+                    break;
+                }
+                default: sqlite3_result_null(ctx); break;
+                }
+                return SQLITE_OK;
+            }
+
+            int array_rowid(sqlite3_vtab_cursor* cur, sqlite3_int64* rowid) {
+                *rowid = static_cast<array_cursor*>(cur)->rowid;
+                return SQLITE_OK;
+            }
+
+            sqlite3_module make_array_module() {
+                sqlite3_module m{};
+                // xCreate is null, making it an eponymous-only table
+                m.xConnect = array_connect;
+                m.xBestIndex = array_best_index;
+                m.xDisconnect = array_disconnect;
+                m.xOpen = array_open;
+                m.xClose = array_close;
+                m.xFilter = array_filter;
+                m.xNext = array_next;
+                m.xEof = array_eof;
+                m.xColumn = array_column;
+                m.xRowid = array_rowid;
+                return m;
+            }
+        }
+
+        int register_array_module(sqlite3* db) {
+            static const sqlite3_module module = make_array_module();
+            return sqlite3_create_module_v2(db, "sqlitepp_array", &module, nullptr, nullptr);
+        }
+    }
+}
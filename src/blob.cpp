@@ -0,0 +1,201 @@
+#include "sqlitepp/blob.h"
+#include "sqlitepp/database.h"
+#include "sqlitepp/error_code.h"
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+#include <system_error>
+
+namespace sqlitepp {
+	blob_stream::blob_stream(database& db, const std::string& table, const std::string& column, int64_t rowid, mode m, const std::string& schema)
+		: m_db(&db), m_handle(nullptr), m_size(0), m_pos(0)
+	{
+		int res = sqlite3_blob_open(db.raw(), schema.c_str(), table.c_str(), column.c_str(), rowid, m == mode::read_write ? 1 : 0, &m_handle);
+		if(res != SQLITE_OK) {
+			// A handle may be returned on error, it has to be closed as well
+			std::system_error err(make_error_code(static_cast<error_code>(res)), sqlite3_errmsg(db.raw()));
+			sqlite3_blob_close(m_handle);
+			m_handle = nullptr;
+			throw err;
+		}
+		m_size = sqlite3_blob_bytes(m_handle);
+	}
+
+	blob_stream::blob_stream(blob_stream&& other) noexcept
+		: m_db(other.m_db), m_handle(other.m_handle), m_size(other.m_size), m_pos(other.m_pos)
+	{
+		other.m_handle = nullptr;
+	}
+
+	blob_stream& blob_stream::operator=(blob_stream&& other) noexcept {
+		if(this == &other) return *this;
+		close();
+		m_db = other.m_db;
+		m_handle = other.m_handle;
+		m_size = other.m_size;
+		m_pos = other.m_pos;
+		other.m_handle = nullptr;
+		return *this;
+	}
+
+	blob_stream::~blob_stream() noexcept {
+		close();
+	}
+
+	void blob_stream::seek(int64_t pos) {
+		if(pos < 0 || pos > m_size) throw std::out_of_range("blob position out of range");
+		m_pos = pos;
+	}
+
+	size_t blob_stream::read(void* data, size_t size) {
+		auto n = static_cast<size_t>(std::min<int64_t>(static_cast<int64_t>(size), m_size - m_pos));
+		read_at(m_pos, data, n);
+		m_pos += n;
+		return n;
+	}
+
+	void blob_stream::read_at(int64_t offset, void* data, size_t size) const {
+		if(m_handle == nullptr) throw std::logic_error("blob_stream is closed");
+		if(offset < 0 || offset + static_cast<int64_t>(size) > m_size) throw std::out_of_range("read past the end of the blob");
+		auto ptr = static_cast<char*>(data);
+		// Blobs are limited to INT_MAX bytes, offsets always fit into an int
+		while(size != 0) {
+			int n = static_cast<int>(std::min<size_t>(size, INT_MAX));
+			int res = sqlite3_blob_read(m_handle, ptr, n, static_cast<int>(offset));
+			throw_if_error(res, m_db->raw());
+			ptr += n;
+			offset += n;
+			size -= n;
+		}
+	}
+
+	void blob_stream::write(const void* data, size_t size) {
+		write_at(m_pos, data, size);
+		m_pos += size;
+	}
+
+	void blob_stream::write_at(int64_t offset, const void* data, size_t size) {
+		if(m_handle == nullptr) throw std::logic_error("blob_stream is closed");
+		if(offset < 0 || offset + static_cast<int64_t>(size) > m_size) throw std::out_of_range("write past the end of the blob");
+		auto ptr = static_cast<const char*>(data);
+		while(size != 0) {
+			int n = static_cast<int>(std::min<size_t>(size, INT_MAX));
+			int res = sqlite3_blob_write(m_handle, ptr, n, static_cast<int>(offset));
+			throw_if_error(res, m_db->raw());
+			ptr += n;
+			offset += n;
+			size -= n;
+		}
+	}
+
+	void blob_stream::reopen(int64_t rowid) {
+		if(m_handle == nullptr) throw std::logic_error("blob_stream is closed");
+		int res = sqlite3_blob_reopen(m_handle, rowid);
+		throw_if_error(res, m_db->raw());
+		m_size = sqlite3_blob_bytes(m_handle);
+		m_pos = 0;
+	}
+
+	void blob_stream::close() noexcept {
+		if(m_handle) sqlite3_blob_close(m_handle);
+		m_handle = nullptr;
+	}
+
+	blob_streambuf::blob_streambuf(blob_stream stream, size_t chunk_size)
+		: m_stream(std::move(stream)), m_buffer(std::max<size_t>(chunk_size, 1)), m_offset(m_stream.tell())
+	{}
+
+	blob_streambuf::~blob_streambuf() {
+		try {
+			flush_put();
+		} catch(...) {
+			// Destructors must not throw, use sync() to detect write errors
+		}
+	}
+
+	int64_t blob_streambuf::position() const noexcept {
+		if(pbase() != nullptr) return m_offset + (pptr() - pbase());
+		if(eback() != nullptr) return m_offset + (gptr() - eback());
+		return m_offset;
+	}
+
+	void blob_streambuf::flush_put() {
+		if(pbase() == nullptr) return;
+		auto pos = position();
+		m_stream.write_at(m_offset, pbase(), static_cast<size_t>(pptr() - pbase()));
+		m_offset = pos;
+		setp(nullptr, nullptr);
+	}
+
+	blob_streambuf::int_type blob_streambuf::underflow() {
+		if(gptr() != nullptr && gptr() < egptr()) return traits_type::to_int_type(*gptr());
+		try {
+			flush_put();
+			m_offset = position();
+			auto n = static_cast<size_t>(std::min<int64_t>(static_cast<int64_t>(m_buffer.size()), m_stream.size() - m_offset));
+			if(n == 0) {
+				setg(nullptr, nullptr, nullptr);
+				return traits_type::eof();
+			}
+			m_stream.read_at(m_offset, m_buffer.data(), n);
+			setg(m_buffer.data(), m_buffer.data(), m_buffer.data() + n);
+		} catch(...) {
+			return traits_type::eof();
+		}
+		return traits_type::to_int_type(*gptr());
+	}
+
+	blob_streambuf::int_type blob_streambuf::overflow(int_type c) {
+		try {
+			auto pos = position();
+			flush_put();
+			setg(nullptr, nullptr, nullptr);
+			m_offset = pos;
+			// The put area never extends past the end of the blob
+			auto n = static_cast<size_t>(std::min<int64_t>(static_cast<int64_t>(m_buffer.size()), m_stream.size() - m_offset));
+			if(n == 0) return traits_type::eof();
+			setp(m_buffer.data(), m_buffer.data() + n);
+		} catch(...) {
+			return traits_type::eof();
+		}
+		if(traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+		return c;
+	}
+
+	int blob_streambuf::sync() {
+		try {
+			auto pos = position();
+			flush_put();
+			m_offset = pos;
+		} catch(...) {
+			return -1;
+		}
+		return 0;
+	}
+
+	blob_streambuf::pos_type blob_streambuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) {
+		int64_t base = dir == std::ios_base::beg ? 0 : (dir == std::ios_base::end ? m_stream.size() : position());
+		int64_t pos = base + off;
+		if(pos < 0 || pos > m_stream.size()) return pos_type(off_type(-1));
+		try {
+			flush_put();
+		} catch(...) {
+			return pos_type(off_type(-1));
+		}
+		setg(nullptr, nullptr, nullptr);
+		m_offset = pos;
+		return pos_type(pos);
+	}
+
+	blob_streambuf::pos_type blob_streambuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+		return seekoff(off_type(pos), std::ios_base::beg, which);
+	}
+
+	std::streamsize blob_streambuf::showmanyc() {
+		auto remaining = m_stream.size() - position();
+		return remaining > 0 ? static_cast<std::streamsize>(remaining) : -1;
+	}
+}
@@ -1,10 +1,75 @@
 #include "sqlitepp/database.h"
 #include "sqlitepp/error_code.h"
+#include "sqlitepp/function.h"
+#include "sqlitepp/orm_identity_map.h"
+#include "sqlitepp/statement.h"
 #include <cstdio>
+#include <cstring>
+#include <list>
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
 
 namespace sqlitepp {
+	namespace detail {
+		// Defined in array.cpp
+		int register_array_module(sqlite3* db);
+
+		struct statement_cache {
+			struct entry {
+				uint64_t hash;
+				sqlite3_stmt* handle;
+			};
+			std::mutex mtx {};
+			size_t capacity {};
+			uint64_t hits {};
+			uint64_t misses {};
+			// Idle statements, most recently used first
+			std::list<entry> idle {};
+			std::unordered_multimap<uint64_t, std::list<entry>::iterator> index {};
+
+			void evict(size_t size) noexcept {
+				while(idle.size() > size) {
+					auto& e = idle.back();
+					auto range = index.equal_range(e.hash);
+					for(auto it = range.first; it != range.second; ++it) {
+						if(it->second->handle == e.handle) {
+							index.erase(it);
+							break;
+						}
+					}
+					sqlite3_finalize(e.handle);
+					idle.pop_back();
+				}
+			}
+		};
+
+		void release_statement(statement_cache& cache, sqlite3_stmt* handle) noexcept {
+			sqlite3_reset(handle);
+			sqlite3_clear_bindings(handle);
+			std::unique_lock<std::mutex> lck(cache.mtx);
+			// Capacity is 0 once the cache was disabled or the database closed
+			if(cache.capacity == 0) {
+				sqlite3_finalize(handle);
+				return;
+			}
+			auto sql = sqlite3_sql(handle);
+			auto hash = shape_hash(sql ? sql : "");
+			cache.idle.push_front({ hash, handle });
+			cache.index.emplace(hash, cache.idle.begin());
+			cache.evict(cache.capacity);
+		}
+	}
+
+	struct database::busy_state {
+		busy_strategy strategy;
+		std::chrono::steady_clock::time_point first_retry;
+	};
+
     database::database(const std::string& filename)
-		: m_handle(nullptr)
+		: m_handle(nullptr), m_identity_map(), m_index_advisor(), m_update_hook(), m_wal_hook(), m_progress_handler(), m_progress_instructions(0), m_statement_cache(), m_busy()
 	{
         if(SQLITE_VERSION_NUMBER != libversion_number())
             throw std::logic_error("version missmatch between library and header files");
@@ -13,9 +78,19 @@ namespace sqlitepp {
 		throw_if_error(res, static_cast<sqlite3*>(nullptr));
 		res = sqlite3_extended_result_codes(m_handle, 1);
 		throw_if_error(res, m_handle);
+		res = detail::register_array_module(m_handle);
+		throw_if_error(res, m_handle);
 	}
 
 	database::~database() noexcept {
+		if(m_statement_cache) {
+			// Statements still alive finalize their handle on destruction, sqlite3_close_v2 waits for them
+			std::unique_lock<std::mutex> lck(m_statement_cache->mtx);
+			m_statement_cache->capacity = 0;
+			m_statement_cache->evict(0);
+		}
+		// With statements still alive the connection is closed later, which may roll back an open transaction
+		sqlite3_rollback_hook(m_handle, nullptr, nullptr);
 		sqlite3_close_v2(m_handle);
 	}
 
@@ -38,6 +113,39 @@ namespace sqlitepp {
         sqlite3_interrupt(m_handle);
     }
 
+	void database::busy_timeout(std::chrono::milliseconds timeout) {
+		int res = sqlite3_busy_timeout(m_handle, static_cast<int>(timeout.count()));
+		throw_if_error(res, m_handle);
+		m_busy.reset();
+	}
+
+	void database::set_busy_strategy(const busy_strategy& strategy) {
+		if(strategy.initial_delay.count() < 0 || strategy.max_delay < strategy.initial_delay || strategy.multiplier < 1.0
+			|| strategy.jitter < 0.0 || strategy.jitter > 1.0)
+			throw std::invalid_argument("invalid busy strategy");
+		auto state = std::make_unique<busy_state>();
+		state->strategy = strategy;
+		int res = sqlite3_busy_handler(m_handle, [](void* ud, int count) -> int {
+			auto state = static_cast<busy_state*>(ud);
+			auto& s = state->strategy;
+			auto now = std::chrono::steady_clock::now();
+			// count restarts at 0 for every lock sqlite waits for
+			if(count == 0) state->first_retry = now;
+			if(now - state->first_retry >= s.timeout) return 0;
+			double delay = static_cast<double>(s.initial_delay.count()) * std::pow(s.multiplier, std::min(count, 64));
+			delay = std::min(delay, static_cast<double>(s.max_delay.count()));
+			thread_local std::minstd_rand rng{ std::random_device{}() };
+			delay *= 1.0 - s.jitter * std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+			auto wait = std::chrono::duration<double, std::milli>(delay);
+			auto remaining = s.timeout - (now - state->first_retry);
+			std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+				std::chrono::duration_cast<std::chrono::steady_clock::duration>(wait), remaining));
+			return 1;
+		}, state.get());
+		throw_if_error(res, m_handle);
+		m_busy = std::move(state);
+	}
+
     int64_t database::last_insert_rowid() const noexcept {
         return sqlite3_last_insert_rowid(m_handle);
     }
@@ -48,6 +156,158 @@ namespace sqlitepp {
 
 	sqlite3* database::raw() const noexcept { return m_handle; }
 
+	static_assert(static_cast<int>(update_operation::insert) == SQLITE_INSERT, "update_operation::insert does not match SQLITE_INSERT");
+	static_assert(static_cast<int>(update_operation::remove) == SQLITE_DELETE, "update_operation::remove does not match SQLITE_DELETE");
+	static_assert(static_cast<int>(update_operation::update) == SQLITE_UPDATE, "update_operation::update does not match SQLITE_UPDATE");
+
+	void database::install_update_hook() {
+		if(!m_identity_map && !m_update_hook) {
+			sqlite3_update_hook(m_handle, nullptr, nullptr);
+			return;
+		}
+		sqlite3_update_hook(m_handle, [](void* ud, int op, const char* db, const char* table, sqlite3_int64 rowid) {
+			auto that = static_cast<database*>(ud);
+			if(that->m_identity_map) that->m_identity_map->on_update(op, table, rowid);
+			if(that->m_update_hook) that->m_update_hook(static_cast<update_operation>(op), db, table, rowid);
+		}, this);
+	}
+
+	void database::set_update_hook(update_hook_fn_t fn) {
+		m_update_hook = std::move(fn);
+		install_update_hook();
+	}
+
+	void database::set_wal_hook(wal_hook_fn_t fn) {
+		m_wal_hook = std::move(fn);
+		if(!m_wal_hook) {
+			sqlite3_wal_hook(m_handle, nullptr, nullptr);
+			return;
+		}
+		sqlite3_wal_hook(m_handle, [](void* ud, sqlite3*, const char* db, int frames) -> int {
+			// The commit already happened, errors can not be reported
+			try {
+				static_cast<database*>(ud)->m_wal_hook(db, frames);
+			} catch(...) {}
+			return SQLITE_OK;
+		}, this);
+	}
+
+	void database::set_progress_handler(int instructions, progress_handler_fn_t fn) {
+		if(fn && instructions <= 0) throw std::invalid_argument("instructions must be positive");
+		m_progress_handler = std::move(fn);
+		m_progress_instructions = m_progress_handler ? instructions : 0;
+		install_progress_handler();
+	}
+
+	void database::install_progress_handler() noexcept {
+		if(!m_progress_handler) {
+			sqlite3_progress_handler(m_handle, 0, nullptr, nullptr);
+			return;
+		}
+		sqlite3_progress_handler(m_handle, m_progress_instructions, [](void* ud) -> int {
+			return static_cast<database*>(ud)->call_progress_handler() ? 1 : 0;
+		}, this);
+	}
+
+	bool database::call_progress_handler() noexcept {
+		if(!m_progress_handler) return false;
+		// Exceptions can not pass through sqlite, interrupt the statement instead
+		try {
+			return m_progress_handler();
+		} catch(...) {
+			return true;
+		}
+	}
+
+	void database::set_identity_map(std::shared_ptr<orm::identity_map> map) {
+		m_identity_map = std::move(map);
+		install_update_hook();
+		if(!m_identity_map) {
+			sqlite3_rollback_hook(m_handle, nullptr, nullptr);
+			return;
+		}
+		// Cached entities may hold values written by the rolled back transaction
+		sqlite3_rollback_hook(m_handle, [](void* ud) {
+			static_cast<database*>(ud)->m_identity_map->clear();
+		}, this);
+	}
+
+	orm::identity_map* database::get_identity_map() const noexcept { return m_identity_map.get(); }
+
+	void database::set_index_advisor(std::shared_ptr<orm::index_advisor> advisor) {
+		m_index_advisor = std::move(advisor);
+	}
+
+	orm::index_advisor* database::get_index_advisor() const noexcept { return m_index_advisor.get(); }
+
+	static_assert(static_cast<int>(function_flags::deterministic) == SQLITE_DETERMINISTIC, "function_flags::deterministic does not match SQLITE_DETERMINISTIC");
+
+	void detail::register_function(database& db, const std::string& name, int args, function_flags flags, void* user,
+		void(*fn)(sqlite3_context*, int, sqlite3_value**), void(*step)(sqlite3_context*, int, sqlite3_value**),
+		void(*final)(sqlite3_context*), void(*destroy)(void*))
+	{
+		// destroy is called by sqlite if registering fails
+		int res = sqlite3_create_function_v2(db.raw(), name.c_str(), args, SQLITE_UTF8 | static_cast<int>(flags), user, fn, step, final, destroy);
+		throw_if_error(res, db.raw());
+	}
+
+	void detail::register_window_function(database& db, const std::string& name, int args, function_flags flags,
+		void(*step)(sqlite3_context*, int, sqlite3_value**), void(*final)(sqlite3_context*),
+		void(*value)(sqlite3_context*), void(*inverse)(sqlite3_context*, int, sqlite3_value**))
+	{
+		int res = sqlite3_create_window_function(db.raw(), name.c_str(), args, SQLITE_UTF8 | static_cast<int>(flags), nullptr, step, final, value, inverse, nullptr);
+		throw_if_error(res, db.raw());
+	}
+
+	void database::set_statement_cache_size(size_t size) {
+		if(!m_statement_cache) {
+			if(size == 0) return;
+			m_statement_cache = std::make_shared<detail::statement_cache>();
+		}
+		std::unique_lock<std::mutex> lck(m_statement_cache->mtx);
+		m_statement_cache->capacity = size;
+		m_statement_cache->evict(size);
+	}
+
+	statement_cache_stats database::get_statement_cache_stats() const {
+		if(!m_statement_cache) return { 0, 0, 0 };
+		std::unique_lock<std::mutex> lck(m_statement_cache->mtx);
+		return { m_statement_cache->hits, m_statement_cache->misses, m_statement_cache->idle.size() };
+	}
+
+	sqlite3_stmt* database::acquire_statement(const std::string& query, std::shared_ptr<detail::statement_cache>& cache) {
+		sqlite3_stmt* handle = nullptr;
+		cache.reset();
+		if(!m_statement_cache || m_statement_cache->capacity == 0) {
+			int res = sqlite3_prepare_v2(m_handle, query.data(), query.size(), &handle, nullptr);
+			throw_if_error(res, m_handle);
+			return handle;
+		}
+		auto canonical = canonical_sql(query);
+		auto hash = shape_hash(canonical);
+		{
+			auto& c = *m_statement_cache;
+			std::unique_lock<std::mutex> lck(c.mtx);
+			auto range = c.index.equal_range(hash);
+			for(auto it = range.first; it != range.second; ++it) {
+				// Guard against hash collisions
+				if(strcmp(sqlite3_sql(it->second->handle), canonical.c_str()) != 0) continue;
+				handle = it->second->handle;
+				c.idle.erase(it->second);
+				c.index.erase(it);
+				c.hits++;
+				cache = m_statement_cache;
+				return handle;
+			}
+			c.misses++;
+		}
+		int res = sqlite3_prepare_v3(m_handle, canonical.data(), canonical.size(), SQLITE_PREPARE_PERSISTENT, &handle, nullptr);
+		throw_if_error(res, m_handle);
+		// Empty statements (e.g. only a comment) have no handle and can not be reused
+		if(handle != nullptr) cache = m_statement_cache;
+		return handle;
+	}
+
 	bool is_threadsafe() noexcept {
         return sqlite3_threadsafe() != 0;
     }
@@ -5,7 +5,11 @@ namespace sqlitepp {
     {
         const char* name() const noexcept override { return "sqlite"; }
         std::string message(int ev) const override {
-            return sqlite3_errstr(ev);
+            switch(static_cast<error_code>(ev)) {
+            case error_code::timeout: return "statement deadline exceeded";
+            case error_code::cancelled: return "statement cancelled";
+            default: return sqlite3_errstr(ev);
+            }
         }
     };
     
@@ -0,0 +1,167 @@
+#include "sqlitepp/maintenance.h"
+#include "sqlitepp/database.h"
+#include "sqlitepp/error_code.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+namespace sqlitepp {
+	struct maintenance::state {
+		maintenance_options options;
+		std::mutex mtx {};
+		std::condition_variable cv {};
+		bool stop { false };
+		bool wake { false };
+		// Size of the WAL as reported by the last commit (or left by the last checkpoint)
+		int64_t frames { 0 };
+		// A commit happened since the last quiet period
+		bool dirty { false };
+		std::chrono::steady_clock::time_point last_commit {};
+		// Only used by the background thread
+		bool optimized { false };
+		std::chrono::steady_clock::time_point last_optimize {};
+		maintenance_stats stats {};
+	};
+
+	maintenance::maintenance(const std::string& filename, maintenance_options options)
+		: m_state(std::make_shared<state>()), m_db(std::make_unique<database>(filename)), m_thread()
+	{
+		if(options.passive_frames <= 0 || options.restart_frames < options.passive_frames || options.truncate_frames < options.restart_frames)
+			throw std::invalid_argument("checkpoint thresholds must be positive and ascending");
+		m_state->options = options;
+		m_db->busy_timeout(options.busy_timeout);
+		m_thread = std::thread([this]() { run(); });
+	}
+
+	maintenance::~maintenance() noexcept {
+		{
+			std::unique_lock<std::mutex> lck(m_state->mtx);
+			m_state->stop = true;
+		}
+		m_state->cv.notify_all();
+		if(m_thread.joinable()) m_thread.join();
+	}
+
+	void maintenance::attach(database& db) {
+		std::weak_ptr<state> weak = m_state;
+		db.set_wal_hook([weak](const char* schema, int frames) {
+			auto s = weak.lock();
+			if(!s || std::strcmp(schema, "main") != 0) return;
+			bool wake;
+			{
+				std::unique_lock<std::mutex> lck(s->mtx);
+				s->frames = frames;
+				s->dirty = true;
+				s->last_commit = std::chrono::steady_clock::now();
+				wake = frames >= s->options.passive_frames;
+				s->wake = s->wake || wake;
+			}
+			if(wake) s->cv.notify_one();
+		});
+	}
+
+	void maintenance::trigger() {
+		{
+			std::unique_lock<std::mutex> lck(m_state->mtx);
+			m_state->wake = true;
+		}
+		m_state->cv.notify_one();
+	}
+
+	maintenance_stats maintenance::stats() const {
+		std::unique_lock<std::mutex> lck(m_state->mtx);
+		return m_state->stats;
+	}
+
+	template<typename Fn>
+	void maintenance::guarded(Fn&& fn) noexcept {
+		try {
+			fn();
+		} catch(const std::system_error& e) {
+			std::unique_lock<std::mutex> lck(m_state->mtx);
+			auto primary = e.code().value() & 0xff;
+			if(e.code().category() == sqlite_error_category() && (primary == SQLITE_BUSY || primary == SQLITE_LOCKED))
+				m_state->stats.busy++;
+			else
+				m_state->stats.errors++;
+		} catch(...) {
+			std::unique_lock<std::mutex> lck(m_state->mtx);
+			m_state->stats.errors++;
+		}
+	}
+
+	void maintenance::run() noexcept {
+		auto& s = *m_state;
+		std::unique_lock<std::mutex> lck(s.mtx);
+		while(!s.stop) {
+			s.cv.wait_for(lck, s.options.interval, [&s]() { return s.stop || s.wake; });
+			if(s.stop) break;
+			s.wake = false;
+			auto frames = s.frames;
+			auto last_commit = s.last_commit;
+			bool idle = s.dirty && std::chrono::steady_clock::now() - last_commit >= s.options.idle_time;
+			lck.unlock();
+
+			// Idle tasks write to the WAL as well, run them first so the checkpoint includes their changes
+			if(idle) guarded([this]() { run_idle_tasks(); });
+			guarded([this, frames, idle]() { run_checkpoint(frames, idle); });
+
+			lck.lock();
+			// Commits while the tasks ran start a new quiet period
+			if(idle && s.last_commit == last_commit) s.dirty = false;
+		}
+	}
+
+	void maintenance::run_checkpoint(int64_t frames, bool idle) {
+		auto& s = *m_state;
+		int mode = SQLITE_CHECKPOINT_PASSIVE;
+		if(idle || frames >= s.options.truncate_frames) mode = SQLITE_CHECKPOINT_TRUNCATE;
+		else if(frames >= s.options.restart_frames) mode = SQLITE_CHECKPOINT_RESTART;
+		else if(frames < s.options.passive_frames) return;
+
+		// A passive checkpoint copies as much as possible without blocking writers or waiting for readers
+		int log = 0, ckpt = 0;
+		int res = sqlite3_wal_checkpoint_v2(m_db->raw(), nullptr, SQLITE_CHECKPOINT_PASSIVE, &log, &ckpt);
+		throw_if_error(res, m_db->raw());
+		{
+			std::unique_lock<std::mutex> lck(s.mtx);
+			s.stats.passive++;
+			s.stats.wal_frames = log < 0 ? -1 : log - ckpt;
+			if(s.frames == frames) s.frames = log - ckpt;
+		}
+		if(mode == SQLITE_CHECKPOINT_PASSIVE || log <= 0) return;
+
+		// Waits up to busy_timeout for readers, so the next writer starts at the beginning of the WAL
+		res = sqlite3_wal_checkpoint_v2(m_db->raw(), nullptr, mode, &log, &ckpt);
+		throw_if_error(res, m_db->raw());
+		std::unique_lock<std::mutex> lck(s.mtx);
+		if(mode == SQLITE_CHECKPOINT_TRUNCATE) s.stats.truncate++;
+		else s.stats.restart++;
+		s.stats.wal_frames = log - ckpt;
+		if(s.frames == frames) s.frames = 0;
+	}
+
+	void maintenance::run_idle_tasks() {
+		auto& s = *m_state;
+		auto now = std::chrono::steady_clock::now();
+		if(s.options.optimize_interval.count() > 0 && (!s.optimized || now - s.last_optimize >= s.options.optimize_interval)) {
+			// Without 0x10000 only tables queried by this connection are checked, which are none.
+			// Older versions ignore that flag, analyze every table with the same row limit optimize uses instead.
+			if(sqlite3_libversion_number() >= 3046000)
+				m_db->exec("PRAGMA optimize=0x10002;");
+			else
+				m_db->exec("PRAGMA analysis_limit=400; ANALYZE;");
+			s.optimized = true;
+			s.last_optimize = now;
+			std::unique_lock<std::mutex> lck(s.mtx);
+			s.stats.optimize++;
+		}
+		if(s.options.vacuum_pages > 0) {
+			m_db->exec("PRAGMA incremental_vacuum(" + std::to_string(s.options.vacuum_pages) + ");");
+			std::unique_lock<std::mutex> lck(s.mtx);
+			s.stats.vacuum++;
+		}
+	}
+}
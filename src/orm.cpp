@@ -1,11 +1,16 @@
 #include "sqlitepp/orm.h"
+#include "sqlitepp/orm_advisor.h"
+
+#include <algorithm>
+#include <unordered_map>
 
 namespace sqlitepp {
     namespace orm {
 
         static void bind_db_val(statement& s, size_t i, const db_value& val) {
+            // Bind NULL explicitly, statements may be reused with different values
             if(std::holds_alternative<db_null_type>(val))
-                return;
+                return s.bind(i, nullptr);
             if(std::holds_alternative<db_blob_type>(val))
                 return s.bind(i, std::get<db_blob_type>(val));
             if(std::holds_alternative<db_text_type>(val))
@@ -17,59 +22,265 @@ namespace sqlitepp {
             throw std::logic_error("unreachable");
         }
 
-        void entity::from_result(const sqlitepp::result_iterator& it) {
+        static std::string table_name(const class_info& info) {
+            std::string res;
+            if(!info.schema.empty()) res += "`" + info.schema + "`.";
+            res += "`" + info.table + "`";
+            return res;
+        }
+
+        static void observe(database& db, const class_info& info, const std::string& where, const std::vector<db_value>& params) {
+            if(auto advisor = db.get_index_advisor()) advisor->record(info, where, params);
+        }
+
+        // Condition selecting the row of a single entity, see entity::bind_key()
+        static std::string key_condition(const class_info& info) {
+            if(!info.without_rowid) return "_rowid_ = ?";
+            std::string res;
+            for(auto& f : info.fields) {
+                if(!f.primary_key) continue;
+                if(!res.empty()) res += " AND ";
+                res += "`" + f.name + "` = ?";
+            }
+            if(res.empty()) throw std::logic_error("WITHOUT ROWID table " + info.table + " has no primary key");
+            return res;
+        }
+
+        static size_t value_size(const db_value& val) noexcept {
+            if(std::holds_alternative<db_text_type>(val))
+                return std::get<db_text_type>(val).size();
+            if(std::holds_alternative<db_blob_type>(val))
+                return std::get<db_blob_type>(val).size();
+            return sizeof(db_integer_type);
+        }
+
+        uint64_t hash_value(const db_value& val) noexcept {
+            // FNV-1a, seeded with the type index so 0 and "" differ
+            uint64_t hash = 0xcbf29ce484222325ull ^ val.index();
+            auto update = [&hash](const void* data, size_t size) {
+                auto ptr = static_cast<const uint8_t*>(data);
+                for(size_t i = 0; i < size; i++) {
+                    hash ^= ptr[i];
+                    hash *= 0x100000001b3ull;
+                }
+            };
+            if(std::holds_alternative<db_text_type>(val)) {
+                auto& v = std::get<db_text_type>(val);
+                update(v.data(), v.size());
+            } else if(std::holds_alternative<db_blob_type>(val)) {
+                auto& v = std::get<db_blob_type>(val);
+                update(v.data(), v.size());
+            } else if(std::holds_alternative<db_integer_type>(val)) {
+                update(&std::get<db_integer_type>(val), sizeof(db_integer_type));
+            } else if(std::holds_alternative<db_real_type>(val)) {
+                update(&std::get<db_real_type>(val), sizeof(db_real_type));
+            }
+            return hash;
+        }
+
+        static db_value read_db_val(const sqlitepp::result_iterator& it, size_t idx, const field_info& field) {
+            db_value val{db_null_type{}};
+            if(it.column_is_null(idx)) {
+                if(field.nullable) return val;
+                // Non nullable members can not hold NULL, read it the way sqlite converts it
+                switch(field.type) {
+                case db_type::blob: val = db_blob_type{}; break;
+                case db_type::text: val = db_text_type{}; break;
+                case db_type::real: val = db_real_type{}; break;
+                case db_type::integer: val = db_integer_type{}; break;
+                }
+                return val;
+            }
+            switch(field.type) {
+            case db_type::blob: {
+                auto data = it.column_blob(idx);
+                val.emplace<db_blob_type>(data.second);
+                std::copy(static_cast<const uint8_t*>(data.first),
+                    static_cast<const uint8_t*>(data.first) + data.second,
+                    std::get<db_blob_type>(val).data());
+                break;
+            }
+            case db_type::text: val = it.column_string(idx); break;
+            case db_type::real: val = it.column_double(idx); break;
+            case db_type::integer: val = it.column_int64(idx); break;
+            }
+            return val;
+        }
+
+        void entity::from_result(const sqlitepp::result_iterator& it, const std::vector<size_t>& columns) {
             auto& info = this->get_class_info();
-            this->_rowid_ = it.column_int64("_rowid_");
-            this->m_db_vals.resize(info.fields.size());
-            for(size_t i=0; i<info.fields.size(); i++) {
-                auto& e = info.fields[i];
-                db_value val{db_null_type{}};
-                switch(e.type) {
-                case db_type::blob: {
-                    auto data = it.column_blob(e.name);
-                    val.emplace<db_blob_type>(data.second);
-                    std::copy(static_cast<const uint8_t*>(data.first),
-                        static_cast<const uint8_t*>(data.first) + data.second,
-                        std::get<db_blob_type>(val).data());
-                    break;
-                }
-                case db_type::text: val = it.column_string(e.name); break;
-                case db_type::real: val = it.column_double(e.name); break;
-                case db_type::integer: val = it.column_int64(e.name); break;
+            this->_rowid_ = it.column_int64(0);
+            this->snapshot_clear();
+            // Every field not part of the result stays pending until it is loaded
+            this->m_pending.assign(info.fields.size(), true);
+            for(size_t i = 0; i < columns.size(); i++) {
+                auto& e = info.fields[columns[i]];
+                auto val = read_db_val(it, i + 1, e);
+                e.setter(this, val);
+                this->snapshot_field(columns[i], std::move(val));
+                this->m_pending[columns[i]] = false;
+            }
+            for(size_t i = 0; i < info.fields.size(); i++) {
+                // _rowid_ is always read, so a projection never leaves the rowid alias pending
+                if(this->m_pending[i] && info.fields[i].row_id && !info.without_rowid) {
+                    info.fields[i].setter(this, this->_rowid_);
+                    this->m_pending[i] = false;
                 }
+                if(this->m_pending[i] || info.fields[i].row_id) this->snapshot_field(i, info.fields[i].getter(this));
+            }
+            this->store_key();
+        }
+
+        void entity::store_key() {
+            auto& info = this->get_class_info();
+            this->m_key.clear();
+            if(!info.without_rowid) return;
+            for(auto& f : info.fields) {
+                if(f.primary_key) this->m_key.push_back(f.getter(this));
+            }
+        }
+
+        void entity::bind_key(statement& stmt, size_t idx) const {
+            if(!this->get_class_info().without_rowid) return stmt.bind(idx, this->_rowid_);
+            for(auto& v : this->m_key) bind_db_val(stmt, idx++, v);
+        }
+
+        void entity::snapshot_clear() {
+            auto& info = this->get_class_info();
+            switch(info.snapshot) {
+            case snapshot_policy::full:
+                m_db_vals.assign(info.fields.size(), db_value{db_null_type{}});
+                m_db_hashes.clear();
+                break;
+            case snapshot_policy::hash:
+                m_db_vals.assign(info.fields.size(), db_value{db_null_type{}});
+                m_db_hashes.assign(info.fields.size(), 0);
+                break;
+            case snapshot_policy::none:
+                m_db_vals.clear();
+                m_db_hashes.clear();
+                break;
+            }
+        }
+
+        void entity::snapshot_field(size_t idx, db_value val) {
+            auto& info = this->get_class_info();
+            switch(info.snapshot) {
+            case snapshot_policy::full:
+                m_db_vals[idx] = std::move(val);
+                break;
+            case snapshot_policy::hash:
+                m_db_hashes[idx] = hash_value(val);
+                if(value_size(val) <= info.snapshot_inline_limit) m_db_vals[idx] = std::move(val);
+                else m_db_vals[idx] = db_null_type{};
+                break;
+            case snapshot_policy::none: break;
+            }
+        }
+
+        bool entity::is_field_modified(size_t idx, const db_value& current) const {
+            auto& info = this->get_class_info();
+            if(m_db_vals.size() != info.fields.size()) return true;
+            switch(info.snapshot) {
+            case snapshot_policy::full: return current != m_db_vals[idx];
+            case snapshot_policy::hash: return hash_value(current) != m_db_hashes[idx];
+            case snapshot_policy::none: return true;
+            }
+            return true;
+        }
+
+        void entity::load_fields(const std::vector<size_t>& fields) {
+            if(this->_rowid_ < 0 || fields.empty()) return;
+            auto& info = this->get_class_info();
+            std::string query = "SELECT ";
+            for(size_t i = 0; i < fields.size(); i++) {
+                if(i != 0) query += ", ";
+                query += "`" + info.fields[fields[i]].name + "`";
+            }
+            query += " FROM " + table_name(info) + " WHERE " + key_condition(info) + ";";
+
+            statement stmt(this->m_db, query);
+            this->bind_key(stmt, 1);
+            auto it = stmt.iterator();
+            if(!it.next()) throw std::runtime_error("entity does not exist in the database");
+            if(m_db_vals.size() != info.fields.size()) this->snapshot_clear();
+            for(size_t i = 0; i < fields.size(); i++) {
+                auto& e = info.fields[fields[i]];
+                auto val = read_db_val(it, i, e);
                 e.setter(this, val);
-                this->m_db_vals[i] = val;
+                this->snapshot_field(fields[i], std::move(val));
+                if(fields[i] < m_pending.size()) m_pending[fields[i]] = false;
+            }
+        }
+
+        void entity::load() {
+            std::vector<size_t> fields;
+            for(size_t i = 0; i < m_pending.size(); i++) {
+                if(m_pending[i]) fields.push_back(i);
             }
+            this->load_fields(fields);
+        }
+
+        void entity::load(const std::string& field) {
+            auto& info = this->get_class_info();
+            for(size_t i = 0; i < info.fields.size(); i++) {
+                if(info.fields[i].name != field) continue;
+                if(i < m_pending.size() && m_pending[i]) this->load_fields({i});
+                return;
+            }
+            throw std::invalid_argument("unknown field " + field);
+        }
+
+        bool entity::is_loaded(const std::string& field) const {
+            auto& info = this->get_class_info();
+            for(size_t i = 0; i < info.fields.size(); i++) {
+                if(info.fields[i].name == field) return i >= m_pending.size() || !m_pending[i];
+            }
+            throw std::invalid_argument("unknown field " + field);
         }
 
         bool entity::is_modified() const {
             auto& info = this->get_class_info();
-            if(m_db_vals.size() != info.fields.size()) return true;
-            for(size_t i = 0; i < m_db_vals.size(); i++) {
-                auto dbval = info.fields[i].getter(this);
-                if(dbval != m_db_vals[i]) return true;
+            for(size_t i = 0; i < info.fields.size(); i++) {
+                if(is_field_modified(i, info.fields[i].getter(this))) return true;
             }
             return false;
         }
 
         void entity::reset() {
             auto& info = this->get_class_info();
-            for(size_t i = 0; i < std::min(m_db_vals.size(), info.fields.size()); i++) {
+            if(m_db_vals.size() != info.fields.size()) {
+                // Nothing to restore from memory, the database is the only source of truth left
+                if(info.snapshot == snapshot_policy::none) this->refresh();
+                return;
+            }
+            std::vector<size_t> missing;
+            for(size_t i = 0; i < info.fields.size(); i++) {
+                if(info.snapshot == snapshot_policy::hash && hash_value(m_db_vals[i]) != m_db_hashes[i]) {
+                    missing.push_back(i);
+                    continue;
+                }
                 info.fields[i].setter(this, m_db_vals[i]);
             }
+            this->load_fields(missing);
+        }
+
+        void entity::refresh() {
+            auto& info = this->get_class_info();
+            std::vector<size_t> fields(info.fields.size());
+            for(size_t i = 0; i < fields.size(); i++) fields[i] = i;
+            this->load_fields(fields);
         }
 
         void entity::remove() {
             if(this->_rowid_ < 0) return;
             auto& info = this->get_class_info();
-            std::string query = "DELETE FROM ";
-            if(!info.schema.empty()) query += "`" + info.schema + "`";
-            query += "`" + info.table + "` WHERE _rowid_ = ?;";
-
-            statement stmt(this->m_db, query);
-            stmt.bind(1, this->_rowid_);
+            statement stmt(this->m_db, "DELETE FROM " + table_name(info) + " WHERE " + key_condition(info) + ";");
+            this->bind_key(stmt, 1);
+            identity_map::write_guard guard(this->m_db.get_identity_map(), this);
             stmt.execute();
             this->_rowid_ = -1;
+            this->m_key.clear();
             for(auto& f : info.fields) {
                 if(f.row_id) f.setter(this, this->_rowid_);
             }
@@ -77,9 +288,7 @@ namespace sqlitepp {
 
         void entity::insert() {
             auto& info = this->get_class_info();
-            std::string query = "INSERT INTO ";
-            if(!info.schema.empty()) query += "`" + info.schema + "`";
-            query += "`" + info.table + "` (";
+            std::string query = "INSERT INTO " + table_name(info) + " (";
             for(size_t i = 0; i < info.fields.size(); i++) {
                 if(i != 0) query += ", ";
                 query += "`" + info.fields[i].name + "`";
@@ -91,47 +300,61 @@ namespace sqlitepp {
             }
             query += ");";
             statement stmt(this->m_db, query);
-            std::vector<db_value> vals = this->m_db_vals;
-            vals.resize(info.fields.size());
+            std::vector<db_value> vals(info.fields.size(), db_value{db_null_type{}});
             for(size_t i = 0; i < info.fields.size(); i++) {
                 if(info.fields[i].row_id) continue;
-                auto val = info.fields[i].getter(this);
-                bind_db_val(stmt, i + 1, val);
-                vals[i] = val;
+                vals[i] = info.fields[i].getter(this);
+                bind_db_val(stmt, i + 1, vals[i]);
             }
+            identity_map::write_guard guard(this->m_db.get_identity_map(), this);
             stmt.execute();
-            this->_rowid_ = this->m_db.last_insert_rowid();
+            this->_rowid_ = info.without_rowid ? 0 : this->m_db.last_insert_rowid();
+            this->snapshot_clear();
+            this->m_pending.clear();
             for(size_t i = 0; i < info.fields.size(); i++) {
                 auto& f = info.fields[i];
-                if(!f.row_id) continue;
-                f.setter(this, this->_rowid_);
-                vals[i] = this->_rowid_;
+                if(f.row_id) {
+                    f.setter(this, this->_rowid_);
+                    vals[i] = this->_rowid_;
+                }
+                this->snapshot_field(i, std::move(vals[i]));
             }
-            this->m_db_vals = std::move(vals);
+            this->store_key();
         }
 
-        // TODO: Only update changed columns
         void entity::update() {
             auto& info = this->get_class_info();
-            std::string query = "UPDATE ";
-            if(!info.schema.empty()) query += "`" + info.schema + "`";
-            query += "`" + info.table + "` SET ";
+            std::vector<size_t> dirty;
+            std::vector<db_value> vals;
             for(size_t i = 0; i < info.fields.size(); i++) {
+                // Without a snapshot we can not tell if a pending field was changed, so never overwrite it
+                bool pending = i < m_pending.size() && m_pending[i];
+                if(pending && info.snapshot == snapshot_policy::none) continue;
+                auto val = info.fields[i].getter(this);
+                if(!is_field_modified(i, val)) continue;
+                dirty.push_back(i);
+                vals.push_back(std::move(val));
+            }
+            if(dirty.empty()) return;
+
+            std::string query = "UPDATE " + table_name(info) + " SET ";
+            for(size_t i = 0; i < dirty.size(); i++) {
                 if(i != 0) query += ", ";
-                query += "`" + info.fields[i].name + "` = ?";
+                query += "`" + info.fields[dirty[i]].name + "` = ?";
             }
-            query += " WHERE _rowid_ = ?;";
+            query += " WHERE " + key_condition(info) + ";";
             statement stmt(this->m_db, query);
-            std::vector<db_value> vals = this->m_db_vals;
-            vals.resize(info.fields.size());
-            for(size_t i = 0; i < info.fields.size(); i++) {
-                auto val = info.fields[i].getter(this);
-                bind_db_val(stmt, i + 1, val);
-                vals[i] = val;
+            for(size_t i = 0; i < dirty.size(); i++) {
+                bind_db_val(stmt, i + 1, vals[i]);
             }
-            this->m_db_vals = std::move(vals);
-            stmt.bind(info.fields.size() + 1, this->_rowid_);
+            this->bind_key(stmt, dirty.size() + 1);
+            identity_map::write_guard guard(this->m_db.get_identity_map(), this);
             stmt.execute();
+            for(size_t i = 0; i < dirty.size(); i++) {
+                this->snapshot_field(dirty[i], std::move(vals[i]));
+                if(dirty[i] < m_pending.size()) m_pending[dirty[i]] = false;
+            }
+            this->store_key();
         }
 
         void entity::save() {
@@ -139,6 +362,10 @@ namespace sqlitepp {
             else this->insert();
         }
 
+        void entity::upsert() {
+            orm::upsert(this->m_db, this->get_class_info(), { this });
+        }
+
         std::function<void(class_info&, field_info&)> primary_key(bool v) {
             return [v](class_info&, field_info& f){
                 f.primary_key = v;
@@ -150,6 +377,11 @@ namespace sqlitepp {
                 f.row_id = v;
             };
         }
+        std::function<void(class_info&, field_info&)> lazy(bool v) {
+            return [v](class_info&, field_info& f){
+                f.lazy = v;
+            };
+        }
         std::function<void(class_info&, field_info&)> nullable(bool v) {
             return [v](class_info&, field_info& f){
                 f.nullable = v;
@@ -183,6 +415,26 @@ namespace sqlitepp {
                 c.is_temporary = v;
             };
         }
+        std::function<void(class_info&)> snapshot(snapshot_policy policy, size_t inline_limit) {
+            return [policy, inline_limit](class_info& c){
+                c.snapshot = policy;
+                c.snapshot_inline_limit = inline_limit;
+            };
+        }
+
+        std::function<void(class_info&)> index(std::string name, std::vector<std::string> columns, std::string where, bool unique) {
+            return [name, columns, where, unique](class_info& c){
+                c.indexes.push_back(index_info{ name, columns, where, unique });
+            };
+        }
+        std::function<void(class_info&)> unique_index(std::string name, std::vector<std::string> columns, std::string where) {
+            return index(std::move(name), std::move(columns), std::move(where), true);
+        }
+        std::function<void(class_info&)> without_rowid(bool v) {
+            return [v](class_info& c){
+                c.without_rowid = v;
+            };
+        }
 
         std::string generate_create_table(const class_info& info) {
             std::string res;
@@ -246,31 +498,82 @@ namespace sqlitepp {
                 case fk_action::cascade: res += "ON UPDATE CASCADE"; break;
                 }
             }
-            res += "\n);";
+            res += "\n)";
+            if(info.without_rowid) {
+                if(pk_fields.empty()) throw std::logic_error("WITHOUT ROWID table " + info.table + " has no primary key");
+                for(auto& e : info.fields) {
+                    if(e.row_id) throw std::logic_error("WITHOUT ROWID table " + info.table + " can not have a row_id field");
+                }
+                res += " WITHOUT ROWID";
+            }
+            res += ";";
+            return res;
+        }
+
+        std::string generate_create_indexes(const class_info& info) {
+            std::string res;
+            for(auto& idx : info.indexes) {
+                if(idx.columns.empty()) throw std::logic_error("index " + idx.name + " has no columns");
+                if(!res.empty()) res += "\n";
+                res += idx.unique ? "CREATE UNIQUE INDEX " : "CREATE INDEX ";
+                // The schema is given on the index name, the table has to be unqualified
+                if(!info.schema.empty()) res += "`" + info.schema + "`.";
+                res += "`" + idx.name + "` ON `" + info.table + "` (";
+                for(size_t i = 0; i < idx.columns.size(); i++) {
+                    if(i != 0) res += ", ";
+                    if(info.get_field_by_name(idx.columns[i])) res += "`" + idx.columns[i] + "`";
+                    else res += idx.columns[i];
+                }
+                res += ")";
+                if(!idx.where.empty()) res += " WHERE " + idx.where;
+                res += ";";
+            }
             return res;
         }
 
         int64_t remove(database& db, const class_info& info, const std::string& where, std::vector<db_value> vals) {
-            std::string query = "DELETE FROM ";
-            if(!info.schema.empty()) query += "`" + info.schema + "`";
-            query += "`" + info.table + "`";
+            std::string query = "DELETE FROM " + table_name(info);
             if(!where.empty()) query += " WHERE " + where;
             query += ";";
 
+            observe(db, info, where, vals);
             auto nchanges = db.total_changes();
             sqlitepp::statement stmt(db, query);
             for(size_t i = 0; i<vals.size(); i++)
                 bind_db_val(stmt, i+1, vals[i]);
             stmt.execute();
+            // SQLite skips the update hook when truncating a table
+            if(where.empty() && db.get_identity_map()) db.get_identity_map()->evict(info);
+            return db.total_changes() - nchanges;
+        }
+
+        int64_t update_where(database& db, const class_info& info, const std::vector<field_assignment>& values, const std::string& where, std::vector<db_value> vals) {
+            if(values.empty()) throw std::invalid_argument("no values to update");
+            std::string query = "UPDATE " + table_name(info) + " SET ";
+            for(size_t i = 0; i < values.size(); i++) {
+                if(values[i].field >= info.fields.size()) throw std::out_of_range("invalid field index");
+                if(i != 0) query += ", ";
+                query += "`" + info.fields[values[i].field].name + "` = ?";
+            }
+            if(!where.empty()) query += " WHERE " + where;
+            query += ";";
+
+            observe(db, info, where, vals);
+            auto nchanges = db.total_changes();
+            sqlitepp::statement stmt(db, query);
+            for(size_t i = 0; i < values.size(); i++)
+                bind_db_val(stmt, i+1, values[i].value);
+            for(size_t i = 0; i < vals.size(); i++)
+                bind_db_val(stmt, values.size()+i+1, vals[i]);
+            stmt.execute();
             return db.total_changes() - nchanges;
         }
 
         int64_t count(database& db, const class_info& info, const std::string& where, std::vector<db_value> vals) {
-            std::string query = "SELECT COUNT(*) FROM ";
-            if(!info.schema.empty()) query += "`" + info.schema + "`";
-            query += "`" + info.table + "`";
+            std::string query = "SELECT COUNT(*) FROM " + table_name(info);
             if(!where.empty()) query += " WHERE " + where;
             query += ";";
+            observe(db, info, where, vals);
 
             sqlitepp::statement stmt(db, query);
             for(size_t i = 0; i<vals.size(); i++)
@@ -280,54 +583,491 @@ namespace sqlitepp {
             return it.column_int64(0);
         }
 
-        std::vector<std::unique_ptr<entity>> select_multiple(database& db, const class_info& info, const std::string& where, std::vector<db_value> vals) {
-            std::string query = "SELECT _rowid_ as _rowid_";
-            for(auto& e: info.fields) {
-                query +=", `" + e.name + "`";
+        struct entity_loader {
+            static const std::pmr::vector<bool>& pending(const entity& e) noexcept { return e.m_pending; }
+            static int64_t rowid(const entity& e) noexcept { return e._rowid_; }
+            static void from_result(entity& e, const sqlitepp::result_iterator& it, const std::vector<size_t>& columns) {
+                e.from_result(it, columns);
             }
-            query += " FROM ";
-            if(!info.schema.empty()) query += "`" + info.schema + "`";
-            query += "`" + info.table + "`";
-            if(!where.empty()) {
-                query += " WHERE " + where;
+            /**
+             * \brief Fill fields of a cached entity that are still pending from the current row
+             * 
+             * Fields already loaded keep their (possibly modified) value.
+             */
+            static void merge_result(entity& e, const sqlitepp::result_iterator& it, const std::vector<size_t>& columns) {
+                auto& info = e.get_class_info();
+                if(e.m_pending.size() != info.fields.size()) return;
+                if(e.m_db_vals.size() != info.fields.size()) e.snapshot_clear();
+                for(size_t i = 0; i < columns.size(); i++) {
+                    if(!e.m_pending[columns[i]]) continue;
+                    auto& f = info.fields[columns[i]];
+                    auto val = read_db_val(it, i + 1, f);
+                    f.setter(&e, val);
+                    e.snapshot_field(columns[i], std::move(val));
+                    e.m_pending[columns[i]] = false;
+                }
+            }
+            /**
+             * \brief Load pending fields before all fields are written, e.g. by upsert()
+             * 
+             * Like save(), pending fields changed by the application (as far as the snapshot can tell) are kept.
+             */
+            static void load_unmodified_pending(entity& e) {
+                auto& info = e.get_class_info();
+                std::vector<size_t> fields;
+                for(size_t i = 0; i < e.m_pending.size(); i++) {
+                    if(!e.m_pending[i]) continue;
+                    if(info.snapshot == snapshot_policy::none || !e.is_field_modified(i, info.fields[i].getter(&e))) fields.push_back(i);
+                }
+                e.load_fields(fields);
             }
+            /**
+             * \brief Load all pending fields that are not lazy, e.g. after a projected query
+             */
+            static void load_eager(entity& e) {
+                auto& info = e.get_class_info();
+                std::vector<size_t> fields;
+                for(size_t i = 0; i < e.m_pending.size(); i++) {
+                    if(e.m_pending[i] && !info.fields[i].lazy) fields.push_back(i);
+                }
+                e.load_fields(fields);
+            }
+            static void set_stored(entity& e, int64_t rowid, std::vector<db_value> vals) {
+                auto& info = e.get_class_info();
+                e._rowid_ = rowid;
+                e.snapshot_clear();
+                e.m_pending.clear();
+                for(size_t i = 0; i < info.fields.size(); i++) {
+                    if(info.fields[i].row_id) {
+                        info.fields[i].setter(&e, rowid);
+                        vals[i] = rowid;
+                    }
+                    e.snapshot_field(i, std::move(vals[i]));
+                }
+                e.store_key();
+            }
+            static void set_field(entity& e, size_t idx, db_value val) {
+                auto& info = e.get_class_info();
+                info.fields[idx].setter(&e, val);
+                if(e.m_db_vals.size() != info.fields.size()) e.snapshot_clear();
+                e.snapshot_field(idx, std::move(val));
+                if(idx < e.m_pending.size()) e.m_pending[idx] = false;
+            }
+        };
+
+        static std::string build_select_query(const class_info& info, const select_options& options, bool with_rowid, std::vector<size_t>& columns, bool single) {
+            columns.clear();
+            if(options.fields.empty()) {
+                for(size_t i = 0; i < info.fields.size(); i++) {
+                    if(!info.fields[i].lazy) columns.push_back(i);
+                }
+            } else {
+                for(auto i : options.fields) {
+                    if(i >= info.fields.size()) throw std::out_of_range("invalid field index");
+                    columns.push_back(i);
+                }
+                // Entities of WITHOUT ROWID tables are identified by their primary key
+                for(size_t i = 0; with_rowid && info.without_rowid && i < info.fields.size(); i++) {
+                    if(info.fields[i].primary_key && std::find(columns.begin(), columns.end(), i) == columns.end())
+                        columns.push_back(i);
+                }
+            }
+            std::string query = "SELECT ";
+            if(with_rowid) query += info.without_rowid ? "0 as _rowid_" : "_rowid_ as _rowid_";
+            for(size_t i = 0; i < columns.size(); i++) {
+                if(with_rowid || i != 0) query += ", ";
+                query += "`" + info.fields[columns[i]].name + "`";
+            }
+            query += " FROM " + table_name(info);
+            if(!options.after.empty()) {
+                if(options.after.size() != options.order_by.size())
+                    throw std::invalid_argument("after requires one value per order_by field");
+                std::string keys, values;
+                for(size_t i = 0; i < options.order_by.size(); i++) {
+                    if(options.order_by[i].order != options.order_by[0].order)
+                        throw std::invalid_argument("after requires the same sort order on every order_by field");
+                    if(i != 0) {
+                        keys += ", ";
+                        values += ", ";
+                    }
+                    keys += "`" + info.fields.at(options.order_by[i].field).name + "`";
+                    values += "?";
+                }
+                auto op = options.order_by[0].order == sort_order::ascending ? " > " : " < ";
+                query += " WHERE (" + keys + ")" + op + "(" + values + ")";
+                if(!options.where.empty()) query += " AND (" + options.where + ")";
+            } else if(!options.where.empty()) {
+                query += " WHERE " + options.where;
+            }
+            for(size_t i = 0; i < options.order_by.size(); i++) {
+                query += i == 0 ? " ORDER BY " : ", ";
+                query += "`" + info.fields.at(options.order_by[i].field).name + "`";
+                if(options.order_by[i].order == sort_order::descending) query += " DESC";
+            }
+            auto limit = single && (options.limit < 0 || options.limit > 1) ? 1 : options.limit;
+            if(limit >= 0 || options.offset > 0) query += " LIMIT " + std::to_string(limit);
+            if(options.offset > 0) query += " OFFSET " + std::to_string(options.offset);
             query += ";";
+            return query;
+        }
 
-            sqlitepp::statement stmt(db, query);
-            for(size_t i=0; i<vals.size(); i++)
-                bind_db_val(stmt, i + 1, vals[i]);
+        static statement prepare_select(database& db, const class_info& info, const select_options& options, bool with_rowid, std::vector<size_t>& columns, bool single = false) {
+            sqlitepp::statement stmt(db, build_select_query(info, options, with_rowid, columns, single));
+            observe(db, info, options.where, options.params);
+            size_t idx = 1;
+            for(auto& v : options.after)
+                bind_db_val(stmt, idx++, v);
+            for(auto& v : options.params)
+                bind_db_val(stmt, idx++, v);
+            return stmt;
+        }
+
+        std::vector<std::unique_ptr<entity>> select_multiple(database& db, const class_info& info, const select_options& options) {
+            std::vector<size_t> columns;
+            auto stmt = prepare_select(db, info, options, true, columns);
             auto it = stmt.iterator();
             std::vector<std::unique_ptr<entity>> res;
             while(it.next()) {
                 auto e = info.create(db);
-                e->from_result(it);
+                entity_loader::from_result(*e, it, columns);
                 res.emplace_back(std::move(e));
             }
             return res;
         }
 
-        std::unique_ptr<entity> select_one(database& db, const class_info& info, const std::string& where, std::vector<db_value> vals) {
-            std::string query = "SELECT _rowid_ as _rowid_";
-            for(auto& e: info.fields) {
-                query +=", `" + e.name + "`";
+        std::unique_ptr<entity> select_one(database& db, const class_info& info, const select_options& options) {
+            std::vector<size_t> columns;
+            auto stmt = prepare_select(db, info, options, true, columns, true);
+            auto it = stmt.iterator();
+            if(!it.next()) return nullptr;
+            
+            auto e = info.create(db);
+            entity_loader::from_result(*e, it, columns);
+            return e;
+        }
+
+        std::vector<std::shared_ptr<entity>> select_multiple_shared(database& db, const class_info& info, const select_options& options) {
+            auto map = info.without_rowid ? nullptr : db.get_identity_map();
+            std::vector<size_t> columns;
+            auto stmt = prepare_select(db, info, options, true, columns);
+            auto it = stmt.iterator();
+            std::vector<std::shared_ptr<entity>> res;
+            while(it.next()) {
+                auto rowid = it.column_int64(0);
+                std::shared_ptr<entity> e = map ? map->find(info, rowid) : nullptr;
+                if(e) {
+                    entity_loader::merge_result(*e, it, columns);
+                } else {
+                    e = info.create(db);
+                    entity_loader::from_result(*e, it, columns);
+                    if(map) e = map->insert(info, rowid, std::move(e));
+                }
+                res.emplace_back(std::move(e));
+            }
+            return res;
+        }
+
+        std::shared_ptr<entity> select_one_shared(database& db, const class_info& info, const select_options& options) {
+            auto map = info.without_rowid ? nullptr : db.get_identity_map();
+            std::vector<size_t> columns;
+            auto stmt = prepare_select(db, info, options, true, columns, true);
+            auto it = stmt.iterator();
+            if(!it.next()) return nullptr;
+
+            auto rowid = it.column_int64(0);
+            std::shared_ptr<entity> e = map ? map->find(info, rowid) : nullptr;
+            if(e) {
+                entity_loader::merge_result(*e, it, columns);
+                return e;
+            }
+            e = info.create(db);
+            entity_loader::from_result(*e, it, columns);
+            if(map) e = map->insert(info, rowid, std::move(e));
+            return e;
+        }
+
+        size_t select_multiple(database& db, const class_info& info, entity_arena& arena, const select_options& options) {
+            std::vector<size_t> columns;
+            auto stmt = prepare_select(db, info, options, true, columns);
+            auto it = stmt.iterator();
+            size_t n = 0;
+            while(it.next()) {
+                entity_loader::from_result(*arena.create(db, info), it, columns);
+                n++;
+            }
+            return n;
+        }
+
+        statement select_columns(database& db, const class_info& info, const select_options& options) {
+            std::vector<size_t> columns;
+            return prepare_select(db, info, options, false, columns);
+        }
+
+        statement select_aggregate(database& db, const class_info& info, const aggregate_options& options) {
+            if(options.columns.empty()) throw std::invalid_argument("no aggregate columns");
+            auto column_name = [&info](size_t idx) -> std::string {
+                if(idx >= info.fields.size()) throw std::out_of_range("invalid field index");
+                return "`" + info.fields[idx].name + "`";
+            };
+            std::string query = "SELECT ";
+            for(size_t i = 0; i < options.columns.size(); i++) {
+                auto& c = options.columns[i];
+                if(i != 0) query += ", ";
+                if(c.function.empty()) {
+                    query += column_name(c.field);
+                } else {
+                    query += c.function + "(";
+                    query += c.field == aggregate_options::all_fields ? "*" : column_name(c.field);
+                    query += ")";
+                }
             }
-            query += " FROM ";
-            if(!info.schema.empty()) query += "`" + info.schema + "`";
-            query += "`" + info.table + "`";
-            if(!where.empty()) {
-                query += " WHERE " + where;
+            query += " FROM " + table_name(info);
+            if(!options.where.empty()) query += " WHERE " + options.where;
+            for(size_t i = 0; i < options.group_by.size(); i++) {
+                query += i == 0 ? " GROUP BY " : ", ";
+                query += column_name(options.group_by[i]);
             }
             query += ";";
 
+            observe(db, info, options.where, options.params);
             sqlitepp::statement stmt(db, query);
-            for(size_t i=0; i<vals.size(); i++)
-                bind_db_val(stmt, i + 1, vals[i]);
-            auto it = stmt.iterator();
-            if(!it.next()) return nullptr;
-            
-            auto e = info.create(db);
-            e->from_result(it);
+            for(size_t i = 0; i < options.params.size(); i++)
+                bind_db_val(stmt, i + 1, options.params[i]);
+            return stmt;
+        }
+
+        std::vector<std::unique_ptr<entity>> select_multiple(database& db, const class_info& info, const std::string& where, std::vector<db_value> vals) {
+            return select_multiple(db, info, select_options{ {}, where, std::move(vals) });
+        }
+
+        std::unique_ptr<entity> select_one(database& db, const class_info& info, const std::string& where, std::vector<db_value> vals) {
+            return select_one(db, info, select_options{ {}, where, std::move(vals) });
+        }
+
+        std::vector<std::shared_ptr<entity>> select_multiple_shared(database& db, const class_info& info, const std::string& where, std::vector<db_value> vals) {
+            return select_multiple_shared(db, info, select_options{ {}, where, std::move(vals) });
+        }
+
+        std::shared_ptr<entity> select_one_shared(database& db, const class_info& info, const std::string& where, std::vector<db_value> vals) {
+            return select_one_shared(db, info, select_options{ {}, where, std::move(vals) });
+        }
+
+        size_t select_multiple(database& db, const class_info& info, entity_arena& arena, const std::string& where, std::vector<db_value> vals) {
+            return select_multiple(db, info, arena, select_options{ {}, where, std::move(vals) });
+        }
+
+        relation_index_t select_related(database& db, const class_info& target, const std::string& key_field, const std::vector<db_value>& keys, size_t batch_size) {
+            if(batch_size == 0) throw std::invalid_argument("batch_size must not be zero");
+            const field_info* key = target.get_field_by_name(key_field);
+            if(!key && (target.without_rowid || (key_field != "_rowid_" && key_field != "rowid" && key_field != "oid")))
+                throw std::invalid_argument("unknown key field " + key_field);
+            std::string column = key ? "`" + key->name + "`" : "_rowid_";
+
+            // Deduplicate keys and skip NULL, which never matches
+            std::vector<db_value> unique_keys;
+            {
+                std::unordered_map<db_value, bool, db_value_hash> seen;
+                for(auto& e : keys) {
+                    if(std::holds_alternative<db_null_type>(e)) continue;
+                    if(seen.emplace(e, true).second) unique_keys.push_back(e);
+                }
+            }
+
+            relation_index_t res;
+            for(size_t offset = 0; offset < unique_keys.size(); offset += batch_size) {
+                select_options options;
+                options.where = column + " IN (";
+                for(size_t i = offset; i < std::min(unique_keys.size(), offset + batch_size); i++) {
+                    options.where += i == offset ? "?" : ", ?";
+                    options.params.push_back(unique_keys[i]);
+                }
+                options.where += ")";
+                for(auto& e : select_multiple_shared(db, target, options)) {
+                    db_value k = key ? key->getter(e.get()) : db_value{entity_loader::rowid(*e)};
+                    res.emplace(std::move(k), std::move(e));
+                }
+            }
+            return res;
+        }
+
+        static std::string build_upsert_query(const class_info& info, std::vector<size_t>& columns) {
+            columns.clear();
+            std::vector<size_t> pk_fields;
+            bool pk_is_rowid = true;
+            std::map<int, std::vector<size_t>> unique_fields;
+            std::vector<std::vector<size_t>> targets;
+            for(size_t i = 0; i < info.fields.size(); i++) {
+                auto& e = info.fields[i];
+                if(!e.row_id) columns.push_back(i);
+                if(e.primary_key) {
+                    pk_fields.push_back(i);
+                    pk_is_rowid = pk_is_rowid && e.row_id;
+                }
+                if(e.unique_id == field_info::UNIQUE_ID_SINGLE_FIELD) targets.push_back({ i });
+                else if(e.unique_id > 0 || e.unique_id == field_info::UNIQUE_ID_DEFAULT) unique_fields[e.unique_id].push_back(i);
+            }
+            // Rowid aliases are always bound to NULL and can never conflict
+            if(!pk_fields.empty() && !pk_is_rowid) targets.insert(targets.begin(), pk_fields);
+            for(auto& e : unique_fields) targets.push_back(e.second);
+            if(targets.empty()) throw std::logic_error("upsert requires a primary key or unique constraint on " + info.table);
+            if(columns.empty()) throw std::logic_error("upsert requires at least one column");
+
+            std::string query = "INSERT INTO " + table_name(info) + " (";
+            for(size_t i = 0; i < columns.size(); i++) {
+                if(i != 0) query += ", ";
+                query += "`" + info.fields[columns[i]].name + "`";
+            }
+            query += ") VALUES (";
+            for(size_t i = 0; i < columns.size(); i++) {
+                query += i == 0 ? "?" : ", ?";
+            }
+            query += ")";
+            for(auto& target : targets) {
+                query += " ON CONFLICT(";
+                for(size_t i = 0; i < target.size(); i++) {
+                    if(i != 0) query += ", ";
+                    query += "`" + info.fields[target[i]].name + "`";
+                }
+                query += ") DO UPDATE SET ";
+                bool first = true;
+                for(auto c : columns) {
+                    if(std::find(target.begin(), target.end(), c) != target.end()) continue;
+                    if(!first) query += ", ";
+                    first = false;
+                    query += "`" + info.fields[c].name + "` = excluded.`" + info.fields[c].name + "`";
+                }
+                // DO NOTHING would not return the rowid, so use a no-op update instead
+                if(first) query += "`" + info.fields[target[0]].name + "` = excluded.`" + info.fields[target[0]].name + "`";
+            }
+            // WITHOUT ROWID tables have no rowid, the entity is identified by its key instead
+            query += info.without_rowid ? " RETURNING 0;" : " RETURNING _rowid_;";
+            return query;
+        }
+
+        void upsert(database& db, const class_info& info, const std::vector<entity*>& entities) {
+            if(entities.empty()) return;
+            std::vector<size_t> columns;
+            statement stmt(db, build_upsert_query(info, columns));
+            // Entities are only marked as stored once all rows are written, a rollback would leave them pointing to missing rows
+            std::vector<std::pair<int64_t, std::vector<db_value>>> stored;
+            stored.reserve(entities.size());
+            if(entities.size() > 1) db.exec("SAVEPOINT sqlitepp_upsert;");
+            try {
+                for(auto e : entities) {
+                    // Every column is written, so fields left out when reading the entity have to be loaded first
+                    entity_loader::load_unmodified_pending(*e);
+                    std::vector<db_value> vals(info.fields.size(), db_value{db_null_type{}});
+                    for(size_t i = 0; i < columns.size(); i++) {
+                        vals[columns[i]] = info.fields[columns[i]].getter(e);
+                        bind_db_val(stmt, i + 1, vals[columns[i]]);
+                    }
+                    int64_t rowid = -1;
+                    {
+                        identity_map::write_guard guard(db.get_identity_map(), e);
+                        auto it = stmt.iterator();
+                        if(!it.next()) throw std::logic_error("upsert did not return a rowid");
+                        rowid = it.column_int64(0);
+                        // Step until done, so the statement completes before it is reset
+                        while(it.next()) {}
+                    }
+                    stored.emplace_back(rowid, std::move(vals));
+                }
+            } catch(...) {
+                if(entities.size() > 1) db.exec("ROLLBACK TO sqlitepp_upsert; RELEASE sqlitepp_upsert;");
+                throw;
+            }
+            if(entities.size() > 1) db.exec("RELEASE sqlitepp_upsert;");
+            for(size_t i = 0; i < entities.size(); i++) {
+                entity_loader::set_stored(*entities[i], stored[i].first, std::move(stored[i].second));
+            }
+        }
+
+        std::shared_ptr<entity> find(database& db, const class_info& info, int64_t rowid) {
+            if(info.without_rowid) throw std::logic_error("WITHOUT ROWID tables can not be searched by rowid");
+            if(auto map = db.get_identity_map()) {
+                if(auto e = map->find(info, rowid)) {
+                    // The cached entity might come from a projected query
+                    entity_loader::load_eager(*e);
+                    return e;
+                }
+            }
+            return select_one_shared(db, info, "_rowid_ = ?", { rowid });
+        }
+
+        void load_lazy(database& db, const class_info& info, const std::vector<entity*>& entities, size_t batch_size) {
+            if(batch_size == 0) throw std::invalid_argument("batch_size must not be zero");
+            // Union of all pending fields, entities that already loaded a field keep their value
+            std::vector<size_t> fields;
+            for(size_t i = 0; i < info.fields.size(); i++) {
+                for(auto e : entities) {
+                    auto& p = entity_loader::pending(*e);
+                    if(i < p.size() && p[i] && entity_loader::rowid(*e) >= 0) {
+                        fields.push_back(i);
+                        break;
+                    }
+                }
+            }
+            if(fields.empty()) return;
+            if(info.without_rowid) {
+                for(auto e : entities) e->load();
+                return;
+            }
+
+            std::string columns = "_rowid_";
+            for(auto f : fields) columns += ", `" + info.fields[f].name + "`";
+            std::unordered_map<int64_t, entity*> by_rowid;
+            for(size_t offset = 0; offset < entities.size(); offset += batch_size) {
+                by_rowid.clear();
+                for(size_t i = offset; i < std::min(entities.size(), offset + batch_size); i++) {
+                    if(entity_loader::rowid(*entities[i]) >= 0) by_rowid[entity_loader::rowid(*entities[i])] = entities[i];
+                }
+                if(by_rowid.empty()) continue;
+
+                std::string query = "SELECT " + columns + " FROM " + table_name(info) + " WHERE _rowid_ IN (";
+                for(size_t i = 0; i < by_rowid.size(); i++) query += i == 0 ? "?" : ", ?";
+                query += ");";
+                statement stmt(db, query);
+                size_t idx = 1;
+                for(auto& e : by_rowid) stmt.bind(idx++, e.first);
+                auto it = stmt.iterator();
+                while(it.next()) {
+                    auto found = by_rowid.find(it.column_int64(0));
+                    if(found == by_rowid.end()) continue;
+                    auto& p = entity_loader::pending(*found->second);
+                    for(size_t i = 0; i < fields.size(); i++) {
+                        if(fields[i] >= p.size() || !p[fields[i]]) continue;
+                        entity_loader::set_field(*found->second, fields[i], read_db_val(it, i + 1, info.fields[fields[i]]));
+                    }
+                }
+            }
+        }
+
+        entity_arena::entity_arena(size_t initial_size)
+            : m_resource(initial_size), m_entities()
+        {}
+
+        entity_arena::~entity_arena() {
+            clear();
+        }
+
+        entity* entity_arena::create(database& db, const class_info& info) {
+            if(!info.construct || info.size == 0)
+                throw std::logic_error("class_info does not support arena allocation");
+            void* mem = m_resource.allocate(info.size, info.alignment);
+            // Make sure we have space for the pointer before constructing, so we never leak an entity
+            if(m_entities.size() == m_entities.capacity())
+                m_entities.reserve(std::max<size_t>(64, m_entities.capacity() * 2));
+            auto e = info.construct(mem, db, &m_resource);
+            m_entities.push_back(e);
             return e;
         }
+
+        void entity_arena::clear() {
+            for(auto it = m_entities.rbegin(); it != m_entities.rend(); it++) {
+                (*it)->~entity();
+            }
+            m_entities.clear();
+            m_resource.release();
+        }
     }
 }
\ No newline at end of file
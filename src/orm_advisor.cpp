@@ -0,0 +1,262 @@
+#include "sqlitepp/orm_advisor.h"
+#include "sqlitepp/orm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace sqlitepp {
+    namespace orm {
+        namespace {
+            enum class predicate_kind {
+                equality,
+                range,
+                prefix,
+                other
+            };
+
+            struct predicate {
+                std::string column;
+                predicate_kind kind;
+            };
+
+            bool starts_with_word(const std::string& str, size_t pos, const char* word) {
+                size_t len = strlen(word);
+                if(str.compare(pos, len, word) != 0) return false;
+                if(pos > 0 && (isalnum(static_cast<unsigned char>(str[pos - 1])) || str[pos - 1] == '_')) return false;
+                return pos + len >= str.size() || !(isalnum(static_cast<unsigned char>(str[pos + len])) || str[pos + len] == '_');
+            }
+
+            bool has_constant_glob_prefix(const db_value& val) {
+                if(!std::holds_alternative<db_text_type>(val)) return false;
+                auto& str = std::get<db_text_type>(val);
+                return !str.empty() && str[0] != '*' && str[0] != '?' && str[0] != '[';
+            }
+
+            /**
+             * Extract the predicates of a condition rendered by the condition builder.
+             * Returns false if the condition contains OR or NOT, which prevent using a single index.
+             */
+            bool parse_predicates(const std::string& where, const std::vector<db_value>& params, std::vector<predicate>& res) {
+                // Longest operators first, so "IS NOT" is not read as "IS"
+                static const std::pair<const char*, predicate_kind> operators[] = {
+                    { "NOT BETWEEN", predicate_kind::other },
+                    { "NOT IN", predicate_kind::other },
+                    { "IS NOT", predicate_kind::other },
+                    { "BETWEEN", predicate_kind::range },
+                    // LIKE is case insensitive and can not use an index with the default BINARY collation
+                    { "LIKE", predicate_kind::other },
+                    { "GLOB", predicate_kind::prefix },
+                    { "IS", predicate_kind::equality },
+                    { "IN", predicate_kind::equality },
+                    { "<>", predicate_kind::other },
+                    { "!=", predicate_kind::other },
+                    { ">=", predicate_kind::range },
+                    { "<=", predicate_kind::range },
+                    { "=", predicate_kind::equality },
+                    { ">", predicate_kind::range },
+                    { "<", predicate_kind::range },
+                };
+                bool sargable = true;
+                size_t param = 0;
+                for(size_t i = 0; i < where.size(); i++) {
+                    char c = where[i];
+                    if(c == '\'') {
+                        auto end = where.find('\'', i + 1);
+                        if(end == std::string::npos) break;
+                        i = end;
+                    } else if(c == '?') {
+                        param++;
+                    } else if(starts_with_word(where, i, "OR") || starts_with_word(where, i, "NOT")) {
+                        sargable = false;
+                    } else if(c == '`') {
+                        auto end = where.find('`', i + 1);
+                        if(end == std::string::npos) break;
+                        predicate p{ where.substr(i + 1, end - i - 1), predicate_kind::other };
+                        i = end;
+                        size_t pos = i + 1;
+                        while(pos < where.size() && where[pos] == ' ') pos++;
+                        for(auto& op : operators) {
+                            if(where.compare(pos, strlen(op.first), op.first) != 0) continue;
+                            p.kind = op.second;
+                            i = pos + strlen(op.first) - 1;
+                            if(p.kind == predicate_kind::prefix) {
+                                auto next = where.find_first_not_of(' ', i + 1);
+                                bool is_param = next != std::string::npos && where[next] == '?';
+                                if(!is_param || param >= params.size() || !has_constant_glob_prefix(params[param]))
+                                    p.kind = predicate_kind::other;
+                            }
+                            break;
+                        }
+                        res.push_back(std::move(p));
+                    }
+                }
+                return sargable;
+            }
+
+            struct index_columns {
+                std::string name;
+                std::vector<std::string> columns;
+            };
+
+            std::string schema_prefix(const class_info& info) {
+                return info.schema.empty() ? "" : "`" + info.schema + "`.";
+            }
+
+            std::vector<index_columns> existing_indexes(database& db, const class_info& info) {
+                std::vector<index_columns> res;
+                {
+                    statement stmt(db, "PRAGMA " + schema_prefix(info) + "index_list(`" + info.table + "`);");
+                    auto it = stmt.iterator();
+                    while(it.next()) res.push_back({ it.column_string(1), {} });
+                }
+                for(auto& idx : res) {
+                    statement stmt(db, "PRAGMA " + schema_prefix(info) + "index_info(`" + idx.name + "`);");
+                    auto it = stmt.iterator();
+                    while(it.next()) idx.columns.push_back(it.column_is_null(2) ? std::string() : it.column_string(2));
+                }
+                // The INTEGER PRIMARY KEY is the rowid and not listed as index
+                for(auto& f : info.fields) {
+                    if(f.row_id) res.push_back({ "", { f.name } });
+                }
+                return res;
+            }
+
+            bool is_covered(const std::vector<index_columns>& indexes, const std::vector<std::string>& equality, const std::string& range) {
+                for(auto& idx : indexes) {
+                    if(idx.columns.size() < equality.size() + (range.empty() ? 0 : 1)) continue;
+                    // Equality columns can be in any order, as long as they are the leading columns
+                    bool match = std::is_permutation(equality.begin(), equality.end(), idx.columns.begin());
+                    if(match && !range.empty()) match = idx.columns[equality.size()] == range;
+                    if(match) return true;
+                }
+                return false;
+            }
+        }
+
+        void index_advisor::record(const class_info& info, const std::string& where, const std::vector<db_value>& params) {
+            if(where.empty()) return;
+            std::vector<predicate> predicates;
+            bool sargable = parse_predicates(where, params, predicates);
+            if(predicates.empty()) return;
+
+            std::unique_lock<std::mutex> lck(m_mtx);
+            auto& usage = m_usage[&info];
+            std::vector<std::string> equality;
+            std::string range;
+            for(auto& p : predicates) {
+                auto& col = usage.columns[p.column];
+                col.column = p.column;
+                switch(p.kind) {
+                case predicate_kind::equality:
+                    col.equality++;
+                    if(std::find(equality.begin(), equality.end(), p.column) == equality.end()) equality.push_back(p.column);
+                    break;
+                case predicate_kind::range: col.range++; if(range.empty()) range = p.column; break;
+                case predicate_kind::prefix: col.prefix++; if(range.empty()) range = p.column; break;
+                case predicate_kind::other: break;
+                }
+            }
+            if(!sargable) return;
+            // Only a single range can be used by an index, after all equality columns
+            if(std::find(equality.begin(), equality.end(), range) != equality.end()) range.clear();
+            if(equality.empty() && range.empty()) return;
+            std::sort(equality.begin(), equality.end());
+
+            std::string key;
+            for(auto& e : equality) key += e + ",";
+            key += "|" + range;
+            auto it = usage.shapes.find(key);
+            if(it == usage.shapes.end()) {
+                usage.shapes.emplace(key, shape{ equality, range, 1, where, params });
+            } else {
+                it->second.hits++;
+            }
+        }
+
+        std::vector<column_usage> index_advisor::usage(const class_info& info) const {
+            std::unique_lock<std::mutex> lck(m_mtx);
+            std::vector<column_usage> res;
+            auto it = m_usage.find(&info);
+            if(it == m_usage.end()) return res;
+            for(auto& e : it->second.columns) res.push_back(e.second);
+            std::stable_sort(res.begin(), res.end(), [](const column_usage& a, const column_usage& b) {
+                return a.equality + a.range + a.prefix > b.equality + b.range + b.prefix;
+            });
+            return res;
+        }
+
+        std::vector<index_suggestion> index_advisor::suggest(database& db) const {
+            std::map<const class_info*, class_usage> recorded;
+            {
+                std::unique_lock<std::mutex> lck(m_mtx);
+                recorded = m_usage;
+            }
+            std::vector<index_suggestion> res;
+            for(auto& cls : recorded) {
+                auto& info = *cls.first;
+                auto indexes = existing_indexes(db, info);
+
+                int64_t rows = 0;
+                {
+                    statement stmt(db, std::string(info.without_rowid ? "SELECT COUNT(*)" : "SELECT MAX(_rowid_)")
+                        + " FROM " + schema_prefix(info) + "`" + info.table + "`;");
+                    auto it = stmt.iterator();
+                    if(it.next() && !it.column_is_null(0)) rows = it.column_int64(0);
+                }
+
+                for(auto& e : cls.second.shapes) {
+                    auto& s = e.second;
+                    if(is_covered(indexes, s.equality, s.range)) continue;
+
+                    index_suggestion suggestion{ &info, {}, {}, s.hits, 0.0, {} };
+                    // Most selective (most used) equality columns first
+                    suggestion.columns = s.equality;
+                    std::stable_sort(suggestion.columns.begin(), suggestion.columns.end(), [&cls](const std::string& a, const std::string& b) {
+                        return cls.second.columns.at(a).equality > cls.second.columns.at(b).equality;
+                    });
+                    if(!s.range.empty()) suggestion.columns.push_back(s.range);
+
+                    statement stmt(db, "EXPLAIN QUERY PLAN SELECT * FROM " + schema_prefix(info) + "`" + info.table + "` WHERE " + s.where + ";");
+                    for(size_t i = 0; i < s.params.size(); i++) {
+                        auto& p = s.params[i];
+                        if(std::holds_alternative<db_text_type>(p)) stmt.bind(i + 1, std::get<db_text_type>(p));
+                        else if(std::holds_alternative<db_integer_type>(p)) stmt.bind(i + 1, std::get<db_integer_type>(p));
+                        else if(std::holds_alternative<db_real_type>(p)) stmt.bind(i + 1, std::get<db_real_type>(p));
+                        else if(std::holds_alternative<db_blob_type>(p)) stmt.bind(i + 1, std::get<db_blob_type>(p));
+                        else stmt.bind(i + 1, nullptr);
+                    }
+                    auto it = stmt.iterator();
+                    bool scan = false;
+                    while(it.next()) {
+                        auto detail = it.column_string(3);
+                        if(detail.compare(0, 4, "SCAN") == 0) scan = true;
+                        if(!suggestion.plan.empty()) suggestion.plan += "\n";
+                        suggestion.plan += detail;
+                    }
+                    double visited = scan ? static_cast<double>(rows) : std::sqrt(static_cast<double>(rows));
+                    suggestion.estimated_cost = visited * static_cast<double>(s.hits);
+
+                    std::string name = "idx_" + info.table;
+                    for(auto& c : suggestion.columns) name += "_" + c;
+                    suggestion.statement = "CREATE INDEX " + schema_prefix(info) + "`" + name + "` ON `" + info.table + "` (";
+                    for(size_t i = 0; i < suggestion.columns.size(); i++) {
+                        if(i != 0) suggestion.statement += ", ";
+                        suggestion.statement += "`" + suggestion.columns[i] + "`";
+                    }
+                    suggestion.statement += ");";
+                    res.push_back(std::move(suggestion));
+                }
+            }
+            std::stable_sort(res.begin(), res.end(), [](const index_suggestion& a, const index_suggestion& b) {
+                return a.estimated_cost > b.estimated_cost;
+            });
+            return res;
+        }
+
+        void index_advisor::clear() {
+            std::unique_lock<std::mutex> lck(m_mtx);
+            m_usage.clear();
+        }
+    }
+}
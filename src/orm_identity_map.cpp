@@ -0,0 +1,145 @@
+#include "sqlitepp/orm_identity_map.h"
+#include "sqlitepp/orm.h"
+
+#include <sqlite3.h>
+
+namespace sqlitepp {
+    namespace orm {
+        identity_map::identity_map(size_t lru_capacity)
+            : m_capacity(lru_capacity)
+        {}
+
+        void identity_map::touch(entry& e, const key& k, const std::shared_ptr<entity>& ptr) {
+            if(m_capacity == 0) return;
+            if(e.in_lru) {
+                m_lru.splice(m_lru.begin(), m_lru, e.lru);
+            } else {
+                m_lru.emplace_front(k, ptr);
+                e.lru = m_lru.begin();
+                e.in_lru = true;
+            }
+            while(m_lru.size() > m_capacity) {
+                auto it = m_entries.find(m_lru.back().first);
+                if(it != m_entries.end()) it->second.in_lru = false;
+                m_lru.pop_back();
+            }
+        }
+
+        void identity_map::erase(std::unordered_map<key, entry, key_hash>::iterator it) {
+            if(it->second.in_lru) m_lru.erase(it->second.lru);
+            m_entries.erase(it);
+        }
+
+        void identity_map::sweep() {
+            for(auto it = m_entries.begin(); it != m_entries.end();) {
+                if(it->second.ptr.expired()) it = m_entries.erase(it);
+                else it++;
+            }
+            m_sweep_threshold = std::max<size_t>(64, m_entries.size() * 2);
+        }
+
+        std::shared_ptr<entity> identity_map::find(const class_info& info, int64_t rowid) {
+            std::unique_lock<std::mutex> lck(m_mtx);
+            key k{&info, rowid};
+            auto it = m_entries.find(k);
+            if(it == m_entries.end()) return nullptr;
+            auto ptr = it->second.ptr.lock();
+            if(!ptr) {
+                erase(it);
+                return nullptr;
+            }
+            touch(it->second, k, ptr);
+            return ptr;
+        }
+
+        std::shared_ptr<entity> identity_map::insert(const class_info& info, int64_t rowid, std::shared_ptr<entity> e) {
+            std::unique_lock<std::mutex> lck(m_mtx);
+            key k{&info, rowid};
+            auto it = m_entries.find(k);
+            if(it != m_entries.end()) {
+                auto existing = it->second.ptr.lock();
+                if(existing) {
+                    touch(it->second, k, existing);
+                    return existing;
+                }
+                it->second.ptr = e;
+            } else {
+                if(m_entries.size() >= m_sweep_threshold) sweep();
+                bool known = false;
+                auto range = m_classes.equal_range(info.table);
+                for(auto c = range.first; c != range.second; c++) known = known || c->second == &info;
+                if(!known) m_classes.emplace(info.table, &info);
+                it = m_entries.emplace(k, entry{e, m_lru.end(), false}).first;
+            }
+            touch(it->second, k, e);
+            return e;
+        }
+
+        void identity_map::evict(const class_info& info, int64_t rowid) {
+            std::unique_lock<std::mutex> lck(m_mtx);
+            auto it = m_entries.find(key{&info, rowid});
+            if(it != m_entries.end()) erase(it);
+        }
+
+        void identity_map::evict(const class_info& info) {
+            std::unique_lock<std::mutex> lck(m_mtx);
+            for(auto it = m_entries.begin(); it != m_entries.end();) {
+                if(it->first.info != &info) {
+                    it++;
+                    continue;
+                }
+                if(it->second.in_lru) m_lru.erase(it->second.lru);
+                it = m_entries.erase(it);
+            }
+        }
+
+        void identity_map::evict(const std::string& table, int64_t rowid) {
+            std::unique_lock<std::mutex> lck(m_mtx);
+            auto range = m_classes.equal_range(table);
+            for(auto c = range.first; c != range.second; c++) {
+                auto it = m_entries.find(key{c->second, rowid});
+                if(it != m_entries.end()) erase(it);
+            }
+        }
+
+        void identity_map::clear() {
+            std::unique_lock<std::mutex> lck(m_mtx);
+            m_entries.clear();
+            m_lru.clear();
+        }
+
+        size_t identity_map::size() const {
+            std::unique_lock<std::mutex> lck(m_mtx);
+            return m_entries.size();
+        }
+
+        identity_map::write_guard::write_guard(identity_map* map, const entity* e)
+            : m_map(map)
+        {
+            if(!m_map) return;
+            std::unique_lock<std::mutex> lck(m_map->m_mtx);
+            m_map->m_writing = e;
+        }
+
+        identity_map::write_guard::~write_guard() {
+            if(!m_map) return;
+            std::unique_lock<std::mutex> lck(m_map->m_mtx);
+            m_map->m_writing = nullptr;
+        }
+
+        void identity_map::on_update(int op, const char* table, int64_t rowid) {
+            std::unique_lock<std::mutex> lck(m_mtx);
+            auto range = m_classes.equal_range(table);
+            for(auto c = range.first; c != range.second; c++) {
+                auto it = m_entries.find(key{c->second, rowid});
+                if(it == m_entries.end()) continue;
+                // The entity writing its own state is still up to date
+                if(op != SQLITE_DELETE && m_writing != nullptr) {
+                    auto ptr = it->second.ptr.lock();
+                    if(ptr.get() == m_writing) continue;
+                }
+                erase(it);
+            }
+        }
+    }
+}
@@ -0,0 +1,490 @@
+#include "sqlitepp/orm_migration.h"
+#include "sqlitepp/error_code.h"
+#include "sqlitepp/orm.h"
+#include "sqlitepp/transaction.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+
+namespace sqlitepp {
+    namespace orm {
+        namespace {
+            struct live_column {
+                std::string name;
+                std::string type;
+                bool notnull;
+                bool primary_key;
+            };
+
+            struct live_table {
+                bool exists { false };
+                bool without_rowid { false };
+                std::vector<live_column> columns {};
+                std::set<std::vector<std::string>> unique {};
+                std::set<std::string> indexes {};
+                std::set<std::string> foreign_keys {};
+
+                const live_column* column(const std::string& name) const {
+                    for(auto& c : columns) {
+                        if(c.name == name) return &c;
+                    }
+                    return nullptr;
+                }
+            };
+
+            std::string upper(std::string str) {
+                std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+                return str;
+            }
+
+            std::string schema_prefix(const class_info& info) {
+                return info.schema.empty() ? "" : "`" + info.schema + "`.";
+            }
+
+            const char* type_name(db_type type) {
+                switch(type) {
+                case db_type::text: return "TEXT";
+                case db_type::integer: return "INTEGER";
+                case db_type::real: return "REAL";
+                case db_type::blob: return "BLOB";
+                }
+                return "";
+            }
+
+            const char* action_name(fk_action action) {
+                switch(action) {
+                case fk_action::no_action: return "NO ACTION";
+                case fk_action::restrict: return "RESTRICT";
+                case fk_action::set_null: return "SET NULL";
+                case fk_action::set_default: return "SET DEFAULT";
+                case fk_action::cascade: return "CASCADE";
+                }
+                return "";
+            }
+
+            std::string foreign_key(const std::string& from, const std::string& table, const std::string& to, const std::string& on_update, const std::string& on_delete) {
+                return from + "->" + table + "." + to + " " + on_update + "/" + on_delete;
+            }
+
+            std::string literal(const db_value& val) {
+                if(std::holds_alternative<db_integer_type>(val)) return std::to_string(std::get<db_integer_type>(val));
+                if(std::holds_alternative<db_real_type>(val)) {
+                    char buf[32];
+                    snprintf(buf, sizeof(buf), "%.17g", std::get<db_real_type>(val));
+                    return buf;
+                }
+                if(std::holds_alternative<db_text_type>(val)) {
+                    std::string res = "'";
+                    for(auto c : std::get<db_text_type>(val)) {
+                        if(c == '\'') res += '\'';
+                        res += c;
+                    }
+                    return res + "'";
+                }
+                if(std::holds_alternative<db_blob_type>(val)) {
+                    static const char hex[] = "0123456789ABCDEF";
+                    std::string res = "X'";
+                    for(auto b : std::get<db_blob_type>(val)) {
+                        res += hex[b >> 4];
+                        res += hex[b & 0x0f];
+                    }
+                    return res + "'";
+                }
+                return "NULL";
+            }
+
+            // Value of a column that does not exist in the old table
+            std::string initial_value(const field_info& f) {
+                if(f.default_value.has_value()) return literal(*f.default_value);
+                if(f.nullable) return "NULL";
+                switch(f.type) {
+                case db_type::text: return "''";
+                case db_type::integer: return "0";
+                case db_type::real: return "0.0";
+                case db_type::blob: return "X''";
+                }
+                return "NULL";
+            }
+
+            live_table read_live_table(database& db, const class_info& info) {
+                live_table res;
+                auto schema = schema_prefix(info);
+                {
+                    statement stmt(db, "PRAGMA " + schema + "table_info(`" + info.table + "`);");
+                    auto it = stmt.iterator();
+                    while(it.next()) {
+                        res.columns.push_back({ it.column_string(1), upper(it.column_string(2)), it.column_int64(3) != 0, it.column_int64(5) != 0 });
+                    }
+                }
+                res.exists = !res.columns.empty();
+                if(!res.exists) return res;
+                {
+                    statement stmt(db, "SELECT sql FROM " + schema + "sqlite_master WHERE type = 'table' AND name = ?;");
+                    stmt.bind(1, info.table);
+                    auto it = stmt.iterator();
+                    if(it.next() && !it.column_is_null(0)) res.without_rowid = upper(it.column_string(0)).find("WITHOUT ROWID") != std::string::npos;
+                }
+                std::vector<std::string> unique;
+                {
+                    statement stmt(db, "PRAGMA " + schema + "index_list(`" + info.table + "`);");
+                    auto it = stmt.iterator();
+                    while(it.next()) {
+                        res.indexes.insert(it.column_string(1));
+                        if(it.column_string(3) == "u") unique.push_back(it.column_string(1));
+                    }
+                }
+                for(auto& name : unique) {
+                    statement stmt(db, "PRAGMA " + schema + "index_info(`" + name + "`);");
+                    auto it = stmt.iterator();
+                    std::vector<std::string> columns;
+                    while(it.next()) columns.push_back(it.column_string(2));
+                    std::sort(columns.begin(), columns.end());
+                    res.unique.insert(columns);
+                }
+                {
+                    statement stmt(db, "PRAGMA " + schema + "foreign_key_list(`" + info.table + "`);");
+                    auto it = stmt.iterator();
+                    while(it.next()) {
+                        res.foreign_keys.insert(foreign_key(it.column_string(3), it.column_string(2), it.column_string(4), it.column_string(5), it.column_string(6)));
+                    }
+                }
+                return res;
+            }
+
+            std::set<std::vector<std::string>> expected_unique(const class_info& info) {
+                std::set<std::vector<std::string>> res;
+                std::map<int, std::vector<std::string>> groups;
+                for(auto& f : info.fields) {
+                    if(f.unique_id == field_info::UNIQUE_ID_SINGLE_FIELD) res.insert({ f.name });
+                    else if(f.unique_id > 0 || f.unique_id == field_info::UNIQUE_ID_DEFAULT) groups[f.unique_id].push_back(f.name);
+                }
+                for(auto& e : groups) {
+                    std::sort(e.second.begin(), e.second.end());
+                    res.insert(e.second);
+                }
+                return res;
+            }
+
+            std::vector<std::string> index_statements(const class_info& info, const live_table* live) {
+                std::vector<std::string> res;
+                for(auto& idx : info.indexes) {
+                    if(live && live->indexes.count(idx.name)) continue;
+                    class_info single;
+                    single.table = info.table;
+                    single.schema = info.schema;
+                    single.fields = info.fields;
+                    single.indexes = { idx };
+                    res.push_back(generate_create_indexes(single));
+                }
+                return res;
+            }
+
+            std::string column_definition(const field_info& f) {
+                std::string res = "`" + f.name + "` " + type_name(f.type);
+                if(!f.nullable) res += " NOT NULL";
+                if(f.default_value.has_value()) res += " DEFAULT " + literal(*f.default_value);
+                if(!f.fk_table.empty()) {
+                    res += " REFERENCES `" + f.fk_table + "` (`" + f.fk_field + "`)";
+                    res += std::string(" ON DELETE ") + action_name(f.fk_del_action);
+                    res += std::string(" ON UPDATE ") + action_name(f.fk_update_action);
+                }
+                return res;
+            }
+
+            bool can_add_column(const field_info& f) {
+                if(f.primary_key || f.unique_id != field_info::UNIQUE_ID_NONE) return false;
+                bool null_default = !f.default_value.has_value() || std::holds_alternative<db_null_type>(*f.default_value);
+                // NOT NULL needs a default, a REFERENCES column has to default to NULL
+                if(!f.nullable && null_default) return false;
+                if(!f.fk_table.empty() && !null_default) return false;
+                return true;
+            }
+
+            void transaction(database& db, const std::function<void()>& fn) {
+                sqlitepp::transaction tx(db, transaction_mode::immediate);
+                fn();
+                tx.commit();
+            }
+
+            int64_t query_int64(database& db, const std::string& query, int64_t fallback) {
+                statement stmt(db, query);
+                auto it = stmt.iterator();
+                if(!it.next() || it.column_is_null(0)) return fallback;
+                return it.column_int64(0);
+            }
+        }
+
+        migration_plan plan_migration(database& db, const class_info& info) {
+            migration_plan plan;
+            auto live = read_live_table(db, info);
+            if(!live.exists) {
+                plan.kind = migration_plan::action::create;
+                plan.changes.push_back("create table " + info.table);
+                plan.statements.push_back(generate_create_table(info));
+                for(auto& s : index_statements(info, nullptr)) plan.statements.push_back(s);
+                return plan;
+            }
+
+            bool rebuild = false;
+            std::vector<std::string> statements;
+            std::set<std::string> expected_fks;
+            for(auto& f : info.fields) {
+                auto col = live.column(f.name);
+                if(!col) {
+                    if(can_add_column(f)) {
+                        plan.changes.push_back("add column " + f.name);
+                        statements.push_back("ALTER TABLE " + schema_prefix(info) + "`" + info.table + "` ADD COLUMN " + column_definition(f) + ";");
+                    } else {
+                        plan.changes.push_back("add column " + f.name + " (requires rebuild)");
+                        rebuild = true;
+                    }
+                    continue;
+                }
+                if(!f.fk_table.empty())
+                    expected_fks.insert(foreign_key(f.name, f.fk_table, f.fk_field, action_name(f.fk_update_action), action_name(f.fk_del_action)));
+                if(col->type != type_name(f.type)) {
+                    plan.changes.push_back("change type of " + f.name + " from " + col->type + " to " + type_name(f.type));
+                    rebuild = true;
+                }
+                if(col->notnull == f.nullable) {
+                    plan.changes.push_back(std::string(f.nullable ? "drop" : "add") + " NOT NULL on " + f.name);
+                    rebuild = true;
+                }
+                if(col->primary_key != f.primary_key) {
+                    plan.changes.push_back("change primary key");
+                    rebuild = true;
+                }
+            }
+            for(auto& c : live.columns) {
+                if(info.get_field_by_name(c.name)) continue;
+                plan.changes.push_back("drop column " + c.name);
+                rebuild = true;
+            }
+            if(live.unique != expected_unique(info)) {
+                plan.changes.push_back("change unique constraints");
+                rebuild = true;
+            }
+            if(live.foreign_keys != expected_fks) {
+                plan.changes.push_back("change foreign keys");
+                rebuild = true;
+            }
+            if(live.without_rowid != info.without_rowid) {
+                plan.changes.push_back(info.without_rowid ? "convert to WITHOUT ROWID" : "convert to rowid table");
+                rebuild = true;
+            }
+
+            if(rebuild) {
+                plan.kind = migration_plan::action::rebuild;
+                // Indexes are dropped together with the old table
+                plan.statements = index_statements(info, nullptr);
+                return plan;
+            }
+            for(auto& idx : info.indexes) {
+                if(!live.indexes.count(idx.name)) plan.changes.push_back("create index " + idx.name);
+            }
+            for(auto& idx : index_statements(info, &live)) statements.push_back(idx);
+            plan.statements = std::move(statements);
+            if(!plan.statements.empty()) plan.kind = migration_plan::action::alter;
+            return plan;
+        }
+
+        migration_plan migrate(database& db, const class_info& info, const migration_options& options) {
+            if(options.batch_size == 0) throw std::invalid_argument("batch_size must not be zero");
+            if(!sqlite3_get_autocommit(db.raw())) throw std::logic_error("migrate() can not run inside a transaction");
+
+            auto plan = plan_migration(db, info);
+            migration_progress progress;
+            progress.table = info.table;
+            auto report = [&](migration_progress::phase phase) {
+                progress.current = phase;
+                if(options.progress) options.progress(progress);
+            };
+
+            if(plan.kind == migration_plan::action::none) return plan;
+            if(plan.kind != migration_plan::action::rebuild) {
+                transaction(db, [&]() {
+                    for(auto& s : plan.statements) db.exec(s);
+                });
+                report(migration_progress::phase::done);
+                return plan;
+            }
+
+            auto live = read_live_table(db, info);
+            auto schema = schema_prefix(info);
+            auto table = "`" + info.table + "`";
+            class_info shadow = info;
+            shadow.table = info.table + "__sqlitepp_migration";
+            shadow.indexes.clear();
+            auto shadow_table = "`" + shadow.table + "`";
+            std::string triggers[] = { info.table + "__sqlitepp_ins", info.table + "__sqlitepp_upd", info.table + "__sqlitepp_del" };
+
+            // Rows are matched by rowid if both tables have one, by primary key otherwise
+            bool use_rowid = !live.without_rowid && !info.without_rowid;
+            for(auto& f : info.fields) {
+                if(!use_rowid && f.primary_key && !live.column(f.name))
+                    throw std::logic_error("primary key " + f.name + " does not exist in table " + info.table);
+            }
+            // Condition on the shadow table matching the row of the old table referenced by prefix
+            auto key_match = [&](const std::string& prefix) {
+                if(use_rowid) return "_rowid_ = " + prefix + "_rowid_";
+                std::string res;
+                for(auto& f : info.fields) {
+                    if(!f.primary_key) continue;
+                    if(!res.empty()) res += " AND ";
+                    res += "`" + f.name + "` = " + prefix + "`" + f.name + "`";
+                }
+                return res;
+            };
+            // A row_id() field is the rowid of the new table and takes the old rowid if it is new
+            bool has_alias = std::any_of(info.fields.begin(), info.fields.end(), [](const field_info& f) { return f.row_id; });
+            std::string columns = use_rowid && !has_alias ? "_rowid_" : "";
+            auto values = [&](const std::string& prefix) {
+                std::string res = use_rowid && !has_alias ? prefix + "_rowid_" : "";
+                for(auto& f : info.fields) {
+                    if(!res.empty()) res += ", ";
+                    if(live.column(f.name)) res += prefix + "`" + f.name + "`";
+                    else if(f.row_id && !live.without_rowid) res += prefix + "_rowid_";
+                    else res += initial_value(f);
+                }
+                return res;
+            };
+            for(auto& f : info.fields) {
+                if(!columns.empty()) columns += ", ";
+                columns += "`" + f.name + "`";
+            }
+
+            auto cleanup = [&]() {
+                for(auto& t : triggers) db.exec("DROP TRIGGER IF EXISTS " + schema + "`" + t + "`;");
+                db.exec("DROP TABLE IF EXISTS " + schema + shadow_table + ";");
+            };
+
+            try {
+                // Leftovers of an interrupted migration are incomplete, start over
+                cleanup();
+                transaction(db, [&]() {
+                    db.exec(generate_create_table(shadow));
+                    // Keep rows changed by other connections during the copy in sync. Rows violating a constraint
+                    // of the new table fail the write instead of replacing (and losing) other rows.
+                    auto insert = "INSERT OR ABORT INTO " + shadow_table + " (" + columns + ") VALUES (" + values("NEW.") + ");";
+                    auto remove = "DELETE FROM " + shadow_table + " WHERE " + key_match("OLD.") + ";";
+                    db.exec("CREATE TRIGGER " + schema + "`" + triggers[0] + "` AFTER INSERT ON " + table + " BEGIN " + insert + " END;");
+                    db.exec("CREATE TRIGGER " + schema + "`" + triggers[1] + "` AFTER UPDATE ON " + table + " BEGIN " + remove + " " + insert + " END;");
+                    db.exec("CREATE TRIGGER " + schema + "`" + triggers[2] + "` AFTER DELETE ON " + table + " BEGIN " + remove + " END;");
+                });
+
+                // Rows written since the triggers exist are already up to date in the shadow table. A constraint
+                // violation aborts the migration, the old table is left untouched.
+                auto copy = "INSERT INTO " + shadow_table + " (" + columns + ") SELECT " + values("") + " FROM " + schema + table
+                    + " WHERE NOT EXISTS (SELECT 1 FROM " + shadow_table + " WHERE " + key_match(table + ".") + ")";
+                if(live.without_rowid) {
+                    progress.rows_estimated = query_int64(db, "SELECT COUNT(*) FROM " + schema + table + ";", 0);
+                    // Batches are ranges of the primary key, the table is stored in that order
+                    std::string key, params;
+                    for(auto& c : live.columns) {
+                        if(!c.primary_key) continue;
+                        if(!key.empty()) {
+                            key += ", ";
+                            params += ", ";
+                        }
+                        key += "`" + c.name + "`";
+                        params += "?";
+                    }
+                    typedef std::unique_ptr<sqlite3_value, void(*)(sqlite3_value*)> value_ptr;
+                    auto bind_key = [&db](statement& stmt, int idx, const std::vector<value_ptr>& key_vals) {
+                        for(auto& v : key_vals) throw_if_error(sqlite3_bind_value(stmt.raw(), idx++, v.get()), db.raw());
+                        return idx;
+                    };
+                    std::vector<value_ptr> lower;
+                    while(true) {
+                        // Upper bound of the next batch, rows inserted after it are handled by the triggers
+                        std::string after = lower.empty() ? "" : " WHERE (" + key + ") > (" + params + ")";
+                        statement bound(db, "SELECT " + key + " FROM " + schema + table + after + " ORDER BY " + key + " LIMIT 1 OFFSET ?;");
+                        auto idx = bind_key(bound, 1, lower);
+                        bound.bind(idx, static_cast<int64_t>(options.batch_size - 1));
+                        std::vector<value_ptr> upper;
+                        auto it = bound.iterator();
+                        if(it.next()) {
+                            for(int i = 0; i < sqlite3_column_count(bound.raw()); i++) {
+                                upper.emplace_back(sqlite3_value_dup(sqlite3_column_value(bound.raw(), i)), &sqlite3_value_free);
+                                if(!upper.back()) throw std::bad_alloc();
+                            }
+                        }
+                        transaction(db, [&]() {
+                            std::string range = lower.empty() ? "" : " AND (" + key + ") > (" + params + ")";
+                            if(!upper.empty()) range += " AND (" + key + ") <= (" + params + ")";
+                            statement stmt(db, copy + range + ";");
+                            bind_key(stmt, bind_key(stmt, 1, lower), upper);
+                            auto changes = db.total_changes();
+                            stmt.execute();
+                            progress.rows_copied += db.total_changes() - changes;
+                        });
+                        report(migration_progress::phase::copy);
+                        if(upper.empty()) break;
+                        lower = std::move(upper);
+                        if(options.pause.count() > 0) std::this_thread::sleep_for(options.pause);
+                    }
+                } else {
+                    progress.rows_estimated = query_int64(db, "SELECT MAX(_rowid_) FROM " + schema + table + ";", 0);
+                    int64_t lower = std::numeric_limits<int64_t>::min();
+                    while(true) {
+                        // Upper bound of the next batch, rows inserted after it are handled by the triggers
+                        statement bound(db, "SELECT _rowid_ FROM " + schema + table + " WHERE _rowid_ > ? ORDER BY _rowid_ LIMIT 1 OFFSET ?;");
+                        bound.bind(1, lower);
+                        bound.bind(2, static_cast<int64_t>(options.batch_size - 1));
+                        auto it = bound.iterator();
+                        int64_t upper = it.next() ? it.column_int64(0) : std::numeric_limits<int64_t>::max();
+                        bool last = upper == std::numeric_limits<int64_t>::max();
+                        transaction(db, [&]() {
+                            statement stmt(db, copy + " AND _rowid_ > ? AND _rowid_ <= ?;");
+                            stmt.bind(1, lower);
+                            stmt.bind(2, upper);
+                            auto changes = db.total_changes();
+                            stmt.execute();
+                            progress.rows_copied += db.total_changes() - changes;
+                        });
+                        report(migration_progress::phase::copy);
+                        if(last) break;
+                        lower = upper;
+                        if(options.pause.count() > 0) std::this_thread::sleep_for(options.pause);
+                    }
+                }
+
+                report(migration_progress::phase::swap);
+                // Dropping the referenced table would fail or cascade otherwise
+                bool foreign_keys = query_int64(db, "PRAGMA foreign_keys;", 0) != 0;
+                if(foreign_keys) db.exec("PRAGMA foreign_keys = OFF;");
+                try {
+                    transaction(db, [&]() {
+                        // Last line of defense against rows lost by the copy, e.g. an INSERT OR REPLACE on the
+                        // old table overrides the conflict handling of the triggers
+                        if(query_int64(db, "SELECT COUNT(*) FROM " + schema + table + ";", 0) != query_int64(db, "SELECT COUNT(*) FROM " + shadow_table + ";", 0))
+                            throw std::logic_error("migration of table " + info.table + " lost rows, the old table is kept");
+                        for(auto& t : triggers) db.exec("DROP TRIGGER " + schema + "`" + t + "`;");
+                        db.exec("DROP TABLE " + schema + table + ";");
+                        db.exec("ALTER TABLE " + schema + shadow_table + " RENAME TO " + table + ";");
+                        for(auto& s : plan.statements) db.exec(s);
+                    });
+                } catch(...) {
+                    if(foreign_keys) db.exec("PRAGMA foreign_keys = ON;");
+                    throw;
+                }
+                if(foreign_keys) db.exec("PRAGMA foreign_keys = ON;");
+            } catch(...) {
+                try {
+                    cleanup();
+                } catch(...) {}
+                throw;
+            }
+            report(migration_progress::phase::done);
+            return plan;
+        }
+    }
+}
@@ -1,6 +1,9 @@
 #include "sqlitepp/result_iterator.h"
+#include "sqlitepp/database.h"
 #include "sqlitepp/error_code.h"
+#include "sqlitepp/statement.h"
 #include <sqlite3.h>
+#include <algorithm>
 #include <cstring>
 
 namespace sqlitepp {
@@ -33,7 +36,7 @@ namespace sqlitepp {
 	}
 
     result_iterator::result_iterator(result_iterator&& o)
-		: m_handle(o.m_handle), m_has_row(o.m_has_row)
+		: m_handle(o.m_handle), m_has_row(o.m_has_row), m_deadline(o.m_deadline), m_token(o.m_token), m_db(o.m_db)
 	{
 		o.m_handle = nullptr;
 	}
@@ -44,10 +47,85 @@ namespace sqlitepp {
 
 	bool result_iterator::is_valid() const noexcept { return m_handle != nullptr; }
 
+	namespace {
+		// Number of virtual machine instructions between two checks of the limits
+		constexpr int progress_interval = 1000;
+
+		struct progress_state {
+			sqlite3* db;
+			std::chrono::steady_clock::time_point deadline;
+			const cancellation_token* token;
+			error_code reason;
+			// Limits of an outer statement running on the same thread, e.g. inside a user defined function
+			progress_state* outer;
+			// Handler set using database::set_progress_handler(), called after the limits
+			database* owner;
+			int (*owner_handler)(database*);
+		};
+		thread_local progress_state* g_active_progress = nullptr;
+
+		bool check_limits(progress_state* state) {
+			for(auto s = state; s != nullptr; s = s->outer) {
+				if(s->token && s->token->is_cancelled()) s->reason = error_code::cancelled;
+				else if(s->deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= s->deadline)
+					s->reason = error_code::timeout;
+				if(s->reason != error_code::ok) return false;
+			}
+			return true;
+		}
+
+		int progress_handler(void* ud) {
+			auto state = static_cast<progress_state*>(ud);
+			if(!check_limits(state)) return 1;
+			return state->owner ? state->owner_handler(state->owner) : 0;
+		}
+	}
+
+	int result_iterator::step_limited(error_code& reason) noexcept {
+		progress_state state{ sqlite3_db_handle(m_handle), m_deadline, m_token, error_code::ok, nullptr, nullptr, nullptr };
+		if(g_active_progress && g_active_progress->db == state.db) state.outer = g_active_progress;
+		int interval = progress_interval;
+		if(m_db && m_db->m_progress_handler) {
+			state.owner = m_db;
+			state.owner_handler = [](database* db) { return db->call_progress_handler() ? 1 : 0; };
+			interval = std::min(interval, m_db->m_progress_instructions);
+		}
+		auto limit_reason = [&state]() {
+			for(auto s = &state; s != nullptr; s = s->outer) {
+				if(s->reason != error_code::ok) return s->reason;
+			}
+			return error_code::ok;
+		};
+		// Limits are checked once before stepping, so an expired deadline does not run any instructions
+		if(!check_limits(&state)) {
+			reason = limit_reason();
+			return SQLITE_INTERRUPT;
+		}
+		auto previous = g_active_progress;
+		g_active_progress = &state;
+		sqlite3_progress_handler(state.db, interval, progress_handler, &state);
+		int res = sqlite3_step(m_handle);
+		if(state.outer) sqlite3_progress_handler(state.db, interval, progress_handler, state.outer);
+		else if(m_db) m_db->install_progress_handler();
+		else sqlite3_progress_handler(state.db, 0, nullptr, nullptr);
+		g_active_progress = previous;
+		if(res == SQLITE_INTERRUPT) reason = limit_reason();
+		return res;
+	}
+
 	bool result_iterator::next() {
-		int ec = sqlite3_step(m_handle);
+		std::error_code ec;
+		bool row = try_next(ec);
 		throw_if_error(ec, m_handle);
-		m_has_row = ec == SQLITE_ROW;
+		return row;
+	}
+
+	bool result_iterator::try_next(std::error_code& ec) noexcept {
+		bool limited = m_token != nullptr || m_deadline != std::chrono::steady_clock::time_point::max();
+		auto reason = error_code::ok;
+		int res = limited ? step_limited(reason) : sqlite3_step(m_handle);
+		m_has_row = res == SQLITE_ROW;
+		ec = reason != error_code::ok ? make_error_code(reason) : to_error_code(res);
 		return m_has_row;
 	}
 
@@ -65,6 +143,12 @@ namespace sqlitepp {
 		return sqlite3_column_name(m_handle, idx);
 	}
 
+	bool result_iterator::column_is_null(size_t idx) const {
+		if(idx >= column_count())
+			throw_if_error(SQLITE_RANGE, m_handle);
+		return sqlite3_column_type(m_handle, idx) == SQLITE_NULL;
+	}
+
 	size_t result_iterator::column_index(const std::string& name) const {
 		for(size_t i = 0; i < column_count(); i++) {
 			auto col = column_name(i);
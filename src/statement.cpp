@@ -4,31 +4,181 @@
 
 #include "sqlite3.h"
 
+#include <algorithm>
+
 namespace sqlitepp {
+	namespace detail {
+		// Defined in database.cpp
+		void release_statement(statement_cache& cache, sqlite3_stmt* handle) noexcept;
+	}
+
+    namespace {
+		bool is_word_char(char c) noexcept {
+			return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+		}
+
+		bool is_space(char c) noexcept {
+			return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+		}
+
+		// Length of the literal, quoted identifier or comment starting at pos, 0 if there is none
+		size_t verbatim_length(std::string_view str, size_t pos) noexcept {
+			char c = str[pos];
+			if(c == '\'' || c == '"' || c == '`' || c == '[') {
+				char end = c == '[' ? ']' : c;
+				auto e = str.find(end, pos + 1);
+				return e == std::string_view::npos ? str.size() - pos : e - pos + 1;
+			}
+			if(str.compare(pos, 2, "--") == 0) {
+				auto e = str.find('\n', pos);
+				return e == std::string_view::npos ? str.size() - pos : e - pos + 1;
+			}
+			if(str.compare(pos, 2, "/*") == 0) {
+				auto e = str.find("*/", pos + 2);
+				return e == std::string_view::npos ? str.size() - pos : e - pos + 2;
+			}
+			return 0;
+		}
+
+		bool is_keyword(std::string_view str, size_t pos, std::string_view word) noexcept {
+			if(pos + word.size() > str.size()) return false;
+			if(pos > 0 && is_word_char(str[pos - 1])) return false;
+			if(pos + word.size() < str.size() && is_word_char(str[pos + word.size()])) return false;
+			for(size_t i = 0; i < word.size(); i++) {
+				char c = str[pos + i];
+				if(c >= 'a' && c <= 'z') c = static_cast<char>(c - 'a' + 'A');
+				if(c != word[i]) return false;
+			}
+			return true;
+		}
+
+		bool is_connective(std::string_view str, size_t pos) noexcept {
+			return is_keyword(str, pos, "AND") || is_keyword(str, pos, "OR") || is_keyword(str, pos, "NOT");
+		}
+
+		// A group can be removed if it holds a single predicate and is an operand of AND / OR / NOT
+		bool is_redundant_group(std::string_view str, size_t open, size_t close) {
+			for(size_t i = open + 1, depth = 0; i < close; i++) {
+				if(auto len = verbatim_length(str, i)) {
+					i += len - 1;
+					continue;
+				}
+				if(str[i] == '(') depth++;
+				else if(str[i] == ')') depth--;
+				else if(depth == 0 && (str[i] == ',' || is_connective(str, i) || is_keyword(str, i, "BETWEEN"))) return false;
+			}
+			size_t before = open;
+			while(before > 0 && str[before - 1] == ' ') before--;
+			bool start = before == 0 || str[before - 1] == '('
+				|| (before >= 3 && is_connective(str, before - 3)) || (before >= 2 && is_keyword(str, before - 2, "OR"));
+			size_t after = close + 1;
+			while(after < str.size() && str[after] == ' ') after++;
+			bool end = after == str.size() || str[after] == ')' || is_keyword(str, after, "AND") || is_keyword(str, after, "OR");
+			return start && end;
+		}
+	}
+
+	std::string canonical_sql(std::string_view query) {
+		std::string res;
+		res.reserve(query.size());
+		bool space = false;
+		for(size_t i = 0; i < query.size(); i++) {
+			if(auto len = verbatim_length(query, i)) {
+				if(space && !res.empty() && res.back() != '(') res += ' ';
+				space = false;
+				res.append(query.substr(i, len));
+				i += len - 1;
+				continue;
+			}
+			char c = query[i];
+			if(is_space(c)) {
+				space = true;
+				continue;
+			}
+			if(c == ')' || c == ',' || c == ';') space = false;
+			if(space && !res.empty() && res.back() != '(') res += ' ';
+			space = false;
+			res += c;
+		}
+		while(!res.empty() && (res.back() == ';' || res.back() == ' ')) res.pop_back();
+		return res;
+	}
+
+	std::string canonical_condition(std::string_view condition) {
+		auto res = canonical_sql(condition);
+		std::vector<size_t> stack;
+		std::vector<bool> removed(res.size(), false);
+		bool changed = false;
+		for(size_t i = 0; i < res.size(); i++) {
+			if(auto len = verbatim_length(res, i)) {
+				i += len - 1;
+				continue;
+			}
+			if(res[i] == '(') {
+				stack.push_back(i);
+			} else if(res[i] == ')' && !stack.empty()) {
+				auto open = stack.back();
+				stack.pop_back();
+				if(is_redundant_group(res, open, i)) {
+					removed[open] = removed[i] = true;
+					changed = true;
+				}
+			}
+		}
+		if(!changed) return res;
+		std::string stripped;
+		stripped.reserve(res.size());
+		for(size_t i = 0; i < res.size(); i++) {
+			if(!removed[i]) stripped += res[i];
+		}
+		return canonical_sql(stripped);
+	}
+
+	uint64_t shape_hash(std::string_view canonical) noexcept {
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for(auto c : canonical) {
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+
     statement::statement(database& p, const std::string& query)
-		: m_db(&p), m_handle(nullptr)
+		: m_db(&p), m_handle(nullptr), m_cache(), m_timeout(0), m_deadline(std::chrono::steady_clock::time_point::max()), m_token(nullptr)
 	{
-		int res = sqlite3_prepare_v2(m_db->raw(), query.data(), query.size(), &m_handle, NULL);
-		throw_if_error(res, m_handle);
+		m_handle = m_db->acquire_statement(query, m_cache);
 	}
 
 	statement::statement(statement&& other)
-		: m_db(other.m_db), m_handle(other.m_handle)
+		: m_db(other.m_db), m_handle(other.m_handle), m_cache(std::move(other.m_cache)),
+		m_timeout(other.m_timeout), m_deadline(other.m_deadline), m_token(other.m_token)
 	{
 		other.m_handle = nullptr;
 	}
 
 	statement& statement::operator=(statement&& other)
 	{
-		if(m_handle) sqlite3_finalize(m_handle);
+		release();
 		m_db = other.m_db;
 		m_handle = other.m_handle;
+		m_cache = std::move(other.m_cache);
+		m_timeout = other.m_timeout;
+		m_deadline = other.m_deadline;
+		m_token = other.m_token;
 		other.m_handle = nullptr;
 		return *this;
 	}
 
 	statement::~statement() noexcept {
-		if(m_handle) sqlite3_finalize(m_handle);
+		release();
+	}
+
+	void statement::release() noexcept {
+		if(!m_handle) return;
+		if(m_cache) detail::release_statement(*m_cache, m_handle);
+		else sqlite3_finalize(m_handle);
+		m_handle = nullptr;
+		m_cache.reset();
 	}
 	
 	const char* statement::query() const {
@@ -40,67 +190,68 @@ namespace sqlitepp {
 	}
 	
 #ifdef __cpp_lib_string_view
-	void statement::bind(size_t idx, const std::string_view& str) {
-		int res = sqlite3_bind_text64(m_handle, idx, str.data(), str.size(), SQLITE_TRANSIENT, SQLITE_UTF8);
-		throw_if_error(res, m_handle);
+	void statement::bind(size_t idx, const std::string_view& str) { throw_if_error(try_bind(idx, str), m_handle); }
+	void statement::bind(size_t idx, const std::wstring_view& str) { throw_if_error(try_bind(idx, str), m_handle); }
+	void statement::bind(size_t idx, const std::string_view& data, bool is_blob) { throw_if_error(try_bind(idx, data, is_blob), m_handle); }
+
+	std::error_code statement::try_bind(size_t idx, const std::string_view& str) noexcept {
+		return to_error_code(sqlite3_bind_text64(m_handle, idx, str.data(), str.size(), SQLITE_TRANSIENT, SQLITE_UTF8));
 	}
 
-	void statement::bind(size_t idx, const std::wstring_view& str) {
-		int res = sqlite3_bind_text64(m_handle, idx, reinterpret_cast<const char*>(str.data()), str.size(), SQLITE_TRANSIENT, SQLITE_UTF16);
-		throw_if_error(res, m_handle);
+	std::error_code statement::try_bind(size_t idx, const std::wstring_view& str) noexcept {
+		return to_error_code(sqlite3_bind_text64(m_handle, idx, reinterpret_cast<const char*>(str.data()), str.size(), SQLITE_TRANSIENT, SQLITE_UTF16));
 	}
 
-	void statement::bind(size_t idx, const std::string_view& data, bool is_blob) {
-		if(is_blob) {
-			int res = sqlite3_bind_blob64(m_handle, idx, data.data(), data.size(), SQLITE_TRANSIENT);
-			throw_if_error(res, m_handle);
-		} else {
-			int res = sqlite3_bind_text64(m_handle, idx, data.data(), data.size(), SQLITE_TRANSIENT, SQLITE_UTF8);
-			throw_if_error(res, m_handle);
-		}
+	std::error_code statement::try_bind(size_t idx, const std::string_view& data, bool is_blob) noexcept {
+		if(is_blob) return to_error_code(sqlite3_bind_blob64(m_handle, idx, data.data(), data.size(), SQLITE_TRANSIENT));
+		return to_error_code(sqlite3_bind_text64(m_handle, idx, data.data(), data.size(), SQLITE_TRANSIENT, SQLITE_UTF8));
 	}
 #else
-	void statement::bind(size_t idx, const std::string& str) {
-		int res = sqlite3_bind_text64(m_handle, idx, str.data(), str.size(), SQLITE_TRANSIENT, SQLITE_UTF8);
-		throw_if_error(res, m_handle);
+	void statement::bind(size_t idx, const std::string& str) { throw_if_error(try_bind(idx, str), m_handle); }
+	void statement::bind(size_t idx, const std::wstring& str) { throw_if_error(try_bind(idx, str), m_handle); }
+	void statement::bind(size_t idx, const std::string& data, bool is_blob) { throw_if_error(try_bind(idx, data, is_blob), m_handle); }
+
+	std::error_code statement::try_bind(size_t idx, const std::string& str) noexcept {
+		return to_error_code(sqlite3_bind_text64(m_handle, idx, str.data(), str.size(), SQLITE_TRANSIENT, SQLITE_UTF8));
 	}
 
-	void statement::bind(size_t idx, const std::wstring& str) {
-		int res = sqlite3_bind_text64(m_handle, idx, reinterpret_cast<const char*>(str.data()), str.size(), SQLITE_TRANSIENT, SQLITE_UTF16);
-		throw_if_error(res, m_handle);
+	std::error_code statement::try_bind(size_t idx, const std::wstring& str) noexcept {
+		return to_error_code(sqlite3_bind_text64(m_handle, idx, reinterpret_cast<const char*>(str.data()), str.size(), SQLITE_TRANSIENT, SQLITE_UTF16));
 	}
 
-	void statement::bind(size_t idx, const std::string& data, bool is_blob) {
-		if(is_blob) {
-			int res = sqlite3_bind_blob64(m_handle, idx, data.data(), data.size(), SQLITE_TRANSIENT);
-			throw_if_error(res, m_handle);
-		} else {
-			int res = sqlite3_bind_text64(m_handle, idx, data.data(), data.size(), SQLITE_TRANSIENT, SQLITE_UTF8);
-			throw_if_error(res, m_handle);
-		}
+	std::error_code statement::try_bind(size_t idx, const std::string& data, bool is_blob) noexcept {
+		if(is_blob) return to_error_code(sqlite3_bind_blob64(m_handle, idx, data.data(), data.size(), SQLITE_TRANSIENT));
+		return to_error_code(sqlite3_bind_text64(m_handle, idx, data.data(), data.size(), SQLITE_TRANSIENT, SQLITE_UTF8));
 	}
 #endif
 
-	void statement::bind(size_t idx, const std::vector<uint8_t>& blob) {
-		int res = sqlite3_bind_blob64(m_handle, idx, blob.data(), blob.size(), SQLITE_TRANSIENT);
-		throw_if_error(res, m_handle);
+	void statement::bind(size_t idx, const std::vector<uint8_t>& blob) { throw_if_error(try_bind(idx, blob), m_handle); }
+	void statement::bind(size_t idx, zeroblob blob) { throw_if_error(try_bind(idx, blob), m_handle); }
+	void statement::bind(size_t idx, std::nullptr_t) { throw_if_error(try_bind(idx, nullptr), m_handle); }
+	void statement::bind(size_t idx, double val) { throw_if_error(try_bind(idx, val), m_handle); }
+	void statement::bind(size_t idx, int val) { throw_if_error(try_bind(idx, val), m_handle); }
+	void statement::bind(size_t idx, int64_t val) { throw_if_error(try_bind(idx, val), m_handle); }
+
+	std::error_code statement::try_bind(size_t idx, const std::vector<uint8_t>& blob) noexcept {
+		return to_error_code(sqlite3_bind_blob64(m_handle, idx, blob.data(), blob.size(), SQLITE_TRANSIENT));
 	}
 
-	void statement::bind(size_t idx, std::nullptr_t) {
-		int res = sqlite3_bind_null(m_handle, idx);
-		throw_if_error(res, m_handle);
+	std::error_code statement::try_bind(size_t idx, zeroblob blob) noexcept {
+		return to_error_code(sqlite3_bind_zeroblob64(m_handle, idx, blob.size));
 	}
 
-	void statement::bind(size_t idx, double val) {
-		int res = sqlite3_bind_double(m_handle, idx, val);
-		throw_if_error(res, m_handle);
+	std::error_code statement::try_bind(size_t idx, std::nullptr_t) noexcept {
+		return to_error_code(sqlite3_bind_null(m_handle, idx));
 	}
 
-	void statement::bind(size_t idx, int val) { bind(idx, static_cast<int64_t>(val)); }
+	std::error_code statement::try_bind(size_t idx, double val) noexcept {
+		return to_error_code(sqlite3_bind_double(m_handle, idx, val));
+	}
 
-	void statement::bind(size_t idx, int64_t val) {
-		int res = sqlite3_bind_int64(m_handle, idx, val);
-		throw_if_error(res, m_handle);
+	std::error_code statement::try_bind(size_t idx, int val) noexcept { return try_bind(idx, static_cast<int64_t>(val)); }
+
+	std::error_code statement::try_bind(size_t idx, int64_t val) noexcept {
+		return to_error_code(sqlite3_bind_int64(m_handle, idx, val));
 	}
 
 	size_t statement::param_count() const noexcept { return sqlite3_bind_parameter_count(m_handle); }
@@ -108,8 +259,26 @@ namespace sqlitepp {
 	size_t statement::param_name(const char* name) const noexcept { return sqlite3_bind_parameter_index(m_handle, name); }
 	size_t statement::param_name(const std::string& name) const { return param_name(name.c_str()); }
 
+	statement& statement::with_timeout(std::chrono::steady_clock::duration timeout) noexcept {
+		m_timeout = timeout;
+		return *this;
+	}
+
+	statement& statement::with_deadline(std::chrono::steady_clock::time_point deadline) noexcept {
+		m_deadline = deadline;
+		return *this;
+	}
+
+	statement& statement::with_cancellation(const cancellation_token* token) noexcept {
+		m_token = token;
+		return *this;
+	}
+
 	result_iterator statement::iterator() {
-		return result_iterator(m_handle);
+		auto deadline = m_deadline;
+		if(m_timeout > std::chrono::steady_clock::duration::zero())
+			deadline = std::min(deadline, std::chrono::steady_clock::now() + m_timeout);
+		return result_iterator(m_handle, deadline, m_token, m_db);
 	}
 
 	void statement::execute() {
@@ -117,4 +286,21 @@ namespace sqlitepp {
 		// Calling next() calls sqlite step, executing the statement
 		it.next();
 	}
+
+	std::error_code statement::try_execute() noexcept {
+		auto it = iterator();
+		std::error_code ec;
+		it.try_next(ec);
+		return ec;
+	}
+
+	void statement::reset() {
+		// sqlite3_reset returns the error of the last step, which was already reported by it
+		sqlite3_reset(m_handle);
+	}
+
+	void statement::clear_bindings() {
+		int res = sqlite3_clear_bindings(m_handle);
+		throw_if_error(res, m_handle);
+	}
 }
\ No newline at end of file
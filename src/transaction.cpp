@@ -0,0 +1,63 @@
+#include "sqlitepp/transaction.h"
+#include "sqlitepp/database.h"
+
+#include <stdexcept>
+
+namespace sqlitepp {
+	transaction::transaction(database& db, transaction_mode mode)
+		: m_db(&db), m_active(false)
+	{
+		switch(mode) {
+		case transaction_mode::deferred: db.exec("BEGIN DEFERRED;"); break;
+		case transaction_mode::immediate: db.exec("BEGIN IMMEDIATE;"); break;
+		case transaction_mode::exclusive: db.exec("BEGIN EXCLUSIVE;"); break;
+		}
+		m_active = true;
+	}
+
+	transaction::transaction(transaction&& other) noexcept
+		: m_db(other.m_db), m_active(other.m_active)
+	{
+		other.m_active = false;
+	}
+
+	transaction::~transaction() noexcept {
+		if(!m_active) return;
+		try {
+			rollback();
+		} catch(...) {
+			// The transaction might already have been rolled back by sqlite (e.g. SQLITE_FULL)
+		}
+	}
+
+	void transaction::commit() {
+		if(!m_active) throw std::logic_error("transaction is not active");
+		m_db->exec("COMMIT;");
+		m_active = false;
+	}
+
+	void transaction::rollback() {
+		if(!m_active) throw std::logic_error("transaction is not active");
+		m_active = false;
+		m_db->exec("ROLLBACK;");
+	}
+
+	void write_scheduler::lock() {
+		std::unique_lock<std::mutex> lck(m_mtx);
+		auto ticket = m_next_ticket++;
+		m_cv.wait(lck, [&]() { return m_serving == ticket; });
+	}
+
+	void write_scheduler::unlock() {
+		{
+			std::unique_lock<std::mutex> lck(m_mtx);
+			m_serving++;
+		}
+		m_cv.notify_all();
+	}
+
+	size_t write_scheduler::pending() const noexcept {
+		std::unique_lock<std::mutex> lck(m_mtx);
+		return static_cast<size_t>(m_next_ticket - m_serving);
+	}
+}
@@ -0,0 +1,244 @@
+#include "sqlitepp/vtab.h"
+#include "sqlitepp/database.h"
+#include "sqlitepp/error_code.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace sqlitepp {
+	namespace detail {
+		namespace {
+			// Constraints used on the sorted column, stored in idxNum above the column index
+			enum constraint_flags : int {
+				eq = 1 << 16,
+				lower = 1 << 17,
+				lower_inclusive = 1 << 18,
+				upper = 1 << 19,
+				upper_inclusive = 1 << 20
+			};
+			constexpr int column_mask = 0xffff;
+
+			struct source_vtab : sqlite3_vtab {
+				vtab_source* source;
+			};
+
+			struct source_cursor : sqlite3_vtab_cursor {
+				size_t pos;
+				size_t end;
+			};
+
+			vtab_source& source_of(sqlite3_vtab_cursor* cur) {
+				return *static_cast<source_vtab*>(cur->pVtab)->source;
+			}
+
+			int vtab_connect(sqlite3* db, void* aux, int, const char* const*, sqlite3_vtab** vtab, char** err) {
+				auto source = static_cast<vtab_source*>(aux);
+				std::string schema = "CREATE TABLE x(";
+				for(size_t i = 0; i < source->columns.size(); i++) {
+					if(i != 0) schema += ", ";
+					schema += "`" + source->columns[i].name + "` " + source->columns[i].type;
+				}
+				schema += ")";
+				int res = sqlite3_declare_vtab(db, schema.c_str());
+				if(res != SQLITE_OK) {
+					*err = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+					return res;
+				}
+				sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+				auto tab = static_cast<source_vtab*>(sqlite3_malloc(sizeof(source_vtab)));
+				if(tab == nullptr) return SQLITE_NOMEM;
+				memset(tab, 0, sizeof(source_vtab));
+				tab->source = source;
+				*vtab = tab;
+				return SQLITE_OK;
+			}
+
+			int vtab_disconnect(sqlite3_vtab* vtab) {
+				sqlite3_free(vtab);
+				return SQLITE_OK;
+			}
+
+			int vtab_best_index(sqlite3_vtab* vtab, sqlite3_index_info* info) {
+				auto& source = *static_cast<source_vtab*>(vtab)->source;
+				auto rows = static_cast<double>(source.size(source.container));
+				info->estimatedCost = rows;
+				info->estimatedRows = static_cast<sqlite3_int64>(rows);
+				info->idxNum = 0;
+
+				// Use the sorted column with the most selective usable constraints
+				int best_column = -1;
+				int best_flags = 0;
+				int best_args[3] = { -1, -1, -1 };
+				for(size_t col = 0; col < source.columns.size(); col++) {
+					if(!source.columns[col].sorted) continue;
+					int flags = 0;
+					int args[3] = { -1, -1, -1 };
+					for(int i = 0; i < info->nConstraint; i++) {
+						auto& c = info->aConstraint[i];
+						if(!c.usable || c.iColumn != static_cast<int>(col)) continue;
+						// The container is sorted by binary comparison, e.g. name = 'x' COLLATE NOCASE also matches 'X'
+						auto collation = sqlite3_vtab_collation(info, i);
+						if(collation != nullptr && sqlite3_stricmp(collation, "BINARY") != 0) continue;
+						switch(c.op) {
+						case SQLITE_INDEX_CONSTRAINT_EQ: flags |= eq; args[0] = i; break;
+						case SQLITE_INDEX_CONSTRAINT_GT: flags = (flags & ~lower_inclusive) | lower; args[1] = i; break;
+						case SQLITE_INDEX_CONSTRAINT_GE: flags = (flags & ~lower) | lower_inclusive; args[1] = i; break;
+						case SQLITE_INDEX_CONSTRAINT_LT: flags = (flags & ~upper_inclusive) | upper; args[2] = i; break;
+						case SQLITE_INDEX_CONSTRAINT_LE: flags = (flags & ~upper) | upper_inclusive; args[2] = i; break;
+						default: break;
+						}
+					}
+					if(flags & eq) {
+						flags = eq;
+						args[1] = args[2] = -1;
+					}
+					auto score = [](int f) { return (f & eq) ? 3 : ((f & (lower | lower_inclusive)) ? 1 : 0) + ((f & (upper | upper_inclusive)) ? 1 : 0); };
+					if(flags != 0 && score(flags) > score(best_flags)) {
+						best_column = static_cast<int>(col);
+						best_flags = flags;
+						std::copy(std::begin(args), std::end(args), std::begin(best_args));
+					}
+				}
+				if(best_column >= 0) {
+					int argv = 1;
+					for(auto idx : best_args) {
+						if(idx < 0) continue;
+						// SQLite checks the constraint again, so the binary search only has to narrow the range
+						info->aConstraintUsage[idx].argvIndex = argv++;
+					}
+					info->idxNum = best_column | best_flags;
+					double log_rows = std::log2(rows + 1) + 1;
+					if(best_flags & eq) {
+						info->estimatedCost = log_rows;
+						info->estimatedRows = 1;
+					} else if((best_flags & (lower | lower_inclusive)) && (best_flags & (upper | upper_inclusive))) {
+						info->estimatedCost = log_rows + rows / 16;
+						info->estimatedRows = static_cast<sqlite3_int64>(rows / 16) + 1;
+					} else {
+						info->estimatedCost = log_rows + rows / 4;
+						info->estimatedRows = static_cast<sqlite3_int64>(rows / 4) + 1;
+					}
+				}
+				// Rows are returned in container order
+				if(info->nOrderBy == 1 && !info->aOrderBy[0].desc) {
+					auto col = info->aOrderBy[0].iColumn;
+					if(col >= 0 && static_cast<size_t>(col) < source.columns.size() && source.columns[col].sorted)
+						info->orderByConsumed = 1;
+				}
+				return SQLITE_OK;
+			}
+
+			int vtab_open(sqlite3_vtab*, sqlite3_vtab_cursor** cursor) {
+				auto cur = static_cast<source_cursor*>(sqlite3_malloc(sizeof(source_cursor)));
+				if(cur == nullptr) return SQLITE_NOMEM;
+				memset(cur, 0, sizeof(source_cursor));
+				*cursor = cur;
+				return SQLITE_OK;
+			}
+
+			int vtab_close(sqlite3_vtab_cursor* cursor) {
+				sqlite3_free(cursor);
+				return SQLITE_OK;
+			}
+
+			/**
+			 * Find the first index in [first, last) for which the column compares greater than (or equal to, if inclusive) val.
+			 * Returns false if val can not be compared to the column, the range must not be narrowed in that case.
+			 */
+			bool partition(const vtab_source& source, const vtab_column& col, size_t first, size_t last, sqlite3_value* val, bool inclusive, size_t& out) {
+				while(first < last) {
+					auto mid = first + (last - first) / 2;
+					int res = 0;
+					if(!col.compare(source.at(source.container, mid), col.accessor.get(), val, res)) return false;
+					if(res < 0 || (res == 0 && !inclusive)) first = mid + 1;
+					else last = mid;
+				}
+				out = first;
+				return true;
+			}
+
+			int vtab_filter(sqlite3_vtab_cursor* cur, int idx_num, const char*, int argc, sqlite3_value** argv) {
+				auto cursor = static_cast<source_cursor*>(cur);
+				auto& source = source_of(cur);
+				cursor->pos = 0;
+				cursor->end = source.size(source.container);
+				if(idx_num == 0) return SQLITE_OK;
+				auto& col = source.columns[idx_num & column_mask];
+				int arg = 0;
+				try {
+					if(idx_num & eq) {
+						if(arg >= argc) return SQLITE_OK;
+						if(partition(source, col, cursor->pos, cursor->end, argv[arg], true, cursor->pos))
+							partition(source, col, cursor->pos, cursor->end, argv[arg], false, cursor->end);
+						return SQLITE_OK;
+					}
+					if(idx_num & (lower | lower_inclusive)) {
+						if(arg >= argc) return SQLITE_OK;
+						partition(source, col, cursor->pos, cursor->end, argv[arg++], (idx_num & lower_inclusive) != 0, cursor->pos);
+					}
+					if(idx_num & (upper | upper_inclusive)) {
+						if(arg >= argc) return SQLITE_OK;
+						partition(source, col, cursor->pos, cursor->end, argv[arg], (idx_num & upper) != 0, cursor->end);
+					}
+				} catch(const std::exception& e) {
+					cur->pVtab->zErrMsg = sqlite3_mprintf("%s", e.what());
+					return SQLITE_ERROR;
+				}
+				return SQLITE_OK;
+			}
+
+			int vtab_next(sqlite3_vtab_cursor* cur) {
+				static_cast<source_cursor*>(cur)->pos++;
+				return SQLITE_OK;
+			}
+
+			int vtab_eof(sqlite3_vtab_cursor* cur) {
+				auto cursor = static_cast<source_cursor*>(cur);
+				return cursor->pos >= cursor->end;
+			}
+
+			int vtab_column(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int column) {
+				auto cursor = static_cast<source_cursor*>(cur);
+				auto& source = source_of(cur);
+				auto& col = source.columns[column];
+				try {
+					col.result(ctx, source.at(source.container, cursor->pos), col.accessor.get());
+				} catch(...) {
+					set_exception_result(ctx);
+				}
+				return SQLITE_OK;
+			}
+
+			int vtab_rowid(sqlite3_vtab_cursor* cur, sqlite3_int64* rowid) {
+				*rowid = static_cast<sqlite3_int64>(static_cast<source_cursor*>(cur)->pos);
+				return SQLITE_OK;
+			}
+
+			sqlite3_module make_module() {
+				sqlite3_module m{};
+				// xCreate is null, making it an eponymous-only table
+				m.xConnect = vtab_connect;
+				m.xBestIndex = vtab_best_index;
+				m.xDisconnect = vtab_disconnect;
+				m.xOpen = vtab_open;
+				m.xClose = vtab_close;
+				m.xFilter = vtab_filter;
+				m.xNext = vtab_next;
+				m.xEof = vtab_eof;
+				m.xColumn = vtab_column;
+				m.xRowid = vtab_rowid;
+				return m;
+			}
+		}
+
+		void register_vtab(database& db, const std::string& name, std::unique_ptr<vtab_source> src) {
+			static const sqlite3_module module = make_module();
+			// The source is owned by sqlite from here on and deleted when the module is replaced or the connection is closed
+			int res = sqlite3_create_module_v2(db.raw(), name.c_str(), &module, src.release(), [](void* ptr) {
+				delete static_cast<vtab_source*>(ptr);
+			});
+			throw_if_error(res, db.raw());
+		}
+	}
+}
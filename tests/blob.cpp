@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+#include "sqlitepp/blob.h"
+#include "sqlitepp/database.h"
+#include "sqlitepp/statement.h"
+
+#include <istream>
+#include <ostream>
+
+using namespace sqlitepp;
+
+TEST(SQLITEPP_Blob, Stream) {
+    database db;
+    db.exec("CREATE TABLE files (id INTEGER PRIMARY KEY, data BLOB);");
+    const size_t size = 1000 * 1000;
+    {
+        statement stmt(db, "INSERT INTO files (data) VALUES (?);");
+        stmt.bind(1, zeroblob{ size });
+        stmt.execute();
+        stmt.bind(1, zeroblob{ 16 });
+        stmt.execute();
+    }
+
+    blob_stream blob(db, "files", "data", 1, blob_stream::mode::read_write);
+    ASSERT_EQ(blob.size(), size);
+    // Self move assignment keeps the handle open
+    auto& self = blob;
+    blob = std::move(self);
+    ASSERT_NE(blob.raw(), nullptr);
+    {
+        blob_streambuf buf(std::move(blob), 4096);
+        std::ostream out(&buf);
+        for(size_t i = 0; i < size / 4; i++) out << static_cast<char>('a' + i % 26) << "xyz";
+        ASSERT_TRUE(out.good());
+        out << 'x';
+        out.flush();
+        // Blobs can not grow
+        ASSERT_FALSE(out.good());
+
+        std::istream in(&buf);
+        in.seekg(4 * 27);
+        std::string word(4, '\0');
+        in.read(&word[0], 4);
+        ASSERT_EQ(word, "bxyz");
+        in.seekg(-4, std::ios_base::end);
+        in.read(&word[0], 4);
+        ASSERT_EQ(word, "jxyz");
+        ASSERT_EQ(in.get(), std::char_traits<char>::eof());
+
+        auto& stream = buf.stream();
+        stream.reopen(2);
+        ASSERT_EQ(stream.size(), 16);
+        stream.seek(8);
+        stream.write("12345678", 8);
+        ASSERT_THROW(stream.write("9", 1), std::out_of_range);
+    }
+
+    statement check(db, "SELECT substr(data, 1, 4), substr(data, 9, 8), length(data) FROM files ORDER BY id;");
+    auto it = check.iterator();
+    ASSERT_TRUE(it.next());
+    ASSERT_EQ(it.column_string(0), "axyz");
+    ASSERT_EQ(it.column_int64(2), size);
+    ASSERT_TRUE(it.next());
+    ASSERT_EQ(it.column_string(1), "12345678");
+
+    ASSERT_THROW(blob_stream(db, "files", "missing", 1), std::system_error);
+}
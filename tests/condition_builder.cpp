@@ -162,4 +162,26 @@ TEST(SQLITEPP_ConditionBuilder, LessThanEqual) {
     ASSERT_EQ(p.query, "`t` <= ?");
     ASSERT_EQ(p.params.size(), 1);
     ASSERT_TRUE(std::holds_alternative<orm::db_integer_type>(p.params[0]));
-}
\ No newline at end of file
+}
+TEST(SQLITEPP_ConditionBuilder, NestedConditions) {
+    auto a = "a"_c == 1;
+    auto q = (a && "b"_c.between(2, 3)) || !a;
+    auto p = q.as_partial();
+    ASSERT_EQ(p.query, "((`a` = ?) AND (`b` BETWEEN ? AND ?)) OR ( NOT (`a` = ?))");
+    ASSERT_EQ(p.params.size(), 4);
+    ASSERT_EQ(std::get<orm::db_integer_type>(p.params[0]), 1);
+    ASSERT_EQ(std::get<orm::db_integer_type>(p.params[2]), 3);
+    ASSERT_EQ(std::get<orm::db_integer_type>(p.params[3]), 1);
+    // a is still usable after being combined
+    ASSERT_EQ(a.str(), "`a` = ?");
+    ASSERT_EQ(std::get<orm::db_integer_type>(a.rhs.params[0]), 1);
+}
+TEST(SQLITEPP_ConditionBuilder, CanonicalShape) {
+    auto q = ("a"_c == 1 && "b"_c.between(2, 3)) || !("a"_c == 1);
+    ASSERT_EQ(q.canonical(), "(`a` = ? AND (`b` BETWEEN ? AND ?)) OR (NOT `a` = ?)");
+    ASSERT_EQ(canonical_condition(" ( `a` = ? )\n AND  (`b` = 'x  y') ; "), "`a` = ? AND `b` = 'x  y'");
+    // Parameters do not change the shape, the structure does
+    ASSERT_EQ(("a"_c == 1 && "b"_c == 2).shape_hash(), ("a"_c == 5 && "b"_c == "x").shape_hash());
+    ASSERT_NE(("a"_c == 1 && "b"_c == 2).shape_hash(), ("a"_c == 1 || "b"_c == 2).shape_hash());
+    ASSERT_EQ(("a"_c == 1).as_partial().shape_hash(), shape_hash("`a` = ?"));
+}
@@ -1,8 +1,231 @@
 #include <gtest/gtest.h>
 #include "sqlitepp/database.h"
+#include "sqlitepp/error_code.h"
+#include "sqlitepp/function.h"
+#include "sqlitepp/statement.h"
+
+#include <memory>
+#include <optional>
 
 using namespace sqlitepp;
 
 TEST(SQLITEPP_Database, OpenMemory) {
     database db;
 }
+
+TEST(SQLITEPP_Database, StatementCache) {
+    database db;
+    db.exec("CREATE TABLE t (a INTEGER);");
+    db.set_statement_cache_size(4);
+    for(int i = 0; i < 3; i++) {
+        statement stmt(db, i % 2 ? "INSERT INTO t (a) VALUES (?);" : "INSERT INTO t (a)\n VALUES ( ? )");
+        stmt.bind(1, int64_t{i} + 1);
+        stmt.execute();
+    }
+    auto stats = db.get_statement_cache_stats();
+    ASSERT_EQ(stats.misses, 1);
+    ASSERT_EQ(stats.hits, 2);
+    ASSERT_EQ(stats.idle, 1);
+    {
+        // Bindings are cleared when a statement is returned to the cache
+        statement stmt(db, "INSERT INTO t (a) VALUES (?)");
+        stmt.execute();
+        statement count(db, "SELECT COUNT(*), COUNT(a) FROM t");
+        auto it = count.iterator();
+        ASSERT_TRUE(it.next());
+        ASSERT_EQ(it.column_int64(0), 4);
+        ASSERT_EQ(it.column_int64(1), 3);
+    }
+    db.set_statement_cache_size(0);
+    ASSERT_EQ(db.get_statement_cache_stats().idle, 0);
+
+    // Statements using a cached handle may outlive the database
+    auto other = std::make_unique<database>();
+    other->set_statement_cache_size(4);
+    { statement warm(*other, "SELECT 1;"); }
+    statement stmt(*other, "SELECT 1;");
+    ASSERT_EQ(other->get_statement_cache_stats().hits, 1);
+    other.reset();
+}
+
+namespace {
+    struct string_agg {
+        std::string value {};
+        void step(std::optional<std::string_view> str, std::optional<std::string> sep) {
+            if(!str) return;
+            if(!value.empty()) value += sep.value_or(",");
+            value += *str;
+        }
+        std::optional<std::string> result() const {
+            if(value.empty()) return std::nullopt;
+            return value;
+        }
+    };
+}
+
+TEST(SQLITEPP_Database, Functions) {
+    database db;
+    db.exec("CREATE TABLE t (a INTEGER, b TEXT);");
+    db.exec("INSERT INTO t VALUES (1, 'x'), (2, 'y'), (3, NULL);");
+    create_function(db, "twice", [](int64_t v) { return v * 2; }, function_flags::deterministic | function_flags::innocuous);
+    create_function(db, "label", [](std::optional<std::string> str, int64_t n) -> std::string {
+        if(n < 0) throw std::invalid_argument("negative");
+        return str.value_or("none") + std::to_string(n);
+    });
+    create_aggregate<string_agg>(db, "join_str", function_flags::deterministic);
+
+    // Deterministic functions can be used in indexes
+    db.exec("CREATE INDEX t_twice ON t (twice(a));");
+    statement stmt(db, "SELECT SUM(twice(a)), group_concat(label(b, a), ' '), join_str(b, NULL), join_str(b, '+') FROM t;");
+    auto it = stmt.iterator();
+    ASSERT_TRUE(it.next());
+    ASSERT_EQ(it.column_int64(0), 12);
+    ASSERT_EQ(it.column_string(1), "x1 y2 none3");
+    ASSERT_EQ(it.column_string(2), "x,y");
+    ASSERT_EQ(it.column_string(3), "x+y");
+
+    statement empty(db, "SELECT join_str(b, NULL) FROM t WHERE a > 10;");
+    auto it2 = empty.iterator();
+    ASSERT_TRUE(it2.next());
+    ASSERT_TRUE(it2.column_is_null(0));
+
+    statement error(db, "SELECT label(b, -1) FROM t;");
+    ASSERT_THROW(error.execute(), std::system_error);
+}
+
+namespace {
+    struct sum_squares {
+        double sum {};
+        batch_buffer<double, 4> pending {};
+
+        void add(const double* vals, size_t n) {
+            for(size_t i = 0; i < n; i++) sum += vals[i] * vals[i];
+        }
+        void step(double v) { pending.push(v, [this](const double* vals, size_t n) { add(vals, n); }); }
+        void inverse(double v) { sum -= v * v; }
+        double value() {
+            pending.flush([this](const double* vals, size_t n) { add(vals, n); });
+            return sum;
+        }
+    };
+}
+
+TEST(SQLITEPP_Database, WindowFunctions) {
+    database db;
+    db.exec("CREATE TABLE t (a REAL);");
+    db.exec("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 10) INSERT INTO t SELECT x FROM c;");
+    create_window_function<sum_squares>(db, "sum_squares", function_flags::deterministic);
+
+    statement stmt(db, "SELECT sum_squares(a) OVER (ORDER BY a ROWS BETWEEN 1 PRECEDING AND CURRENT ROW) FROM t ORDER BY a;");
+    auto it = stmt.iterator();
+    double prev = 0;
+    for(int i = 1; i <= 10; i++) {
+        ASSERT_TRUE(it.next());
+        ASSERT_DOUBLE_EQ(it.column_double(0), prev * prev + i * i);
+        prev = i;
+    }
+
+    statement total(db, "SELECT sum_squares(a) FROM t;");
+    auto it2 = total.iterator();
+    ASSERT_TRUE(it2.next());
+    ASSERT_DOUBLE_EQ(it2.column_double(0), 385.0);
+}
+
+TEST(SQLITEPP_Database, Deadlines) {
+    database db;
+    const std::string runaway = "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) SELECT MAX(x) FROM c;";
+
+    statement slow(db, runaway);
+    slow.with_timeout(std::chrono::milliseconds(50));
+    auto start = std::chrono::steady_clock::now();
+    try {
+        slow.execute();
+        FAIL() << "statement was not aborted";
+    } catch(const std::system_error& e) {
+        ASSERT_EQ(e.code(), make_error_code(error_code::timeout));
+    }
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+
+    // Other statements on the connection are not affected
+    statement fast(db, "SELECT 1;");
+    auto it = fast.iterator();
+    ASSERT_TRUE(it.next());
+
+    cancellation_token token;
+    int calls = 0;
+    create_function(db, "tick", [&](int64_t v) {
+        if(++calls == 100) token.cancel();
+        return v;
+    });
+    statement cancelled(db, "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT tick(x) + 1 FROM c) SELECT MAX(x) FROM c;");
+    cancelled.with_cancellation(&token);
+    try {
+        cancelled.execute();
+        FAIL() << "statement was not cancelled";
+    } catch(const std::system_error& e) {
+        ASSERT_EQ(e.code(), make_error_code(error_code::cancelled));
+    }
+    ASSERT_GE(calls, 100);
+}
+
+TEST(SQLITEPP_Database, ProgressHandler) {
+    database db;
+    const std::string query = "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 100000) SELECT MAX(x) FROM c;";
+    int calls = 0;
+    db.set_progress_handler(100, [&]() {
+        calls++;
+        return false;
+    });
+    db.exec(query);
+    ASSERT_GT(calls, 0);
+
+    // Limits chain to the handler and restore it afterwards
+    calls = 0;
+    statement limited(db, query);
+    limited.with_timeout(std::chrono::seconds(60));
+    limited.execute();
+    ASSERT_GT(calls, 0);
+    calls = 0;
+    db.exec(query);
+    ASSERT_GT(calls, 0);
+
+    db.set_progress_handler(100, []() { return true; });
+    try {
+        limited.execute();
+        FAIL() << "statement was not interrupted";
+    } catch(const std::system_error& e) {
+        ASSERT_EQ(e.code(), make_error_code(error_code::interrupt));
+    }
+    ASSERT_THROW(db.set_progress_handler(0, []() { return false; }), std::invalid_argument);
+    db.set_progress_handler(0, nullptr);
+    db.exec(query);
+}
+
+TEST(SQLITEPP_Database, TryExecute) {
+    database db;
+    db.exec("CREATE TABLE t (id INTEGER PRIMARY KEY, v TEXT NOT NULL);");
+    statement insert(db, "INSERT INTO t (id, v) VALUES (?, ?);");
+    ASSERT_FALSE(insert.try_bind(1, 1));
+    ASSERT_FALSE(insert.try_bind(2, "a"));
+    ASSERT_FALSE(insert.try_execute());
+
+    // The statement is reset and can be retried after an error
+    auto ec = insert.try_execute();
+    ASSERT_EQ(ec, error_code::constraint_primarykey);
+    ASSERT_FALSE(insert.try_bind(1, 2));
+    ASSERT_FALSE(insert.try_execute());
+    ASSERT_EQ(insert.try_bind(3, 1), error_code::range);
+    ASSERT_THROW(insert.bind(3, 1), std::system_error);
+
+    statement slow(db, "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) SELECT MAX(x) FROM c;");
+    slow.with_deadline(std::chrono::steady_clock::now());
+    auto it = slow.iterator();
+    ASSERT_FALSE(it.try_next(ec));
+    ASSERT_EQ(ec, error_code::timeout);
+
+    statement count(db, "SELECT COUNT(*) FROM t;");
+    auto it2 = count.iterator();
+    ASSERT_TRUE(it2.try_next(ec));
+    ASSERT_FALSE(ec);
+    ASSERT_EQ(it2.column_int64(0), 2);
+}
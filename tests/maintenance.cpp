@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+#include "sqlitepp/database.h"
+#include "sqlitepp/maintenance.h"
+#include "sqlitepp/statement.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+
+using namespace sqlitepp;
+
+TEST(SQLITEPP_Maintenance, Checkpoint) {
+    auto path = (std::filesystem::temp_directory_path() / "sqlitepp_maintenance.db").string();
+    std::remove(path.c_str());
+    {
+        database db(path);
+        db.exec("PRAGMA journal_mode = WAL;");
+        db.exec("CREATE TABLE t (id INTEGER PRIMARY KEY, v TEXT);");
+        db.exec("CREATE INDEX t_v ON t (v);");
+
+        maintenance_options options;
+        options.interval = std::chrono::milliseconds(10);
+        options.passive_frames = 10;
+        options.restart_frames = 100;
+        options.truncate_frames = 100000;
+        options.idle_time = std::chrono::milliseconds(50);
+        maintenance service(path, options);
+        service.attach(db);
+
+        statement autocheckpoint(db, "PRAGMA wal_autocheckpoint;");
+        auto it = autocheckpoint.iterator();
+        ASSERT_TRUE(it.next());
+        ASSERT_EQ(it.column_int64(0), 0);
+
+        statement insert(db, "INSERT INTO t (v) VALUES (?);");
+        for(int i = 0; i < 200; i++) {
+            insert.bind(1, std::string(1000, 'a' + i % 26));
+            insert.execute();
+        }
+
+        // Wait for the quiet period
+        auto start = std::chrono::steady_clock::now();
+        while(service.stats().truncate == 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        auto stats = service.stats();
+        ASSERT_GT(stats.passive, 0);
+        ASSERT_GT(stats.truncate, 0);
+        ASSERT_EQ(stats.optimize, 1);
+        ASSERT_EQ(stats.errors, 0);
+        ASSERT_EQ(std::filesystem::file_size(path + "-wal"), 0);
+
+        statement count(db, "SELECT COUNT(*) FROM t;");
+        auto it2 = count.iterator();
+        ASSERT_TRUE(it2.next());
+        ASSERT_EQ(it2.column_int64(0), 200);
+
+        // PRAGMA optimize (or ANALYZE before SQLite 3.46) analyzed the tables written by the other connection
+        statement analyzed(db, "SELECT COUNT(*) FROM sqlite_stat1 WHERE tbl = 't';");
+        auto it3 = analyzed.iterator();
+        ASSERT_TRUE(it3.next());
+        ASSERT_GT(it3.column_int64(0), 0);
+    }
+    ASSERT_THROW(maintenance(path, maintenance_options{ std::chrono::milliseconds(10), 100, 10, 1000 }), std::invalid_argument);
+    std::remove(path.c_str());
+    std::remove((path + "-wal").c_str());
+    std::remove((path + "-shm").c_str());
+}
@@ -1,9 +1,11 @@
 #include <gtest/gtest.h>
 #include "../include/sqlitepp/database.h"
 #include "../include/sqlitepp/orm.h"
+#include "../include/sqlitepp/transaction.h"
 
 using namespace sqlitepp;
 using namespace sqlitepp::orm;
+using namespace sqlitepp::literals;
 
 struct my_entity : orm::entity {
     enum class e_test {
@@ -93,3 +95,380 @@ TEST(SQLITEPP_ORM, IsModified) {
     ASSERT_TRUE(e.test_optional.has_value());
     ASSERT_EQ(e.test_optional.value(), 1337);
 }
+
+TEST(SQLITEPP_ORM, SelectIntoArena) {
+    database db;
+    db.exec(generate_create_table(my_entity::_class_info));
+    for(int64_t i = 0; i < 100; i++) {
+        my_entity e(db);
+        e.test_optional = i;
+        e.save();
+    }
+
+    entity_arena arena(1024);
+    ASSERT_EQ(select_multiple<my_entity>(db, arena, "t"_c == my_entity::e_test::hello), 100);
+    ASSERT_EQ(arena.size(), 100);
+    for(size_t i = 0; i < arena.size(); i++) {
+        auto& e = arena.at<my_entity>(i);
+        ASSERT_EQ(e.test_optional, static_cast<int64_t>(i));
+        ASSERT_FALSE(e.is_modified());
+    }
+    arena.at<my_entity>(10).test_optional = 1337;
+    arena.at<my_entity>(10).save();
+    arena.clear();
+    ASSERT_TRUE(arena.empty());
+    ASSERT_EQ(count(db, my_entity::_class_info, "test_optional"_c == 1337), 1);
+}
+
+struct hashed_entity : orm::entity {
+    std::string name {};
+    std::vector<uint8_t> data {};
+
+    using entity::entity;
+
+    static const orm::class_info _class_info;
+    const orm::class_info& get_class_info() const noexcept override { return _class_info; }
+};
+
+const orm::class_info hashed_entity::_class_info = orm::builder<hashed_entity>("hashed", { orm::snapshot(orm::snapshot_policy::hash, 8) })
+    .field("name", &hashed_entity::name)
+    .field("data", &hashed_entity::data)
+    .build();
+
+TEST(SQLITEPP_ORM, HashSnapshot) {
+    database db;
+    db.exec(generate_create_table(hashed_entity::_class_info));
+    hashed_entity e(db);
+    e.name = "short";
+    e.data.assign(1024, 0x42);
+    e.save();
+    ASSERT_FALSE(e.is_modified());
+
+    e.data[512] = 0x00;
+    e.name = "changed";
+    ASSERT_TRUE(e.is_modified());
+    // data is larger than the inline limit and needs to be reloaded
+    e.reset();
+    ASSERT_FALSE(e.is_modified());
+    ASSERT_EQ(e.name, "short");
+    ASSERT_EQ(e.data[512], 0x42);
+
+    e.name = "changed";
+    e.save();
+    ASSERT_FALSE(e.is_modified());
+    auto loaded = select_one<hashed_entity>(db);
+    ASSERT_NE(loaded, nullptr);
+    ASSERT_EQ(loaded->name, "changed");
+    ASSERT_EQ(loaded->data, e.data);
+}
+
+struct document_entity : orm::entity {
+    int64_t status {};
+    std::optional<std::string> title {};
+    std::vector<uint8_t> content {};
+
+    using entity::entity;
+
+    static const orm::class_info _class_info;
+    const orm::class_info& get_class_info() const noexcept override { return _class_info; }
+};
+
+const orm::class_info document_entity::_class_info = orm::builder<document_entity>("document")
+    .field("status", &document_entity::status)
+    .field("title", &document_entity::title)
+    .field("content", &document_entity::content, { orm::lazy() })
+    .build();
+
+TEST(SQLITEPP_ORM, LazyField) {
+    database db;
+    db.exec(generate_create_table(document_entity::_class_info));
+    for(int64_t i = 0; i < 10; i++) {
+        document_entity e(db);
+        e.status = i;
+        e.content.assign(100, static_cast<uint8_t>(i));
+        e.save();
+    }
+
+    auto docs = select_multiple<document_entity>(db);
+    ASSERT_EQ(docs.size(), 10);
+    ASSERT_FALSE(docs[0]->title.has_value());
+    ASSERT_FALSE(docs[0]->is_loaded("content"));
+    ASSERT_TRUE(docs[0]->content.empty());
+    ASSERT_FALSE(docs[0]->is_modified());
+
+    // Saving an entity with an unloaded field must not clear the column
+    docs[0]->status = 100;
+    docs[0]->save();
+    docs[0]->load("content");
+    ASSERT_TRUE(docs[0]->is_loaded("content"));
+    ASSERT_EQ(docs[0]->content.size(), 100);
+
+    load_lazy(db, docs, 4);
+    for(auto& e : docs) {
+        ASSERT_TRUE(e->is_loaded("content"));
+        ASSERT_EQ(e->content, std::vector<uint8_t>(100, static_cast<uint8_t>(e == docs[0] ? 0 : e->status)));
+        ASSERT_FALSE(e->is_modified());
+    }
+}
+
+TEST(SQLITEPP_ORM, IdentityMap) {
+    database db;
+    db.set_identity_map(std::make_shared<identity_map>(16));
+    db.exec(generate_create_table(my_entity::_class_info));
+    my_entity e(db);
+    e.test_optional = 10;
+    e.save();
+
+    auto first = select_one_shared<my_entity>(db, "test_optional"_c == 10);
+    auto second = find<my_entity>(db, 1);
+    ASSERT_NE(first, nullptr);
+    ASSERT_EQ(first, second);
+
+    // Writes through the cached entity keep it cached
+    first->t = my_entity::e_test::hello2;
+    first->save();
+    ASSERT_EQ(find<my_entity>(db, 1), first);
+
+    // Writes from elsewhere evict it
+    db.exec("UPDATE e SET test_optional = 20;");
+    auto third = find<my_entity>(db, 1);
+    ASSERT_NE(third, first);
+    ASSERT_EQ(third->test_optional, 20);
+    ASSERT_EQ(third->t, my_entity::e_test::hello2);
+
+    remove(db, my_entity::_class_info);
+    ASSERT_EQ(find<my_entity>(db, 1), nullptr);
+}
+
+TEST(SQLITEPP_ORM, IdentityMapRollback) {
+    database db;
+    db.set_identity_map(std::make_shared<identity_map>(16));
+    db.exec(generate_create_table(my_entity::_class_info));
+    my_entity e(db);
+    e.test_optional = 10;
+    e.save();
+
+    auto first = find<my_entity>(db, 1);
+    ASSERT_NE(first, nullptr);
+    {
+        transaction tx(db);
+        first->test_optional = 20;
+        first->save();
+        ASSERT_EQ(find<my_entity>(db, 1), first);
+    }
+    // The rolled back value is not served from the map anymore
+    auto second = find<my_entity>(db, 1);
+    ASSERT_NE(second, first);
+    ASSERT_EQ(second->test_optional, 10);
+}
+
+struct keyed_entity : orm::entity {
+    std::string external_id {};
+    std::string name {};
+    int64_t version {};
+
+    using entity::entity;
+
+    static const orm::class_info _class_info;
+    const orm::class_info& get_class_info() const noexcept override { return _class_info; }
+};
+
+const orm::class_info keyed_entity::_class_info = orm::builder<keyed_entity>("keyed")
+    .field("external_id", &keyed_entity::external_id, { orm::unique_id() })
+    .field("name", &keyed_entity::name)
+    .field("version", &keyed_entity::version)
+    .build();
+
+TEST(SQLITEPP_ORM, Upsert) {
+    database db;
+    db.exec(generate_create_table(keyed_entity::_class_info));
+    keyed_entity e(db);
+    e.external_id = "ext-1";
+    e.name = "first";
+    e.upsert();
+    ASSERT_FALSE(e.is_modified());
+
+    keyed_entity e2(db);
+    e2.external_id = "ext-1";
+    e2.name = "second";
+    e2.version = 2;
+    e2.upsert();
+    ASSERT_EQ(count(db, keyed_entity::_class_info), 1);
+    // The conflicting upsert updated the row stored by e
+    e.refresh();
+    ASSERT_EQ(e.name, "second");
+
+    std::vector<std::unique_ptr<keyed_entity>> batch;
+    for(int i = 0; i < 10; i++) {
+        batch.emplace_back(std::make_unique<keyed_entity>(db));
+        batch.back()->external_id = "ext-" + std::to_string(i % 5);
+        batch.back()->version = i;
+    }
+    upsert(db, batch);
+    ASSERT_EQ(count(db, keyed_entity::_class_info), 5);
+    auto stored = select_one<keyed_entity>(db, "external_id"_c == "ext-3");
+    ASSERT_EQ(stored->version, 8);
+    ASSERT_FALSE(batch[8]->is_modified());
+    batch[8]->version = 100;
+    batch[8]->save();
+    stored->refresh();
+    ASSERT_EQ(stored->version, 100);
+}
+
+TEST(SQLITEPP_ORM, NullInNonOptionalField) {
+    database db;
+    // E.g. a legacy schema or a column added without default
+    db.exec("CREATE TABLE keyed (external_id TEXT UNIQUE, name TEXT, version INTEGER);");
+    db.exec("INSERT INTO keyed (external_id) VALUES ('ext-1');");
+
+    auto e = select_one<keyed_entity>(db, "external_id"_c == "ext-1");
+    ASSERT_NE(e, nullptr);
+    ASSERT_EQ(e->name, "");
+    ASSERT_EQ(e->version, 0);
+    ASSERT_FALSE(e->is_modified());
+
+    // Setters of non optional members read NULL as the default value as well
+    e->name = "name";
+    keyed_entity::_class_info.get_field_by_name("name")->setter(e.get(), db_value{db_null_type{}});
+    ASSERT_EQ(e->name, "");
+}
+
+TEST(SQLITEPP_ORM, UpsertRollback) {
+    database db;
+    db.exec(generate_create_table(keyed_entity::_class_info));
+    db.exec("CREATE TRIGGER keyed_check BEFORE INSERT ON keyed WHEN NEW.version < 0 BEGIN SELECT RAISE(ABORT, 'negative version'); END;");
+
+    std::vector<std::unique_ptr<keyed_entity>> batch;
+    for(int i = 0; i < 2; i++) {
+        batch.emplace_back(std::make_unique<keyed_entity>(db));
+        batch.back()->external_id = "ext-" + std::to_string(i);
+        batch.back()->version = i == 0 ? 1 : -1;
+    }
+    ASSERT_THROW(upsert(db, batch), std::system_error);
+    ASSERT_EQ(count(db, keyed_entity::_class_info), 0);
+
+    // The first row was rolled back, so the entity has to be inserted again
+    ASSERT_TRUE(batch[0]->is_modified());
+    batch[0]->save();
+    ASSERT_EQ(count(db, keyed_entity::_class_info), 1);
+}
+
+struct lazy_keyed_entity : orm::entity {
+    std::string external_id {};
+    int64_t version {};
+    std::string body {};
+
+    using entity::entity;
+
+    static const orm::class_info _class_info;
+    const orm::class_info& get_class_info() const noexcept override { return _class_info; }
+};
+
+const orm::class_info lazy_keyed_entity::_class_info = orm::builder<lazy_keyed_entity>("lazy_keyed")
+    .field("external_id", &lazy_keyed_entity::external_id, { orm::unique_id() })
+    .field("version", &lazy_keyed_entity::version)
+    .field("body", &lazy_keyed_entity::body, { orm::lazy() })
+    .build();
+
+TEST(SQLITEPP_ORM, UpsertLazyField) {
+    database db;
+    db.exec(generate_create_table(lazy_keyed_entity::_class_info));
+    for(int i = 0; i < 2; i++) {
+        lazy_keyed_entity e(db);
+        e.external_id = "ext-" + std::to_string(i);
+        e.body = "body" + std::to_string(i);
+        e.save();
+    }
+
+    // Unloaded fields keep their stored value
+    auto first = select_one<lazy_keyed_entity>(db, "external_id"_c == "ext-0");
+    ASSERT_FALSE(first->is_loaded("body"));
+    first->version = 1;
+    first->upsert();
+    ASSERT_EQ(first->body, "body0");
+    auto stored = select_one<lazy_keyed_entity>(db, "external_id"_c == "ext-0");
+    stored->load();
+    ASSERT_EQ(stored->version, 1);
+    ASSERT_EQ(stored->body, "body0");
+
+    // Unloaded fields changed before the upsert are written
+    auto second = select_one<lazy_keyed_entity>(db, "external_id"_c == "ext-1");
+    second->body = "changed";
+    second->upsert();
+    stored = select_one<lazy_keyed_entity>(db, "external_id"_c == "ext-1");
+    stored->load();
+    ASSERT_EQ(stored->body, "changed");
+}
+
+struct setting_entity : orm::entity {
+    std::string tenant {};
+    std::string key {};
+    std::string value {};
+    int64_t revision {};
+
+    using entity::entity;
+
+    static const orm::class_info _class_info;
+    const orm::class_info& get_class_info() const noexcept override { return _class_info; }
+};
+
+const orm::class_info setting_entity::_class_info = orm::builder<setting_entity>("setting", {
+        orm::without_rowid(),
+        orm::index("setting_revision", { "tenant", "revision" }),
+        orm::unique_index("setting_value", { "lower(`value`)" }, "`revision` > 0")
+    })
+    .field("tenant", &setting_entity::tenant, { orm::primary_key() })
+    .field("key", &setting_entity::key, { orm::primary_key() })
+    .field("value", &setting_entity::value)
+    .field("revision", &setting_entity::revision)
+    .build();
+
+TEST(SQLITEPP_ORM, IndexesAndWithoutRowid) {
+    auto indexes = generate_create_indexes(setting_entity::_class_info);
+    ASSERT_EQ(indexes, "CREATE INDEX `setting_revision` ON `setting` (`tenant`, `revision`);\n"
+        "CREATE UNIQUE INDEX `setting_value` ON `setting` (lower(`value`)) WHERE `revision` > 0;");
+
+    database db;
+    auto create = generate_create_table(setting_entity::_class_info);
+    ASSERT_NE(create.find(") WITHOUT ROWID;"), std::string::npos);
+    db.exec(create);
+    db.exec(indexes);
+    statement stmt(db, "SELECT COUNT(*) FROM sqlite_master WHERE type = 'index' AND tbl_name = 'setting';");
+    auto it = stmt.iterator();
+    ASSERT_TRUE(it.next());
+    ASSERT_EQ(it.column_int64(0), 2);
+
+    setting_entity s(db);
+    s.tenant = "a";
+    s.key = "theme";
+    s.value = "dark";
+    s.save();
+    setting_entity s2(db);
+    s2.tenant = "b";
+    s2.key = "theme";
+    s2.value = "light";
+    s2.save();
+
+    auto loaded = select_one<setting_entity>(db, "tenant"_c == "b");
+    ASSERT_EQ(loaded->value, "light");
+    // Changing the primary key updates the row stored under the old key
+    loaded->key = "color";
+    loaded->revision = 1;
+    loaded->save();
+    loaded->value = "blue";
+    loaded->save();
+    loaded->refresh();
+    ASSERT_EQ(loaded->key, "color");
+    ASSERT_EQ(loaded->value, "blue");
+    ASSERT_EQ(count(db, setting_entity::_class_info, "key"_c == "theme"), 1);
+
+    auto projected = orm::select_multiple(db, setting_entity::_class_info, select_options{ { 3 } });
+    ASSERT_EQ(projected.size(), 2);
+    projected[0]->load();
+    ASSERT_FALSE(static_cast<setting_entity&>(*projected[0]).value.empty());
+
+    s.value = "light";
+    s.upsert();
+    s.remove();
+    ASSERT_EQ(count(db, setting_entity::_class_info), 1);
+}
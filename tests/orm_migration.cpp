@@ -0,0 +1,197 @@
+#include <gtest/gtest.h>
+#include "../include/sqlitepp/database.h"
+#include "../include/sqlitepp/orm.h"
+#include "../include/sqlitepp/orm_migration.h"
+
+using namespace sqlitepp;
+using namespace sqlitepp::orm;
+using namespace sqlitepp::literals;
+
+struct item_v1 : orm::entity {
+    int64_t id {};
+    std::string name {};
+    int64_t quantity {};
+
+    using entity::entity;
+
+    static const orm::class_info _class_info;
+    const orm::class_info& get_class_info() const noexcept override { return _class_info; }
+};
+
+const orm::class_info item_v1::_class_info = orm::builder<item_v1>("item")
+    .field("id", &item_v1::id, { orm::row_id() })
+    .field("name", &item_v1::name)
+    .field("quantity", &item_v1::quantity)
+    .build();
+
+struct item_v2 : orm::entity {
+    int64_t id {};
+    std::string name {};
+    int64_t quantity {};
+    std::optional<std::string> note {};
+
+    using entity::entity;
+
+    static const orm::class_info _class_info;
+    const orm::class_info& get_class_info() const noexcept override { return _class_info; }
+};
+
+const orm::class_info item_v2::_class_info = orm::builder<item_v2>("item", { orm::index("item_name", { "name" }) })
+    .field("id", &item_v2::id, { orm::row_id() })
+    .field("name", &item_v2::name)
+    .field("quantity", &item_v2::quantity)
+    .field("note", &item_v2::note)
+    .build();
+
+struct item_v3 : orm::entity {
+    int64_t id {};
+    std::string name {};
+    double quantity {};
+    int64_t version {};
+
+    using entity::entity;
+
+    static const orm::class_info _class_info;
+    const orm::class_info& get_class_info() const noexcept override { return _class_info; }
+};
+
+const orm::class_info item_v3::_class_info = orm::builder<item_v3>("item", { orm::index("item_name", { "name" }) })
+    .field("id", &item_v3::id, { orm::row_id() })
+    .field("name", &item_v3::name, { orm::unique_id() })
+    .field("quantity", &item_v3::quantity)
+    .field("version", &item_v3::version, { orm::default_value(int64_t{1}) })
+    .build();
+
+TEST(SQLITEPP_ORMMigration, CreateAndAlter) {
+    database db;
+    auto plan = migrate(db, item_v1::_class_info);
+    ASSERT_EQ(plan.kind, migration_plan::action::create);
+    ASSERT_EQ(plan_migration(db, item_v1::_class_info).kind, migration_plan::action::none);
+
+    item_v1 i(db);
+    i.name = "first";
+    i.save();
+
+    plan = migrate(db, item_v2::_class_info);
+    ASSERT_EQ(plan.kind, migration_plan::action::alter);
+    ASSERT_EQ(plan.changes, std::vector<std::string>({ "add column note", "create index item_name" }));
+    ASSERT_EQ(plan_migration(db, item_v2::_class_info).kind, migration_plan::action::none);
+
+    auto loaded = select_one<item_v2>(db, "name"_c == "first");
+    ASSERT_FALSE(loaded->note.has_value());
+}
+
+TEST(SQLITEPP_ORMMigration, Rebuild) {
+    database db;
+    migrate(db, item_v2::_class_info);
+    for(int i = 0; i < 50; i++) {
+        item_v2 e(db);
+        e.name = "item" + std::to_string(i);
+        e.quantity = i;
+        e.save();
+    }
+
+    auto plan = plan_migration(db, item_v3::_class_info);
+    ASSERT_EQ(plan.kind, migration_plan::action::rebuild);
+
+    migration_options options;
+    options.batch_size = 16;
+    std::vector<int64_t> copied;
+    options.progress = [&](const migration_progress& p) {
+        if(p.current != migration_progress::phase::copy) return;
+        copied.push_back(p.rows_copied);
+        if(copied.size() == 1) {
+            // Writes between batches, to rows already copied and not yet copied
+            db.exec("UPDATE `item` SET `quantity` = 100 WHERE `id` = 1;");
+            db.exec("DELETE FROM `item` WHERE `id` = 40;");
+            db.exec("UPDATE `item` SET `quantity` = 200 WHERE `id` = 30;");
+            db.exec("INSERT INTO `item` (`name`, `quantity`) VALUES ('late', 7);");
+        }
+    };
+    migrate(db, item_v3::_class_info, options);
+    ASSERT_EQ(copied.size(), 4);
+    ASSERT_EQ(plan_migration(db, item_v3::_class_info).kind, migration_plan::action::none);
+
+    ASSERT_EQ(count(db, item_v3::_class_info), 50);
+    auto first = select_one<item_v3>(db, "id"_c == 1);
+    ASSERT_EQ(first->quantity, 100.0);
+    ASSERT_EQ(first->version, 1);
+    ASSERT_EQ(count(db, item_v3::_class_info, "id"_c == 40), 0);
+    ASSERT_EQ(select_one<item_v3>(db, "id"_c == 30)->quantity, 200.0);
+    auto late = select_one<item_v3>(db, "name"_c == "late");
+    ASSERT_EQ(late->id, 51);
+    ASSERT_EQ(late->quantity, 7.0);
+}
+
+TEST(SQLITEPP_ORMMigration, RebuildConstraintViolation) {
+    database db;
+    migrate(db, item_v2::_class_info);
+    for(int i = 0; i < 10; i++) {
+        item_v2 e(db);
+        e.name = i < 2 ? "duplicate" : "item" + std::to_string(i);
+        e.save();
+    }
+
+    // The new UNIQUE constraint on name can not hold, no row may be dropped silently
+    migration_options options;
+    options.batch_size = 4;
+    ASSERT_THROW(migrate(db, item_v3::_class_info, options), std::system_error);
+    ASSERT_EQ(count(db, item_v2::_class_info), 10);
+    ASSERT_EQ(count(db, item_v2::_class_info, "name"_c == "duplicate"), 2);
+    ASSERT_EQ(plan_migration(db, item_v3::_class_info).kind, migration_plan::action::rebuild);
+
+    // Once the data is fixed the migration succeeds
+    db.exec("UPDATE `item` SET `name` = 'unique' WHERE `id` = 2;");
+    migrate(db, item_v3::_class_info, options);
+    ASSERT_EQ(count(db, item_v3::_class_info), 10);
+}
+
+struct stock : orm::entity {
+    std::string region {};
+    int64_t code {};
+    double quantity {};
+
+    using entity::entity;
+
+    static const orm::class_info _class_info;
+    const orm::class_info& get_class_info() const noexcept override { return _class_info; }
+};
+
+const orm::class_info stock::_class_info = orm::builder<stock>("stock", { orm::without_rowid() })
+    .field("region", &stock::region, { orm::primary_key() })
+    .field("code", &stock::code, { orm::primary_key() })
+    .field("quantity", &stock::quantity)
+    .build();
+
+TEST(SQLITEPP_ORMMigration, RebuildWithoutRowid) {
+    database db;
+    db.exec("CREATE TABLE `stock` (`region` TEXT NOT NULL, `code` INTEGER NOT NULL, `quantity` INTEGER NOT NULL, PRIMARY KEY(`region`, `code`)) WITHOUT ROWID;");
+    for(int i = 0; i < 50; i++) {
+        db.exec("INSERT INTO `stock` VALUES ('" + std::string(i % 2 ? "east" : "west") + "', " + std::to_string(i) + ", " + std::to_string(i) + ");");
+    }
+    ASSERT_EQ(plan_migration(db, stock::_class_info).kind, migration_plan::action::rebuild);
+
+    // Copied in batches by primary key instead of a single transaction
+    migration_options options;
+    options.batch_size = 16;
+    std::vector<int64_t> copied;
+    options.progress = [&](const migration_progress& p) {
+        if(p.current != migration_progress::phase::copy) return;
+        copied.push_back(p.rows_copied);
+        if(copied.size() == 1) {
+            db.exec("UPDATE `stock` SET `quantity` = 100 WHERE `region` = 'east' AND `code` = 1;");
+            db.exec("DELETE FROM `stock` WHERE `region` = 'west' AND `code` = 48;");
+            db.exec("INSERT INTO `stock` VALUES ('north', 1, 7);");
+        }
+    };
+    migrate(db, stock::_class_info, options);
+    ASSERT_EQ(copied.size(), 4);
+    ASSERT_EQ(copied.back(), 49);
+    ASSERT_EQ(plan_migration(db, stock::_class_info).kind, migration_plan::action::none);
+
+    ASSERT_EQ(count(db, stock::_class_info), 50);
+    ASSERT_EQ(select_one<stock>(db, "region"_c == "east" && "code"_c == 1)->quantity, 100.0);
+    ASSERT_EQ(count(db, stock::_class_info, "code"_c == 48), 0);
+    ASSERT_EQ(select_one<stock>(db, "region"_c == "north")->quantity, 7.0);
+    ASSERT_EQ(select_one<stock>(db, "region"_c == "west" && "code"_c == 46)->quantity, 46.0);
+}
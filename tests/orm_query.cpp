@@ -0,0 +1,299 @@
+#include <gtest/gtest.h>
+#include "../include/sqlitepp/database.h"
+#include "../include/sqlitepp/orm_query.h"
+
+using namespace sqlitepp;
+using namespace sqlitepp::orm;
+using namespace sqlitepp::literals;
+
+struct account : orm::entity {
+    int64_t id {};
+    std::string name {};
+    int64_t status {};
+    double balance {};
+
+    using entity::entity;
+
+    static const orm::class_info _class_info;
+    const orm::class_info& get_class_info() const noexcept override { return _class_info; }
+};
+
+const orm::class_info account::_class_info = orm::builder<account>("account")
+    .field("id", &account::id, { orm::row_id() })
+    .field("name", &account::name)
+    .field("status", &account::status)
+    .field("balance", &account::balance)
+    .build();
+
+static void fill_accounts(database& db, size_t n) {
+    db.exec(generate_create_table(account::_class_info));
+    for(size_t i = 0; i < n; i++) {
+        account a(db);
+        a.name = "account" + std::to_string(i);
+        a.status = i % 3;
+        a.balance = i * 10.0;
+        a.save();
+    }
+}
+
+TEST(SQLITEPP_ORMQuery, FieldIndexes) {
+    auto idx = account::_class_info.get_field_indexes(&account::status);
+    ASSERT_EQ(idx.size(), 1);
+    ASSERT_EQ(idx[0], 2);
+    idx = account::_class_info.get_field_indexes(&account::id);
+    ASSERT_EQ(idx.size(), 1);
+    ASSERT_EQ(idx[0], 0);
+}
+
+TEST(SQLITEPP_ORMQuery, Projection) {
+    database db;
+    fill_accounts(db, 10);
+
+    auto res = orm::select<account>(db).fields(&account::name, &account::status).where("status"_c == 1).all();
+    ASSERT_EQ(res.size(), 3);
+    for(auto& e : res) {
+        ASSERT_EQ(e->status, 1);
+        ASSERT_TRUE(e->is_loaded("name"));
+        ASSERT_FALSE(e->is_loaded("balance"));
+        ASSERT_EQ(e->balance, 0.0);
+    }
+    res[0]->status = 2;
+    res[0]->save();
+    res[0]->load();
+    ASSERT_EQ(res[0]->balance, 10.0);
+
+    auto rows = orm::select<account>(db).fields(&account::name, &account::status).where("status"_c == 2).tuples<std::string, int64_t>();
+    ASSERT_EQ(rows.size(), 4);
+    ASSERT_EQ(std::get<0>(rows[0]), "account1");
+    ASSERT_EQ(std::get<1>(rows[0]), 2);
+}
+
+TEST(SQLITEPP_ORMQuery, ProjectionIdentityMap) {
+    database db;
+    fill_accounts(db, 10);
+    db.set_identity_map(std::make_shared<identity_map>());
+
+    auto partial = orm::select<account>(db).fields(&account::status).where("status"_c == 1).all_shared();
+    ASSERT_EQ(partial.size(), 3);
+    // The rowid alias is filled from _rowid_ even if it is not selected
+    ASSERT_EQ(partial[0]->id, 2);
+    ASSERT_TRUE(partial[0]->is_loaded("id"));
+    ASSERT_FALSE(partial[0]->is_loaded("name"));
+
+    // Full queries fill the missing fields of cached entities
+    auto full = orm::select<account>(db).where("status"_c == 1).all_shared();
+    ASSERT_EQ(full.size(), 3);
+    ASSERT_EQ(full[0], partial[0]);
+    ASSERT_EQ(full[0]->name, "account1");
+    ASSERT_EQ(full[0]->balance, 10.0);
+    ASSERT_FALSE(full[0]->is_modified());
+
+    partial = orm::select<account>(db).fields(&account::status).where("status"_c == 2).all_shared();
+    auto found = orm::find<account>(db, 3);
+    ASSERT_EQ(found, partial[0]);
+    ASSERT_EQ(found->name, "account2");
+    ASSERT_EQ(found->balance, 20.0);
+}
+
+struct purchase : orm::entity {
+    int64_t account_id {};
+    int64_t amount {};
+
+    using entity::entity;
+
+    static const orm::class_info _class_info;
+    const orm::class_info& get_class_info() const noexcept override { return _class_info; }
+};
+
+const orm::class_info purchase::_class_info = orm::builder<purchase>("purchase")
+    .field("account_id", &purchase::account_id, { orm::fk("account", "id", fk_action::cascade, fk_action::cascade) })
+    .field("amount", &purchase::amount)
+    .build();
+
+TEST(SQLITEPP_ORMQuery, EagerLoading) {
+    database db;
+    fill_accounts(db, 5);
+    db.exec(generate_create_table(purchase::_class_info));
+    for(int64_t i = 0; i < 20; i++) {
+        purchase p(db);
+        p.account_id = (i % 5) + 1;
+        p.amount = i;
+        p.save();
+    }
+
+    auto res = orm::select<purchase>(db).with<account>(&purchase::account_id).fetch();
+    ASSERT_EQ(res.size(), 20);
+    for(auto& p : res) {
+        auto a = res.related<account>(*p, &purchase::account_id);
+        ASSERT_NE(a, nullptr);
+        ASSERT_EQ(a->id, p->account_id);
+        ASSERT_EQ(a->name, "account" + std::to_string(a->id - 1));
+    }
+    // Rows referencing the same account share the entity
+    ASSERT_EQ(res.related<account>(res[0], &purchase::account_id), res.related<account>(res[5], &purchase::account_id));
+}
+
+TEST(SQLITEPP_ORMQuery, Aggregate) {
+    database db;
+    fill_accounts(db, 10);
+
+    auto total = orm::aggregate<account>(db).count().sum(&account::balance).max(&account::name).one();
+    ASSERT_EQ(std::get<0>(total), 10);
+    ASSERT_EQ(std::get<1>(total), 450.0);
+    ASSERT_EQ(std::get<2>(total), "account9");
+
+    auto rows = orm::aggregate<account>(db)
+        .group_by(&account::status)
+        .sum(&account::balance)
+        .avg(&account::balance)
+        .min(&account::id)
+        .where("balance"_c > 0.0)
+        .rows();
+    ASSERT_EQ(rows.size(), 3);
+    std::sort(rows.begin(), rows.end());
+    // status 0: 30, 60, 90 (0 is filtered)
+    ASSERT_EQ(std::get<0>(rows[0]), 0);
+    ASSERT_EQ(std::get<1>(rows[0]), 180.0);
+    ASSERT_EQ(std::get<2>(rows[0]), 60.0);
+    ASSERT_EQ(std::get<3>(rows[0]), 4);
+    // status 1: 10, 40, 70
+    ASSERT_EQ(std::get<0>(rows[1]), 1);
+    ASSERT_EQ(std::get<1>(rows[1]), 120.0);
+
+    auto empty = orm::aggregate<account>(db).sum(&account::status).where("status"_c > 5).one();
+    ASSERT_EQ(std::get<0>(empty), 0);
+}
+
+TEST(SQLITEPP_ORMQuery, UpdateWhere) {
+    database db;
+    fill_accounts(db, 10);
+    db.set_identity_map(std::make_shared<identity_map>());
+
+    auto cached = select_one_shared<account>(db, "id"_c == 2);
+    ASSERT_EQ(cached->status, 1);
+
+    auto changed = update_where<account>(db, set(&account::status, 5), "status"_c == 1);
+    ASSERT_EQ(changed, 3);
+    ASSERT_EQ(count(db, account::_class_info, "status"_c == 5), 3);
+    // The cached entity is stale and must not be returned anymore
+    auto reloaded = select_one_shared<account>(db, "id"_c == 2);
+    ASSERT_NE(reloaded, cached);
+    ASSERT_EQ(reloaded->status, 5);
+
+    changed = update_where<account>(db, { set(&account::status, 0), set(&account::balance, 1) }, "status"_c == 5 || "id"_c == 1);
+    ASSERT_EQ(changed, 4);
+    ASSERT_EQ(orm::aggregate<account>(db).sum(&account::balance).where("status"_c < 1).one(), std::make_tuple(4.0 + 30 + 60 + 90));
+}
+
+TEST(SQLITEPP_ORMQuery, KeysetPagination) {
+    database db;
+    fill_accounts(db, 25);
+
+    auto first = orm::select<account>(db).order_by(&account::balance, sort_order::descending).one();
+    ASSERT_EQ(first->name, "account24");
+
+    std::vector<int64_t> seen;
+    auto query = orm::select<account>(db).where("status"_c != 2).order_by(&account::id).limit(4);
+    auto page = query.all();
+    while(!page.empty()) {
+        ASSERT_LE(page.size(), 4);
+        for(auto& e : page) seen.push_back(e->id);
+        page = query.after(*page.back()).all();
+    }
+    ASSERT_EQ(seen.size(), 17);
+    ASSERT_TRUE(std::is_sorted(seen.begin(), seen.end()));
+
+    auto skipped = orm::select<account>(db).order_by(&account::id).offset(20).all();
+    ASSERT_EQ(skipped.size(), 5);
+    ASSERT_EQ(skipped[0]->id, 21);
+
+    ASSERT_THROW(orm::select<account>(db).order_by(&account::id).after({ 1, 2 }).all(), std::invalid_argument);
+}
+
+TEST(SQLITEPP_ORMQuery, IndexAdvisor) {
+    database db;
+    fill_accounts(db, 50);
+    auto advisor = std::make_shared<index_advisor>();
+    db.set_index_advisor(advisor);
+
+    for(int i = 0; i < 5; i++) {
+        select_multiple<account>(db, "status"_c == 1 && "balance"_c > 100.0);
+    }
+    count(db, account::_class_info, "name"_c.glob("account1*"));
+    count(db, account::_class_info, "name"_c.like("account1%"));
+    count(db, account::_class_info, "id"_c == 3);
+    select_multiple<account>(db, "status"_c == 1 || "name"_c == "x");
+
+    auto usage = advisor->usage(account::_class_info);
+    ASSERT_EQ(usage.size(), 4);
+    ASSERT_EQ(usage[0].column, "status");
+    ASSERT_EQ(usage[0].equality, 6);
+    auto name = std::find_if(usage.begin(), usage.end(), [](const column_usage& u) { return u.column == "name"; });
+    ASSERT_NE(name, usage.end());
+    // LIKE can not use the suggested BINARY index
+    ASSERT_EQ(name->prefix, 1);
+
+    auto suggestions = advisor->suggest(db);
+    // The rowid lookup is already indexed
+    ASSERT_EQ(suggestions.size(), 2);
+    ASSERT_EQ(suggestions[0].columns, std::vector<std::string>({ "status", "balance" }));
+    ASSERT_EQ(suggestions[0].hits, 5);
+    ASSERT_EQ(suggestions[0].statement, "CREATE INDEX `idx_account_status_balance` ON `account` (`status`, `balance`);");
+    ASSERT_EQ(suggestions[1].columns, std::vector<std::string>({ "name" }));
+
+    db.exec(suggestions[0].statement);
+    suggestions = advisor->suggest(db);
+    ASSERT_EQ(suggestions.size(), 1);
+}
+
+TEST(SQLITEPP_ORMQuery, InList) {
+    database db;
+    fill_accounts(db, 20);
+
+    std::vector<int64_t> ids { 3, 5, 7, 100 };
+    auto res = orm::select<account>(db).where("id"_c.in(ids)).order_by(&account::id).all();
+    ASSERT_EQ(res.size(), 3);
+    ASSERT_EQ(res[2]->id, 7);
+    ASSERT_EQ(count(db, account::_class_info, "name"_c.in({ "account1", "account2", "missing" })), 2);
+    ASSERT_EQ(count(db, account::_class_info, "id"_c.not_in(ids) && "status"_c == 1), 6);
+    ASSERT_EQ(count(db, account::_class_info, "id"_c.in(std::vector<int64_t>{})), 0);
+
+    // The query text does not depend on the number of values
+    std::vector<int64_t> many(200000);
+    for(size_t i = 0; i < many.size(); i++) many[i] = static_cast<int64_t>(i) * 2;
+    auto cond = "id"_c.in(many);
+    ASSERT_EQ(cond.str(), "id"_c.in(ids).str());
+    ASSERT_EQ(count(db, account::_class_info, cond), 10);
+}
+
+TEST(SQLITEPP_ORMQuery, DynamicCondition) {
+    database db;
+    fill_accounts(db, 20);
+
+    std::array<std::byte, 1024> buffer;
+    std::pmr::monotonic_buffer_resource resource(buffer.data(), buffer.size());
+    dynamic_condition where(&resource);
+    ASSERT_EQ(count(db, account::_class_info, where), 20);
+
+    std::optional<int64_t> status = 1;
+    std::optional<double> min_balance = 50.0;
+    std::optional<std::string> name;
+    if(status) where &= "status"_c == *status;
+    if(min_balance) where &= "balance"_c >= *min_balance;
+    if(name) where &= "name"_c == *name;
+    ASSERT_EQ(where.str(), ("status"_c == 1 && "balance"_c >= 50.0).str());
+    ASSERT_EQ(where.params().size(), 2);
+    ASSERT_EQ(select_multiple<account>(db, where).size(), 5);
+    ASSERT_EQ(orm::select<account>(db).where(where).all().size(), 5);
+
+    where |= dynamic_condition("`name` = ?", { "account0" });
+    ASSERT_EQ(count(db, account::_class_info, where), 6);
+    ASSERT_EQ(count(db, account::_class_info, !where), 14);
+
+    where.clear();
+    ASSERT_EQ(count(db, account::_class_info, where), 20);
+    ASSERT_THROW(remove(db, account::_class_info, where), std::invalid_argument);
+    where &= "status"_c == 2;
+    ASSERT_EQ(remove(db, account::_class_info, where), 6);
+    ASSERT_EQ(count(db, account::_class_info), 14);
+}
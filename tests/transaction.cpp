@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+#include "sqlitepp/database.h"
+#include "sqlitepp/error_code.h"
+#include "sqlitepp/statement.h"
+#include "sqlitepp/transaction.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+using namespace sqlitepp;
+
+namespace {
+    int64_t count_rows(database& db) {
+        statement stmt(db, "SELECT COUNT(*) FROM t;");
+        auto it = stmt.iterator();
+        it.next();
+        return it.column_int64(0);
+    }
+}
+
+TEST(SQLITEPP_Transaction, RollbackOnDestruction) {
+    database db;
+    db.exec("CREATE TABLE t (a INTEGER);");
+    {
+        transaction tx(db, transaction_mode::immediate);
+        db.exec("INSERT INTO t VALUES (1);");
+    }
+    ASSERT_EQ(count_rows(db), 0);
+    {
+        transaction tx(db);
+        db.exec("INSERT INTO t VALUES (1);");
+        tx.commit();
+        ASSERT_FALSE(tx.is_active());
+        ASSERT_THROW(tx.rollback(), std::logic_error);
+    }
+    ASSERT_EQ(count_rows(db), 1);
+}
+
+TEST(SQLITEPP_Transaction, BusyStrategy) {
+    auto path = (std::filesystem::temp_directory_path() / "sqlitepp_busy_strategy.db").string();
+    std::remove(path.c_str());
+    {
+        database db1(path);
+        database db2(path);
+        db1.exec("CREATE TABLE t (a INTEGER);");
+        ASSERT_THROW(db2.set_busy_strategy(busy_strategy{ std::chrono::milliseconds(1), std::chrono::milliseconds(10), std::chrono::milliseconds(50), 0.5, 0.5 }), std::invalid_argument);
+        db2.set_busy_strategy(busy_strategy{ std::chrono::milliseconds(1), std::chrono::milliseconds(10), std::chrono::milliseconds(50), 2.0, 0.5 });
+
+        auto tx = std::make_unique<transaction>(db1, transaction_mode::immediate);
+        try {
+            db2.exec("INSERT INTO t VALUES (1);");
+            FAIL() << "write succeeded while another connection held the lock";
+        } catch(const std::system_error& e) {
+            ASSERT_EQ(e.code(), make_error_code(error_code::busy));
+        }
+
+        // The waiting writer succeeds once the lock is released. The commit has to wait for the shared lock
+        // db2 briefly holds on every retry as well.
+        db1.set_busy_strategy(busy_strategy{});
+        db2.set_busy_strategy(busy_strategy{});
+        std::thread release([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            tx->commit();
+        });
+        db2.exec("INSERT INTO t VALUES (2);");
+        release.join();
+        ASSERT_EQ(count_rows(db1), 1);
+    }
+    std::remove(path.c_str());
+}
+
+TEST(SQLITEPP_Transaction, WriteScheduler) {
+    auto path = (std::filesystem::temp_directory_path() / "sqlitepp_write_scheduler.db").string();
+    std::remove(path.c_str());
+    {
+        database setup(path);
+        setup.exec("CREATE TABLE t (a INTEGER);");
+
+        write_scheduler scheduler;
+        std::vector<std::thread> threads;
+        for(int i = 0; i < 4; i++) {
+            threads.emplace_back([&]() {
+                database db(path);
+                for(int j = 0; j < 25; j++) {
+                    scheduler.run(db, [](database& db) { db.exec("INSERT INTO t VALUES (1);"); });
+                }
+            });
+        }
+        for(auto& t : threads) t.join();
+        ASSERT_EQ(scheduler.pending(), 0);
+        ASSERT_EQ(count_rows(setup), 100);
+
+        // Failing writers roll back and let the next one in
+        ASSERT_THROW(scheduler.run(setup, [](database& db) {
+            db.exec("INSERT INTO t VALUES (1);");
+            throw std::runtime_error("failed");
+        }), std::runtime_error);
+        ASSERT_EQ(scheduler.run(setup, [](database& db) { return count_rows(db); }), 100);
+    }
+    std::remove(path.c_str());
+}
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include "sqlitepp/database.h"
+#include "sqlitepp/statement.h"
+#include "sqlitepp/vtab.h"
+
+using namespace sqlitepp;
+
+namespace {
+    struct point {
+        int64_t id;
+        std::string name;
+        double x;
+        double y;
+    };
+}
+
+TEST(SQLITEPP_VTab, Container) {
+    std::vector<point> points;
+    for(int64_t i = 0; i < 1000; i++) points.push_back({ i * 2, "p" + std::to_string(i), static_cast<double>(i), 1.0 });
+
+    database db;
+    vtab<point> table;
+    table.column("id", &point::id, true)
+        .column("name", &point::name)
+        .column("x", &point::x)
+        .column("norm", [](const point& p) { return p.x * p.x + p.y * p.y; });
+    table.attach(db, "points", points);
+
+    db.exec("CREATE TABLE t (point_id INTEGER, label TEXT);");
+    db.exec("INSERT INTO t VALUES (10, 'a'), (11, 'b'), (1998, 'c');");
+
+    statement join(db, "SELECT t.label, points.name, points.norm FROM t JOIN points ON points.id = t.point_id ORDER BY t.label;");
+    auto it = join.iterator();
+    ASSERT_TRUE(it.next());
+    ASSERT_EQ(it.column_string(0), "a");
+    ASSERT_EQ(it.column_string(1), "p5");
+    ASSERT_DOUBLE_EQ(it.column_double(2), 26.0);
+    ASSERT_TRUE(it.next());
+    ASSERT_EQ(it.column_string(0), "c");
+    ASSERT_EQ(it.column_string(1), "p999");
+    ASSERT_FALSE(it.next());
+
+    statement range(db, "SELECT COUNT(*), MIN(id), MAX(id) FROM points WHERE id > 100 AND id <= 200 AND x < 90;");
+    auto it2 = range.iterator();
+    ASSERT_TRUE(it2.next());
+    ASSERT_EQ(it2.column_int64(0), 39);
+    ASSERT_EQ(it2.column_int64(1), 102);
+    ASSERT_EQ(it2.column_int64(2), 178);
+
+    // Constraints of a different type than the column are checked by SQLite
+    statement mixed(db, "SELECT COUNT(*) FROM points WHERE id < 10.5 AND id >= '0';");
+    auto it3 = mixed.iterator();
+    ASSERT_TRUE(it3.next());
+    ASSERT_EQ(it3.column_int64(0), 6);
+
+    statement plan(db, "EXPLAIN QUERY PLAN SELECT * FROM points WHERE id = 4 ORDER BY id;");
+    auto it4 = plan.iterator();
+    ASSERT_TRUE(it4.next());
+    ASSERT_NE(it4.column_string(3).find("VIRTUAL TABLE INDEX"), std::string::npos);
+    ASSERT_FALSE(it4.next());
+}
+
+TEST(SQLITEPP_VTab, Collation) {
+    std::vector<std::string> names{ "X", "a", "b", "x", "y" };
+
+    database db;
+    vtab<std::string> table;
+    table.column("name", [](const std::string& s) { return s; }, true);
+    table.attach(db, "names", names);
+
+    // The binary search only knows the binary order of the container
+    statement eq(db, "SELECT COUNT(*) FROM names WHERE name = 'x' COLLATE NOCASE;");
+    auto it = eq.iterator();
+    ASSERT_TRUE(it.next());
+    ASSERT_EQ(it.column_int64(0), 2);
+
+    statement range(db, "SELECT COUNT(*) FROM names WHERE name >= 'x' COLLATE NOCASE;");
+    auto it2 = range.iterator();
+    ASSERT_TRUE(it2.next());
+    ASSERT_EQ(it2.column_int64(0), 3);
+
+    statement binary(db, "SELECT COUNT(*) FROM names WHERE name = 'x';");
+    auto it3 = binary.iterator();
+    ASSERT_TRUE(it3.next());
+    ASSERT_EQ(it3.column_int64(0), 1);
+
+    statement order(db, "SELECT name FROM names ORDER BY name COLLATE NOCASE LIMIT 1;");
+    auto it4 = order.iterator();
+    ASSERT_TRUE(it4.next());
+    ASSERT_EQ(it4.column_string(0), "a");
+}